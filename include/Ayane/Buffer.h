@@ -46,6 +46,11 @@ namespace Ayane {
         
         typedef uint32_t StreamFlags;
         
+        /**
+         *  Creates a buffer of the format, with capacity for the length at
+         *  the format's sample rate. The capacity in frames is computed
+         *  once, and never changes.
+         */
         Buffer ( const BufferFormat &format, const BufferLength &length );
         
         virtual ~Buffer();
@@ -90,17 +95,23 @@ namespace Ayane {
         /**
          *  Returns the maximum amount of frames the buffer may contain.
          */
-        unsigned int frames() const;
+        unsigned int frames() const {
+            return mFrames;
+        }
         
         /**
          *  Returns the number of frames available to be read.
          */
-        unsigned int available() const;
+        unsigned int available() const {
+            return mWriteIndex - mReadIndex;
+        }
         
         /**
          *  Returns the number of frames that have yet to be written.
          */
-        unsigned int space() const;
+        unsigned int space() const {
+            return mFrames - mWriteIndex;
+        }
         
         /**
          *  Resets the read and write pointers.
@@ -197,7 +208,7 @@ namespace Ayane {
         virtual Buffer& operator<< ( const MultiChannel7<SampleFloat32>& ) = 0;
         virtual Buffer& operator<< ( const MultiChannel7<SampleFloat64>& ) = 0;
         
-        virtual Buffer &operator<< ( const Buffer& ) = 0;
+        virtual Buffer &operator<< ( Buffer& ) = 0;
         virtual Buffer &operator<< ( RawBuffer& ) = 0;
         
         /* Readers */
@@ -296,7 +307,9 @@ namespace Ayane {
     protected:
         
         BufferFormat mFormat;
-        BufferLength mLength;
+        
+        // Capacity in frames.
+        const unsigned int mFrames;
         
         // Timestamp
         Duration mTimestamp;
@@ -365,7 +378,7 @@ namespace Ayane {
         virtual TypedBuffer<T>& operator<< ( const MultiChannel7<SampleFloat32>& );
         virtual TypedBuffer<T>& operator<< ( const MultiChannel7<SampleFloat64>& );
         
-        virtual TypedBuffer<T> &operator<< ( const Buffer& );
+        virtual TypedBuffer<T> &operator<< ( Buffer& );
         virtual TypedBuffer<T> &operator<< ( RawBuffer& );
         
         
@@ -394,7 +407,7 @@ namespace Ayane {
         force_inline void write( const MultiChannel7<InSampleType> &frame );
         
         template<typename InSampleType>
-        void write( const TypedBuffer<InSampleType> &buffer );
+        void write( TypedBuffer<InSampleType> &buffer );
         
         void write( RawBuffer &buffer );
         
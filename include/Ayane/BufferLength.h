@@ -68,14 +68,15 @@ namespace Ayane {
         LengthUnits units() const;
         
         /**
-         *  Gets the duration in seconds. If the underlying unit is time,
-         *  the rate parameter may be omitted.
+         *  Gets the duration. If the underlying unit is time, the rate
+         *  parameter may be omitted.
          */
-        double duration( SampleRate rate = 0 ) const;
+        Duration duration( SampleRate rate = 0 ) const;
         
         /**
-         *  Gets the duration in number of frames.  If the underlying unit
-         *  is frames, the rate parameter may be omitted.
+         *  Gets the duration in number of frames, rounded to the nearest
+         *  frame. If the underlying unit is frames, the rate parameter may
+         *  be omitted.
          */
         unsigned int frames( SampleRate rate = 0 ) const;
         
@@ -90,7 +91,7 @@ namespace Ayane {
     private:
         
         LengthUnits mUnits;
-        double mDuration;
+        Duration mDuration;
         unsigned int mFrames;
         
     };
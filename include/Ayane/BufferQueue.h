@@ -25,11 +25,24 @@ namespace Ayane {
         BufferQueue( uint32_t count );
         ~BufferQueue();
         
-        bool push ( ManagedBuffer &inBuffer );
-        bool pop ( ManagedBuffer *outBuffer );
+        /**
+         *  Pushes a buffer, tagged with the generation it was produced in.
+         */
+        bool push ( ManagedBuffer &inBuffer, uint32_t generation = 0 );
+        
+        /**
+         *  Pops a buffer, and optionally the generation it was tagged with.
+         */
+        bool pop ( ManagedBuffer *outBuffer, uint32_t *outGeneration = nullptr );
         
         uint32_t capacity() const;
         
+        /** Gets the number of queued buffers. */
+        uint32_t size() const;
+        
+        /** Gets the number of buffers that can be pushed before full. */
+        uint32_t space() const;
+        
         bool full() const;
         bool empty() const;
         
@@ -46,6 +59,9 @@ namespace Ayane {
         // Dynamic elements array, initialized to the exact size in the
         // initialization list.
         std::vector<ManagedBuffer> mElements;
+        
+        // Generation of each element.
+        std::vector<uint32_t> mGenerations;
     };
     
 }
@@ -9,20 +9,30 @@
 #ifndef AYANE_CLOCK_H_
 #define AYANE_CLOCK_H_
 
-#include <list>
-#include <mutex>
-#include <condition_variable>
+#include <atomic>
+#include <cstdint>
 
+#include "Ayane/Duration.h"
 #include "Ayane/Macros.h"
+#include "Ayane/WakeSource.h"
 
 namespace Ayane {
     
+    class ClockProvider;
+    
     /**
      *  Represents a clock that is advanced asynchronously by an external
      *  driver.
+     *
+     *  The clock's times are stored atomically, so reading them never
+     *  blocks. A clock registered with a ClockProvider sleeps on the
+     *  provider's WakeSource, so that the provider wakes all of its clocks
+     *  at once.
      */
     class Clock {
         
+        friend class ClockProvider;
+        
     public:
         
         Clock();
@@ -32,23 +42,23 @@ namespace Ayane {
          *  Gets the current timestamp of the pipeline. The pipeline timestamp
          *  is driven by the selected clock provider.
          */
-        double pipelineTime() const {
-            return mPipelineTime;
+        Duration pipelineTime() const {
+            return Duration::fromTicks(mPipelineTime.load(std::memory_order_relaxed));
         }
         
         /**
          *  Gets the current output (playback) timestamp.
          */
-        double presentationTime() const {
-            return mPresentationTime;
+        Duration presentationTime() const {
+            return Duration::fromTicks(mPresentationTime.load(std::memory_order_relaxed));
         }
         
         /**
          *  Gets the time delta between the last two successive wait()
          *  calls.
          */
-        double deltaTime() const {
-            return mDeltaTime;
+        Duration deltaTime() const {
+            return Duration::fromTicks(mDeltaTime.load(std::memory_order_relaxed));
         }
         
         /**
@@ -61,21 +71,41 @@ namespace Ayane {
          */
         void stop();
         
+        /**
+         *  Pauses the clock. While paused, advances are discarded, and
+         *  wait() blocks until the clock is resumed or stopped.
+         */
+        void pause();
+        
+        /**
+         *  Resumes a paused clock.
+         */
+        void resume();
+        
+        /**
+         *  Returns true if the clock is paused.
+         */
+        bool isPaused() const {
+            return mPaused.load();
+        }
+        
         /**
          *  Resets the clock to the specified time.
          */
-        void reset( double time = 0.0 );
+        void reset( const Duration &time = Duration() );
         
         /**
          *  Advances the presentation clock by the specified time delta.
          *  All threads that are blocked on a wait() will be unblocked.
+         *  Advances that have not been waited for accumulate.
          */
-        void advancePresentation( double delta );
+        void advancePresentation( const Duration &delta );
         
         /**
-         *  Advances the pipeline clock by the specified time delta.
+         *  Advances the pipeline clock by the specified time delta. Must
+         *  only be called by the clock's owner.
          */
-        void advancePipeline( double delta );
+        void advancePipeline( const Duration &delta );
         
         /**
          *  Waits for the clock to advance. Returns true if the clock is
@@ -83,32 +113,57 @@ namespace Ayane {
          */
         bool wait();
         
+        /**
+         *  Waits until the clock's owner has consumed the last advance and
+         *  is waiting for the next one, the clock is paused and its owner is
+         *  waiting, or the clock is stopped. A clock that has not been
+         *  started is considered idle.
+         */
+        void waitForIdle();
+        
     private:
         AYANE_DISALLOW_COPY_AND_ASSIGN(Clock);
         
+        /**
+         *  Adds an advance without waking the owner. Used by ClockProvider,
+         *  which wakes all of its clocks at once.
+         */
+        void post( int64_t delta );
+        
+        /** Wakes the owner from wait(). */
+        void wake();
+        
         // Is the clock started?
-        bool mStarted;
+        std::atomic<bool> mStarted;
+        
+        // Is the clock paused?
+        std::atomic<bool> mPaused;
+        
+        // Pipeline time (current buffer timestamp) in Duration ticks.
+        std::atomic<int64_t> mPipelineTime;
         
-        // Pipeline time (current buffer timestamp).
-        double mPipelineTime;
+        // Presentation time (playback timestamp) in Duration ticks.
+        std::atomic<int64_t> mPresentationTime;
         
-        // Presentation time (playback timestamp).
-        double mPresentationTime;
+        // Ticks between wait() calls.
+        std::atomic<int64_t> mDeltaTime;
         
-        // Time between wait() calls.
-        double mDeltaTime;
+        // Ticks of advances not yet consumed by wait().
+        std::atomic<int64_t> mUpdateDelta;
         
-        // Latest update delta.
-        double mUpdateDelta;
+        // Is the owner blocked in wait()?
+        std::atomic<bool> mWaiting;
         
-        // Mutex to protect state.
-        std::mutex mStateMutex;
+        // Wakes wait(). Points to the registered provider's wake source, or
+        // to mOwnWakeSource if the clock is not registered.
+        std::atomic<WakeSource*> mWakeSource;
+        WakeSource mOwnWakeSource;
         
-        // Condition variable to notify wait() of an advance().
-        std::condition_variable mAdvanceNotification;
+        // Wakes waitForIdle() when the owner begins waiting.
+        WakeSource mIdleWakeSource;
         
     };
     
 }
 
-#endif
\ No newline at end of file
+#endif
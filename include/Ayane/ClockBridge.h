@@ -0,0 +1,148 @@
+/*
+ *
+ * Copyright (c) 2013 Philip Deljanov. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ */
+
+#ifndef AYANE_CLOCKBRIDGE_H_
+#define AYANE_CLOCKBRIDGE_H_
+
+#include "Ayane/DPointer.h"
+#include "Ayane/ClockProvider.h"
+#include "Ayane/Stage.h"
+
+namespace Ayane {
+
+    class ClockBridgePrivate;
+
+    /**
+     *  A ClockBridge carries a stream from one clock domain to another,
+     *  for example from a pipeline paced by one audio device to a second
+     *  device, or from a capture device into a pipeline. The two devices'
+     *  clocks drift apart, so the bridge resamples the stream by a ratio
+     *  that it continuously adjusts to the drift.
+     *
+     *  The bridge is played with the output clock provider, and produces
+     *  exactly the output domain's elapsed time in frames each clock
+     *  event. Its input is always asynchronous, so the upstream stages
+     *  keep running in the pipeline's clock domain. Input is collected in
+     *  a FIFO, and a slow control loop adjusts the resampling ratio to keep
+     *  the FIFO filled to the target latency. If both clock providers
+     *  smooth their events (see ClockProvider::publishTimestamp()), the
+     *  ratio of their measured rates is also applied directly, so the
+     *  control loop only corrects what remains.
+     *
+     *  Drift is corrected by resampling alone, never by dropping or
+     *  repeating frames. The FIFO is allocated when the input format is
+     *  configured, and never grows while processing. The output is only
+     *  interrupted if the FIFO underruns, after which the bridge refills
+     *  to the target latency before resuming. If the FIFO overruns, the
+     *  oldest unread frames are skipped, a burst longer than the whole
+     *  FIFO is truncated, and the control loop restores the fill level.
+     *  Both events are counted; see underruns() and overruns().
+     */
+    class ClockBridge : public Stage {
+    public:
+
+        ClockBridge();
+        ~ClockBridge();
+
+        /**
+         *  Gets the input sink.
+         */
+        Sink *input();
+
+        /**
+         *  Gets the output source.
+         */
+        Source *output();
+
+        /**
+         *  Sets the clock provider of the output domain, such as a second
+         *  audio device's. Only valid while the stage is not playing.
+         */
+        void setOutputClockProvider(ClockProvider *clockProvider);
+
+        /**
+         *  Sets the clock provider of the input domain, normally the
+         *  pipeline's. Only used to measure the drift between the domains,
+         *  and may be null. Only valid while the stage is not playing.
+         */
+        void setInputClockProvider(ClockProvider *clockProvider);
+
+        /**
+         *  Gets the output sample rate, or 0 if the input sample rate is
+         *  kept.
+         */
+        SampleRate outputSampleRate() const;
+
+        /**
+         *  Sets the output sample rate, or 0 to keep the input sample rate.
+         *  Only valid while the stage is not playing.
+         */
+        void setOutputSampleRate(SampleRate sampleRate);
+
+        /**
+         *  Gets the time, in seconds, the FIFO is kept filled to.
+         */
+        double targetLatency() const;
+
+        /**
+         *  Sets the time, in seconds, the FIFO is kept filled to. Must
+         *  cover the longest interval between input buffers, plus the
+         *  jitter of both domains. The default is 50ms. Only valid while the
+         *  stage is not playing.
+         */
+        void setTargetLatency(double latency);
+
+        /**
+         *  Gets the current ratio of input frames consumed per output
+         *  frame, relative to the nominal ratio of the sample rates.
+         *  Thread-safe.
+         */
+        double correction() const;
+
+        /**
+         *  Gets the time, in seconds, of audio in the FIFO as of the last
+         *  process run. Thread-safe.
+         */
+        double fillLevel() const;
+
+        /**
+         *  Gets the number of times the FIFO ran empty. Thread-safe.
+         */
+        uint64_t underruns() const;
+
+        /**
+         *  Gets the number of times the FIFO was full and input frames
+         *  were skipped. Thread-safe.
+         */
+        uint64_t overruns() const;
+
+        virtual double latency() const;
+
+        virtual ClockProvider *requiredClockProvider();
+
+    protected:
+
+        virtual bool beginPlayback();
+        virtual bool stoppedPlayback();
+        virtual void flushed();
+        virtual void process(ProcessIOFlags *ioFlags);
+        virtual bool reconfigureIO();
+        virtual bool reconfigureInputFormat(const Sink &sink,
+                                            const BufferFormat &format);
+        virtual BufferFormat proposeOutputFormat(const Source &source);
+
+    private:
+        AYANE_DISALLOW_COPY_AND_ASSIGN(ClockBridge);
+
+        ClockBridgePrivate *d_ptr;
+        AYANE_DECLARE_PRIVATE(ClockBridge);
+    };
+
+}
+
+#endif
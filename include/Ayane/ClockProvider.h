@@ -9,7 +9,13 @@
 #ifndef AYANE_CLOCKPROVIDER_H_
 #define AYANE_CLOCKPROVIDER_H_
 
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
 #include "Ayane/Clock.h"
+#include "Ayane/DelayLockedLoop.h"
+#include "Ayane/WakeSource.h"
 
 namespace Ayane {
     
@@ -37,13 +43,19 @@ namespace Ayane {
     /**
      *  A Clock Provider provides a source of time and an interface to
      *  register clocks to be notified of clock events.
+     *
+     *  Subscribed clocks are kept in a lock-free array, so clocks may be
+     *  registered from any thread without blocking the publisher. A clock
+     *  event advances every clock, and then wakes all of them at once
+     *  through the provider's WakeSource. Clock events must be published
+     *  from one thread at a time.
      */
     class ClockProvider {
         
     public:
 
         ClockProvider(ClockCapabilities capabilties, uint64_t defaultPeriod);
-        ~ClockProvider();
+        virtual ~ClockProvider();
         
         /**
          *  Gets the clock period in nanoseconds.
@@ -67,25 +79,133 @@ namespace Ayane {
         }
         
         /**
-         *  Registers a clock to be notified of clock events.
+         *  Registers a clock to be notified of clock events. Returns false
+         *  if kMaxClocks clocks are already registered.
          */
-        void registerClock( Clock* clock );
+        bool registerClock( Clock* clock );
         
         /**
-         *  Cancels a clock's subscription to clock events.
+         *  Cancels a clock's subscription to clock events. Once returned,
+         *  the provider no longer accesses the clock, so it may be deleted.
          */
         void deregisterClock( Clock* clock );
         
+        /** The most clocks that may be registered at once. */
+        static const size_t kMaxClocks = 256;
+        
+        /**
+         *  Publishes a clock event to the provider's subscribers, advancing
+         *  them by the specified time.
+         */
+        void publish( const Duration &time );
+        
+        /**
+         *  Publishes a clock event measured at the specified time, in
+         *  seconds on a monotonic clock, such as a device callback's
+         *  timestamp. The times are smoothed by a DelayLockedLoop, and the
+         *  filtered time since the last event is published, so jitter in
+         *  the measurements does not reach the clocks. The loop locks on the
+         *  first event, and relocks if the clock period changes or an event
+         *  is more than kRelockPeriods periods from its prediction. An event
+         *  that locks the loop publishes one clock period.
+         */
+        void publishTimestamp( double time );
+        
+        /** Prediction error, in periods, beyond which the loop relocks. */
+        static const int kRelockPeriods = 4;
+        
+        /**
+         *  Sets the bandwidth of the smoothing loop in Hz. Takes effect when
+         *  the loop next locks. The default is 1Hz.
+         */
+        void setSmoothingBandwidth( double bandwidth );
+        
+        /**
+         *  Relocks the smoothing loop on the next publishTimestamp(), for
+         *  example after the device was restarted.
+         */
+        void resetSmoothing();
+        
+        /**
+         *  Gets the filtered time of the last event published with
+         *  publishTimestamp(). Thread-safe.
+         */
+        double filteredTime() const {
+            return mFilteredTime.load(std::memory_order_relaxed);
+        }
+        
+        /**
+         *  Gets the predicted time of the next event. Stages may use it to
+         *  schedule work ahead of the event. Thread-safe.
+         */
+        double predictedTime() const {
+            return mPredictedTime.load(std::memory_order_relaxed);
+        }
+        
+        /**
+         *  Gets the ratio of the measured period between events to the
+         *  clock period. Measures the drift of the provider against the
+         *  clock the event times were measured with. Thread-safe.
+         */
+        double rateRatio() const {
+            return mRateRatio.load(std::memory_order_relaxed);
+        }
+        
+        /**
+         *  Gets the RMS jitter of the measured event times in seconds.
+         *  Thread-safe.
+         */
+        double jitter() const {
+            return mJitter.load(std::memory_order_relaxed);
+        }
+        
+    protected:
+        
         /**
-         *  Publishes a clock event to the provider's subscribers.
+         *  Publishes a clock event, and then waits for every subscriber to
+         *  finish processing it. Returns the number of subscribers that are
+         *  not paused.
          */
-        void publish( double time );
+        size_t publishAndWait( const Duration &time );
         
     private:
         AYANE_DISALLOW_COPY_AND_ASSIGN(ClockProvider);
         
         ClockCapabilities mCapabilities;
-        std::list<Clock*> mSubscribers;
+        
+        /**
+         *  Waits until any clock event being published when called has
+         *  been published.
+         */
+        void synchronize() const;
+        
+        // Subscribed clocks. Free slots are null.
+        std::atomic<Clock*> mSubscribers[kMaxClocks];
+        
+        // One past the highest slot ever used.
+        std::atomic<size_t> mSubscriberEnd;
+        
+        // Publish epoch. Odd while a clock event is being published.
+        std::atomic<uint64_t> mEpoch;
+        
+        // Wakes the subscribed clocks.
+        WakeSource mWakeSource;
+        
+        // Event time smoothing. The loop is only accessed by the publisher.
+        DelayLockedLoop mLoop;
+        uint64_t mLoopPeriod;
+        
+        // Filtered time of the last event, rounded to Duration ticks. Deltas
+        // are taken between rounded times so that rounding never accumulates.
+        int64_t mLoopTicks;
+        std::atomic<double> mLoopBandwidth;
+        std::atomic<bool> mRelock;
+        
+        // Smoothing results for other threads.
+        std::atomic<double> mFilteredTime;
+        std::atomic<double> mPredictedTime;
+        std::atomic<double> mRateRatio;
+        std::atomic<double> mJitter;
         
         uint64_t mClockPeriod;
     };
@@ -0,0 +1,120 @@
+/*
+ *
+ * Copyright (c) 2013 Philip Deljanov. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ */
+
+#ifndef AYANE_DELAYLINE_H_
+#define AYANE_DELAYLINE_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "Ayane/Macros.h"
+#include "Ayane/BufferFormat.h"
+#include "Ayane/SampleFormats.h"
+
+namespace Ayane {
+
+    class Buffer;
+
+    /**
+     *  A DelayLine delays the audio passing through a series of buffers by a
+     *  fixed time. The first buffers after the line is configured are
+     *  preceded by silence.
+     *
+     *  Delayed frames are stored in the buffers' own sample format, so the
+     *  delay is bit-exact. Storage is only allocated by reserve(), and is
+     *  sized for the widest sample format, so buffers of any sample format
+     *  with the reserved channel count and sample rate can be delayed.
+     *  process() never allocates. Buffers that do not fit the storage are
+     *  passed through undelayed.
+     */
+    class DelayLine {
+    public:
+
+        /**
+         *  Instantiates a delay line that delays by the specified number of
+         *  seconds.
+         */
+        explicit DelayLine(double delay = 0.0);
+
+        /**
+         *  Gets the delay in seconds.
+         */
+        double delay() const {
+            return mDelay;
+        }
+
+        /**
+         *  Sets the delay in seconds. Any delayed frames are discarded. If
+         *  storage was reserved, it is reserved again for the new delay.
+         */
+        void setDelay(double delay);
+
+        /**
+         *  Gets the delay in frames at the configured sample rate.
+         */
+        uint32_t delayFrames() const {
+            return mDelayFrames;
+        }
+
+        /**
+         *  Allocates storage for buffers of the specified sample format and
+         *  buffer format, holding up to maxFrames frames. Any delayed frames
+         *  are discarded.
+         */
+        void reserve(SampleFormat sampleFormat, const BufferFormat &format,
+                     uint32_t maxFrames);
+
+        /**
+         *  Delays the frames available in the buffer in place. The buffer's
+         *  timestamp and flags are kept. Returns false, and leaves the
+         *  buffer undelayed, if the buffer does not fit the reserved
+         *  storage.
+         */
+        bool process(Buffer &buffer);
+        
+        /**
+         *  Gets the number of buffers passed through undelayed because they
+         *  did not fit the reserved storage.
+         */
+        uint64_t bypassed() const {
+            return mBypassed;
+        }
+
+        /**
+         *  Replaces the delayed frames with silence.
+         */
+        void clear();
+
+    private:
+        AYANE_DISALLOW_COPY_AND_ASSIGN(DelayLine);
+        
+        bool layout(SampleFormat sampleFormat, const BufferFormat &format,
+                    uint32_t maxFrames);
+
+        double mDelay;
+        uint32_t mDelayFrames;
+
+        // Configured format.
+        SampleFormat mSampleFormat;
+        BufferFormat mFormat;
+
+        // Frames per channel in the storage (delay plus largest buffer).
+        uint32_t mFramesPerChannel;
+        
+        // Largest buffer reserved for.
+        uint32_t mMaxFrames;
+        
+        uint64_t mBypassed;
+
+        // Planar storage in the configured sample format.
+        std::vector<uint8_t> mStorage;
+    };
+
+}
+
+#endif
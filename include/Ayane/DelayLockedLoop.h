@@ -0,0 +1,125 @@
+/*
+ *
+ * Copyright (c) 2013 Philip Deljanov. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ */
+
+#ifndef AYANE_DELAYLOCKEDLOOP_H_
+#define AYANE_DELAYLOCKEDLOOP_H_
+
+#include "Ayane/Macros.h"
+
+namespace Ayane {
+
+    /**
+     *  A DelayLockedLoop filters the jitter out of a series of measured
+     *  tick times, such as the timestamps of device callbacks.
+     *
+     *  The loop is a second order filter that tracks both the time of the
+     *  ticks and their true period. The period estimate converges on the
+     *  device's actual rate, so comparing it against the nominal period
+     *  measures the drift between the device and the clock the times were
+     *  measured with. All times are in seconds.
+     */
+    class DelayLockedLoop {
+    public:
+
+        /**
+         *  Instantiates a loop with the specified bandwidth in Hz. Lower
+         *  bandwidths reject more jitter, but take longer to follow changes
+         *  in the period.
+         */
+        explicit DelayLockedLoop(double bandwidth = 1.0);
+
+        /**
+         *  Gets the loop bandwidth in Hz.
+         */
+        double bandwidth() const {
+            return mBandwidth;
+        }
+
+        /**
+         *  Sets the loop bandwidth in Hz. Takes effect on the next reset().
+         */
+        void setBandwidth(double bandwidth) {
+            mBandwidth = bandwidth;
+        }
+
+        /**
+         *  Restarts the loop at a tick measured at the specified time, with
+         *  the nominal period between ticks.
+         */
+        void reset(double time, double period);
+
+        /**
+         *  Returns true if the loop has been reset at least once.
+         */
+        bool isLocked() const {
+            return mNominalPeriod > 0.0;
+        }
+
+        /**
+         *  Updates the loop with the measured time of the next tick, and
+         *  returns the filtered time of that tick.
+         */
+        double update(double time);
+
+        /**
+         *  Gets the filtered time of the last tick.
+         */
+        double time() const {
+            return mTime;
+        }
+
+        /**
+         *  Gets the predicted time of the next tick.
+         */
+        double nextTime() const {
+            return mNextTime;
+        }
+
+        /**
+         *  Gets the estimated period between ticks.
+         */
+        double period() const {
+            return mPeriod;
+        }
+
+        /**
+         *  Gets the ratio of the estimated period to the nominal period.
+         *  Greater than 1 if the ticks are slower than nominal.
+         */
+        double rateRatio() const {
+            return (mNominalPeriod > 0.0) ? (mPeriod / mNominalPeriod) : 1.0;
+        }
+
+        /**
+         *  Gets the RMS difference between the measured and predicted tick
+         *  times, averaged over roughly the loop's time constant.
+         */
+        double jitter() const;
+
+    private:
+        AYANE_DISALLOW_COPY_AND_ASSIGN(DelayLockedLoop);
+
+        double mBandwidth;
+
+        // Loop coefficients.
+        double mB;
+        double mC;
+
+        double mNominalPeriod;
+
+        double mTime;
+        double mNextTime;
+        double mPeriod;
+
+        // Smoothed squared prediction error.
+        double mErrorPower;
+    };
+
+}
+
+#endif
@@ -9,45 +9,96 @@
 #ifndef AYANE_DURATION_H_
 #define AYANE_DURATION_H_
 
+#include <cstdint>
+
+#include "Ayane/SampleFormats.h"
+
 namespace Ayane {
-    
+
+    /**
+     *  A Duration is a span of time, or a point in time on a stream's
+     *  timeline, stored as a 64-bit count of ticks.
+     *
+     *  There are kTicksPerSecond ticks in a second. The tick rate is a
+     *  multiple of every common sample rate (8kHz to 192kHz, in both the
+     *  44.1kHz and 48kHz families), so a whole number of frames at those
+     *  rates is always a whole number of ticks. Timestamps built from frame
+     *  counts therefore never accumulate rounding error, and convert back to
+     *  the same frame counts exactly. Durations cover about 400 years.
+     */
     class Duration
     {
     public:
-        
+
+        /** Number of ticks in a second. */
+        static const int64_t kTicksPerSecond = 705600000;
+
+        Duration ();
         Duration ( double seconds );
         Duration ( unsigned int minutes, double seconds );
         Duration ( unsigned int hours, unsigned int minutes, double seconds );
         Duration ( unsigned int days, unsigned int hours, unsigned int minutes, double seconds );
-        
+
+        /**
+         *  Gets the duration of a number of ticks.
+         */
+        static Duration fromTicks( int64_t ticks );
+
+        /**
+         *  Gets the duration of a number of frames at the sample rate.
+         *  Exact if the rate divides kTicksPerSecond, and rounded to the
+         *  nearest tick otherwise.
+         */
+        static Duration fromFrames( int64_t frames, SampleRate rate );
+
+        /**
+         *  Gets the duration of a number of nanoseconds, rounded to the
+         *  nearest tick.
+         */
+        static Duration fromNanoseconds( int64_t nanoseconds );
+
+        /**
+         *  Gets the duration in ticks.
+         */
+        int64_t ticks() const {
+            return mTicks;
+        }
+
+        /**
+         *  Gets the duration in frames at the sample rate, rounded to the
+         *  nearest frame.
+         */
+        int64_t frames( SampleRate rate ) const;
+
         double totalDays() const;
         double totalHours() const;
         double totalMinutes() const;
         double totalSeconds() const;
-        
+
         unsigned int days() const;
         unsigned int hours() const;
         unsigned int minutes() const;
         double seconds() const;
-        
-        Duration& operator= ( const Duration& rhs );
-        
+
         bool operator== ( const Duration &rhs ) const;
         bool operator!= ( const Duration &rhs ) const;
         bool operator> ( const Duration &rhs ) const;
         bool operator>= ( const Duration &rhs ) const;
         bool operator< ( const Duration &rhs ) const;
         bool operator<= ( const Duration &rhs ) const;
-        
-        Duration operator+ ( const Duration &rhs );
-        Duration operator- ( const Duration &rhs );
-        
+
+        Duration operator+ ( const Duration &rhs ) const;
+        Duration operator- ( const Duration &rhs ) const;
+
+        Duration& operator+= ( const Duration &rhs );
+        Duration& operator-= ( const Duration &rhs );
+
     private:
-        
-        double mTime;
-        
+
+        int64_t mTicks;
+
     };
-    
+
 }
 
 #endif
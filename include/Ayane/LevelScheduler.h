@@ -0,0 +1,175 @@
+/*
+ *
+ * Copyright (c) 2013 Philip Deljanov. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ */
+
+#ifndef AYANE_LEVELSCHEDULER_H_
+#define AYANE_LEVELSCHEDULER_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "Ayane/Macros.h"
+#include "Ayane/DPointer.h"
+#include "Ayane/ThreadAttributes.h"
+
+namespace Ayane {
+
+    class Stage;
+    class ClockProvider;
+    class LevelSchedulerPrivate;
+
+    /**
+     *  LevelStatistics describes the run time behaviour of a single
+     *  dependency level of a LevelScheduler.
+     */
+    typedef struct LevelStatistics {
+    public:
+
+        /** The number of stages in the level. */
+        uint32_t stages;
+
+        /** The time in nanoseconds the last run of the level took. */
+        uint64_t lastDuration;
+
+        /** The longest time in nanoseconds a run of the level took. */
+        uint64_t maxDuration;
+
+        /**
+         *  The number of cycles in which the cycle deadline (the clock
+         *  period) expired while this level was running.
+         */
+        uint64_t deadlineMisses;
+
+        LevelStatistics() :
+        stages(0),
+        lastDuration(0),
+        maxDuration(0),
+        deadlineMisses(0)
+        {
+
+        }
+
+    } LevelStatistics;
+
+    /**
+     *  A LevelScheduler executes a graph of linked Stages on a pool of
+     *  worker threads.
+     *
+     *  The graph is split into dependency levels. A level contains every
+     *  Stage whose upstream Stages all belong to earlier levels. Each clock
+     *  cycle, the levels are executed in order, and all Stages within a
+     *  level run concurrently. A level only begins once every Stage of the
+     *  previous level has finished (a per-cycle barrier), so independent
+     *  branches (for example, many decoders feeding a mixer) are processed
+     *  in parallel and joined at their consumer within a single clock
+     *  period.
+     *
+     *  Stages driven by a LevelScheduler do not create their own processing
+     *  threads or clocks. All of their links are queued, and pulls never
+     *  block since the producer has always finished its cycle before the
+     *  consumer runs. Stages that require their own clock provider stay
+     *  outside the scheduler; pulls from them return whatever has been
+     *  pushed, or kBufferQueueEmpty, rather than waiting.
+     */
+    class LevelScheduler {
+    public:
+
+        /**
+         *  Instantiates a scheduler with the specified number of worker
+         *  threads. If workers is 0, one worker per hardware thread is
+         *  used. The scheduling thread always participates in the work, so
+         *  1 worker means no additional threads are created.
+         */
+        explicit LevelScheduler(unsigned int workers = 0);
+        ~LevelScheduler();
+
+        /**
+         *  Splits the Stages into dependency levels. Links to Stages that
+         *  are not part of the collection are ignored. Returns false if the
+         *  Stages do not form an acyclic graph. Only valid while stopped.
+         */
+        bool build(const std::vector<Stage*> &stages);
+
+        /**
+         *  Attaches the Stages to the scheduler. Must be called after build
+         *  and before the Stages are played.
+         */
+        void attach();
+
+        /**
+         *  Detaches the Stages from the scheduler. Must be called after the
+         *  Stages are stopped.
+         */
+        void detach();
+
+        /**
+         *  Starts executing the levels, clocked by the clock provider.
+         *  Returns false if already started, or if the scheduler's clock
+         *  could not be registered with the clock provider.
+         */
+        bool start(ClockProvider &clockProvider);
+
+        /**
+         *  Stops executing the levels. Blocks until the current cycle
+         *  completes.
+         */
+        void stop();
+        
+        /**
+         *  Pauses executing the levels. The scheduling and worker threads
+         *  are kept. Returns after the current cycle completes.
+         */
+        void pause();
+        
+        /**
+         *  Resumes executing the levels.
+         */
+        void resume();
+
+        /**
+         *  Sets the attributes applied to the scheduling and worker threads
+         *  when they start. Only valid while stopped.
+         */
+        void setThreadAttributes(const ThreadAttributes &attributes);
+
+        /**
+         *  Gets the union of attributes that failed to apply on any of the
+         *  scheduling or worker threads when they last started.
+         */
+        ThreadAttributes::Failures threadAttributeFailures() const;
+
+        /**
+         *  Gets the number of worker threads (including the scheduling
+         *  thread).
+         */
+        unsigned int workerCount() const;
+
+        /**
+         *  Gets the number of dependency levels.
+         */
+        unsigned int levelCount() const;
+
+        /**
+         *  Gets the Stages in the specified level.
+         */
+        const std::vector<Stage*> &level(unsigned int index) const;
+
+        /**
+         *  Gets the run time statistics of the specified level.
+         */
+        LevelStatistics statistics(unsigned int index) const;
+
+    private:
+        AYANE_DISALLOW_COPY_AND_ASSIGN(LevelScheduler);
+
+        LevelSchedulerPrivate *d_ptr;
+        AYANE_DECLARE_PRIVATE(LevelScheduler);
+    };
+
+}
+
+#endif
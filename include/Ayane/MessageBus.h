@@ -12,10 +12,14 @@
 #include <string>
 #include <functional>
 #include <atomic>
+#include <cstdint>
+#include <new>
+#include <utility>
 
 #include "Ayane/Macros.h"
 #include "Ayane/DPointer.h"
 #include "Ayane/Duration.h"
+#include "Ayane/ThreadAttributes.h"
 
 namespace Ayane {
     
@@ -50,9 +54,22 @@ namespace Ayane {
         
     } MessageType;
     
+    /**
+     *  A set of message types, as a bitwise OR of MessageType values.
+     */
+    typedef uint32_t MessageTypes;
+    
+    /** Every message type. */
+    const MessageTypes kAllMessages = 0xffffffff;
+    
+    class Stage;
+    
+    
+    class MessagePool;
     
     /** Message base class. */
     class MessageBase {
+        friend class MessageBus;
         friend class MessageBusPrivate;
         
     public:
@@ -69,7 +86,8 @@ namespace Ayane {
         
     protected:
         
-        MessageBase(MessageType type) : mType(type), mNext(nullptr)
+        MessageBase(MessageType type) :
+        mType(type), mNext(nullptr), mPool(nullptr), mCoalescingSlot(-1)
         {
         }
         
@@ -78,46 +96,92 @@ namespace Ayane {
     private:
         std::atomic<MessageBase*> mNext;
         
+        // The pool the message was allocated from, or null if it was
+        // allocated with new.
+        MessagePool *mPool;
+        
+        // The bus' coalescing slot the message carries the latest value of,
+        // or -1 if the message is not coalesced.
+        int mCoalescingSlot;
+        
     };
     
-    class ErrorMessage : public MessageBase {
+    /**
+     *  Base class of messages carrying text. The text is stored inline, and
+     *  truncated to kMaxLength - 1 characters, so that constructing the
+     *  message never allocates.
+     */
+    class TextMessage : public MessageBase {
+    public:
+        
+        static const size_t kMaxLength = 256;
+        
+        /**
+         *  Gets the text of the message.
+         */
+        const char *text() const {
+            return mText;
+        }
+        
+    protected:
+        
+        TextMessage(MessageType type, const char *text) : MessageBase(type)
+        {
+            size_t length = 0;
+            
+            while( (length < (kMaxLength - 1)) && (text[length] != '\0') ) {
+                mText[length] = text[length];
+                ++length;
+            }
+            
+            mText[length] = '\0';
+        }
+        
+    private:
+        char mText[kMaxLength];
+    };
+    
+    class ErrorMessage : public TextMessage {
         
     public:
+        ErrorMessage(const char *message) : TextMessage(kError, message)
+        {
+        }
+        
         ErrorMessage(const std::string &message) :
-        MessageBase(kWarning), mMessage(message)
+        TextMessage(kError, message.c_str())
         {
         }
         
         static MessageType type() { return kError; }
-        
-    private:
-        std::string mMessage;
     };
     
-    class WarningMessage : public MessageBase {
+    class WarningMessage : public TextMessage {
     public:
+        WarningMessage(const char *message) : TextMessage(kWarning, message)
+        {
+        }
+        
         WarningMessage(const std::string &message) :
-        MessageBase(kWarning), mMessage(message)
+        TextMessage(kWarning, message.c_str())
         {
         }
         
         static MessageType type() { return kWarning; }
-        
-    private:
-        std::string mMessage;
     };
     
-    class TraceMessage : public MessageBase {
+    class TraceMessage : public TextMessage {
     public:
+        TraceMessage(const char *message) : TextMessage(kTrace, message)
+        {
+        }
+        
         TraceMessage(const std::string &message) :
-        MessageBase(kTrace), mMessage(message)
+        TextMessage(kTrace, message.c_str())
         {
         }
         
         static MessageType type() { return kTrace; }
-        
-    private:
-        std::string mMessage;
     };
     
     class DurationMessage : public MessageBase {
@@ -130,21 +194,37 @@ namespace Ayane {
         
         static MessageType type() { return kDuration; }
         
+        const Duration &duration() const {
+            return mDuration;
+        }
+        
     private:
         Duration mDuration;
     };
     
     class ProgressMessage : public MessageBase {
     public:
-        ProgressMessage(const Duration &duration) :
+        ProgressMessage(const Duration &duration, const Stage *source = nullptr) :
         MessageBase(kProgress),
-        mDuration(duration)
+        mDuration(duration),
+        mSource(source)
         {
         }
         
         static MessageType type() { return kProgress; }
         
+        /**
+         *  Gets the stage that published the progress, or null if it was
+         *  not specified. Progress is coalesced per source.
+         */
+        const Stage *source() const {
+            return mSource;
+        }
+        
         Duration mDuration;
+        
+    private:
+        const Stage *mSource;
     };
     
     class EndOfStreamMessage : public MessageBase {
@@ -169,17 +249,74 @@ namespace Ayane {
     };
     
     
+    /**
+     *  A MessagePool is a fixed set of equally sized blocks of memory that
+     *  messages are constructed in. Acquiring and releasing blocks is
+     *  lock-free, and never allocates.
+     */
+    class MessagePool {
+    public:
+        
+        MessagePool(size_t size, uint32_t capacity);
+        ~MessagePool();
+        
+        /**
+         *  Acquires a block, or returns null if every block is in use.
+         *  Thread-safe.
+         */
+        void *acquire();
+        
+        /**
+         *  Returns a block acquired from this pool. Thread-safe.
+         */
+        void release(void *block);
+        
+        /**
+         *  Gets the number of blocks in the pool.
+         */
+        uint32_t capacity() const {
+            return mCapacity;
+        }
+        
+    private:
+        AYANE_DISALLOW_COPY_AND_ASSIGN(MessagePool);
+        
+        size_t mStride;
+        uint32_t mCapacity;
+        
+        unsigned char *mStorage;
+        
+        // Index of the next free block after each free block.
+        std::atomic<uint32_t> *mNextFree;
+        
+        // Index of the first free block in the low 32 bits, and a count of
+        // changes in the high 32 bits so a stale head can't be swapped in.
+        std::atomic<uint64_t> mFreeHead;
+    };
+    
+    
     /**
      *  Message subscriber callback type.
      */
     typedef std::function<void(const MessageBase&)> MessageHandler;
     
+    /**
+     *  Identifies a subscription to a MessageBus.
+     */
+    typedef uint32_t Subscription;
+    
     
     class MessageBusPrivate;
     
     /**
      *  A MessageBus is a multi-publisher message queue that provides a
-     *  lockless message posting interface.
+     *  lockless message posting interface. Messages are delivered to the
+     *  subscribers on the bus' dispatch thread in the order they were
+     *  published.
+     *
+     *  Each message type has a preallocated pool of messages. Publishing a
+     *  pooled message with publish<T>() never allocates or blocks, so it
+     *  is safe on realtime threads.
      */
     class MessageBus {
     public:
@@ -192,18 +329,114 @@ namespace Ayane {
         
         bool isRunning() const;
         
+        /**
+         *  Sets the attributes applied to the dispatch thread when it
+         *  starts. Only valid while stopped.
+         */
+        void setThreadAttributes(const ThreadAttributes &attributes);
+        
+        /**
+         *  Gets the attributes that failed to apply when the dispatch thread
+         *  last started.
+         */
+        ThreadAttributes::Failures threadAttributeFailures() const;
+        
+        /**
+         *  Publishes a message allocated with new. The bus takes ownership
+         *  of the message, and deletes it once dispatched.
+         */
         void publish(MessageBase *message);
         
-        void subscribe(MessageType type, MessageHandler &handler);
-        void unsubscribe(MessageType type, MessageHandler &handler);
+        /**
+         *  Constructs a message of type T from the arguments in a block
+         *  from T's pool, and publishes it. Never allocates, so it may be
+         *  used on realtime threads. Returns false, and drops the message,
+         *  if T's pool is exhausted.
+         */
+        template<typename T, typename... Args>
+        bool publish(Args&&... args);
+        
+        /**
+         *  Gets the number of messages dropped because their pool was
+         *  exhausted.
+         */
+        uint64_t droppedMessages() const;
+        
+        /**
+         *  Enables or disables coalescing of progress messages. While
+         *  enabled, at most one ProgressMessage per source is queued at a
+         *  time. Progress published while one is queued only updates it,
+         *  so it is delivered with the latest duration published before
+         *  dispatch. Up to 32 sources are coalesced, and progress from
+         *  further sources is queued normally. Disabled by default.
+         */
+        void setCoalesceProgress(bool coalesce);
+        
+        /**
+         *  Gets whether progress messages are coalesced.
+         */
+        bool coalesceProgress() const;
+        
+        /**
+         *  Sets the minimum interval between ProgressMessages delivered
+         *  for each source. Progress dispatched sooner after the source's
+         *  last delivered progress is held back, replacing any held before
+         *  it, and the latest is delivered once the interval elapses. So
+         *  the last progress published is always delivered, even if
+         *  publishing stops. Rate limiting shares the 32 coalescing slots,
+         *  so progress from further sources is not limited. An interval of
+         *  0, the default, delivers all progress.
+         */
+        void setProgressInterval(const Duration &interval);
+        
+        /**
+         *  Gets the minimum interval between delivered progress messages.
+         */
+        Duration progressInterval() const;
+        
+        /**
+         *  Subscribes a handler to every message whose type is in the set
+         *  of types. Any number of handlers may be subscribed to a type,
+         *  and are called in the order they subscribed. Handlers are
+         *  called on the dispatch thread, and must not subscribe or
+         *  unsubscribe. Returns the subscription, for unsubscribe().
+         */
+        Subscription subscribe(MessageTypes types, const MessageHandler &handler);
+        
+        /**
+         *  Removes a subscription. Once this returns, the handler is not
+         *  called again.
+         */
+        void unsubscribe(Subscription subscription);
         
     private:
         AYANE_DISALLOW_COPY_AND_ASSIGN(MessageBus);
         
+        MessagePool *pool(MessageType type);
+        void dropped();
+        
         MessageBusPrivate *d_ptr;
         AYANE_DECLARE_PRIVATE(MessageBus);
     };
     
+    template<typename T, typename... Args>
+    bool MessageBus::publish(Args&&... args) {
+        
+        MessagePool *messagePool = pool(T::type());
+        void *block = messagePool ? messagePool->acquire() : nullptr;
+        
+        if( block == nullptr ) {
+            dropped();
+            return false;
+        }
+        
+        T *message = new (block) T(std::forward<Args>(args)...);
+        static_cast<MessageBase*>(message)->mPool = messagePool;
+        
+        publish(message);
+        return true;
+    }
+    
     
 }
 
@@ -0,0 +1,104 @@
+/*
+ *
+ * Copyright (c) 2013 Philip Deljanov. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ */
+
+#ifndef AYANE_OFFLINECLOCKPROVIDER_H_
+#define AYANE_OFFLINECLOCKPROVIDER_H_
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+
+#include "Ayane/ClockProvider.h"
+
+namespace Ayane {
+
+    /**
+     *  An OfflineClockProvider is a free-running clock provider for
+     *  rendering faster than realtime, for example when transcoding or
+     *  rendering to a file.
+     *
+     *  Instead of being paced by a device, the provider publishes the next
+     *  clock event as soon as every registered clock has finished
+     *  processing the last one. The pipeline therefore runs as fast as its
+     *  slowest stage allows. Every event advances time by exactly one
+     *  period of frames at the sample rate, so timestamps are the same on
+     *  every run and do not drift from the frame position.
+     */
+    class OfflineClockProvider : public ClockProvider {
+
+    public:
+
+        /**
+         *  Instantiates a provider that advances by framesPerTick frames of
+         *  the specified sample rate on each clock event.
+         */
+        OfflineClockProvider(uint32_t sampleRate, uint32_t framesPerTick);
+        ~OfflineClockProvider();
+
+        /**
+         *  Starts publishing clock events. Should be called after the stages
+         *  are playing, since events are published as fast as the
+         *  registered clocks consume them.
+         */
+        void start();
+
+        /**
+         *  Stops publishing clock events. Blocks until the current event has
+         *  been processed.
+         */
+        void stop();
+
+        /**
+         *  Gets whether clock events are being published. Becomes false once
+         *  the frame limit is reached.
+         */
+        bool isRunning() const {
+            return mRunning.load(std::memory_order_acquire);
+        }
+
+        /**
+         *  Sets the number of frames after which no more clock events are
+         *  published. 0 (the default) publishes until stopped, for example
+         *  on an EndOfStreamMessage.
+         */
+        void setFrameLimit(uint64_t frames) {
+            mFrameLimit = frames;
+        }
+
+        /**
+         *  Gets the number of frames published so far.
+         */
+        uint64_t frames() const {
+            return mFrames.load(std::memory_order_acquire);
+        }
+
+        /**
+         *  Gets the time published so far.
+         */
+        Duration time() const {
+            return Duration::fromFrames(static_cast<int64_t>(frames()), mSampleRate);
+        }
+
+    private:
+        AYANE_DISALLOW_COPY_AND_ASSIGN(OfflineClockProvider);
+
+        void run();
+
+        uint32_t mSampleRate;
+        uint32_t mFramesPerTick;
+
+        std::atomic<uint64_t> mFrameLimit;
+        std::atomic<uint64_t> mFrames;
+        std::atomic<bool> mRunning;
+
+        std::thread mThread;
+    };
+
+}
+
+#endif
@@ -61,9 +61,16 @@ namespace Ayane {
          */
         ClockProvider &clockProvider();
         
+        /**
+         *  Offers the device's clock provider to the pipeline.
+         */
+        virtual ClockProvider *providedClockProvider();
+        
     protected:
         virtual bool beginPlayback();
         virtual bool stoppedPlayback();
+        virtual void pausedPlayback();
+        virtual void resumedPlayback();
         virtual void process(ProcessIOFlags *ioFlags);
         virtual bool reconfigureIO();
         virtual bool reconfigureInputFormat(const Sink &sink,
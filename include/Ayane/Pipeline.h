@@ -14,11 +14,14 @@
 
 #include "Ayane/Macros.h"
 #include "Ayane/DPointer.h"
+#include "Ayane/SampleFormatPlanner.h"
+#include "Ayane/ThreadAttributes.h"
 
 namespace Ayane {
     
     class Stage;
     class MessageBus;
+    class LevelScheduler;
     class PipelinePrivate;
     
     /**
@@ -27,6 +30,26 @@ namespace Ayane {
     class Pipeline {
     public:
         
+        /**
+         *  Enumeration of pipeline execution modes.
+         */
+        typedef enum {
+            
+            /**
+             *  Each Stage decides its own synchronicity, and asynchronous
+             *  Stages run on their own processing threads.
+             */
+            kStageThreads,
+            
+            /**
+             *  The Stages are split into dependency levels and run by a
+             *  LevelScheduler. Stages within a level run in parallel on a
+             *  pool of worker threads.
+             */
+            kLevelParallel
+            
+        } ExecutionMode;
+        
         Pipeline();
         ~Pipeline();
         
@@ -36,11 +59,120 @@ namespace Ayane {
         
         MessageBus &messageBus();
         
+        /**
+         *  Gets the execution mode.
+         */
+        ExecutionMode executionMode() const;
+        
+        /**
+         *  Sets the execution mode, and for kLevelParallel, the number of
+         *  worker threads (0 selects one per hardware thread). Only valid
+         *  while the pipeline is not playing.
+         */
+        bool setExecutionMode(ExecutionMode mode, unsigned int workers = 0);
+        
+        /**
+         *  Gets the level scheduler if the pipeline is playing in the
+         *  kLevelParallel execution mode, or null otherwise.
+         */
+        const LevelScheduler *levelScheduler() const;
+        
+        /**
+         *  Gets the attributes applied to the pipeline's processing threads.
+         */
+        ThreadAttributes threadAttributes() const;
+        
+        /**
+         *  Sets the attributes applied to the pipeline's processing threads
+         *  when playback begins. In the kLevelParallel execution mode, they
+         *  are applied to the scheduler's threads. Otherwise, they are
+         *  used by every Stage that has no thread attributes of its own,
+         *  without changing the Stage's attributes. Only valid while the
+         *  pipeline is not playing.
+         */
+        bool setThreadAttributes(const ThreadAttributes &attributes);
+        
+        /**
+         *  Returns true if format negotiation is enabled.
+         */
+        bool formatNegotiation() const;
+        
+        /**
+         *  Enables or disables format negotiation. When enabled, play()
+         *  starts the Stages upstream first, so that each Stage's proposed
+         *  output formats (see Stage::proposeOutputFormat) are configured on
+         *  the downstream sinks before the downstream Stages begin
+         *  processing. Formats that are not proposed are still negotiated
+         *  by the first buffer. Only valid while the pipeline is not
+         *  playing.
+         */
+        bool setFormatNegotiation(bool enabled);
+        
+        /**
+         *  Gets the total latency of the pipeline in seconds, as of when
+         *  playback last began. This is the latency of the longest path from
+         *  a Stage without sinks to a Stage without sources.
+         *
+         *  When playback begins, the latency of every path through the
+         *  pipeline is summed from the Stages' latency(), and sinks on
+         *  shorter paths are delayed so that all sinks of a Stage receive
+         *  aligned audio. Buffer timestamps are left on the input timeline,
+         *  so outputs present a buffer at its timestamp plus this latency.
+         */
+        double latency() const;
+        
+        /**
+         *  Gets the clock provider set with setClockProvider, or null.
+         */
+        ClockProvider *clockProvider() const;
+        
+        /**
+         *  Sets the clock provider the pipeline plays with, overriding the
+         *  one selected from its Stages. Without an override, the first
+         *  Stage::providedClockProvider() is used, or if no Stage provides
+         *  one, a TimerClockProvider. For example, an
+         *  OfflineClockProvider renders the pipeline faster than realtime;
+         *  start it once play() returns. Pass null to select a provider from
+         *  the Stages again. Only valid while the pipeline is not playing.
+         */
+        bool setClockProvider(ClockProvider *clockProvider);
+        
+        /**
+         *  Sets the sample format conversion costs used to plan the sample
+         *  formats of the Stages when playback begins. Only valid while the
+         *  pipeline is not playing.
+         */
+        bool setSampleFormatCosts(const SampleFormatCosts &costs);
+        
+        /**
+         *  Gets the sample format plan made when playback last began.
+         */
+        const SampleFormatPlanner &sampleFormatPlan() const;
+        
         bool activate();
         bool deactivate();
         bool play();
+        
+        /**
+         *  Pauses the pipeline, keeping its threads, clocks, and devices
+         *  warm so that resume() is fast. Stages are paused downstream
+         *  first.
+         */
+        bool pause();
+        
+        /**
+         *  Resumes a paused pipeline.
+         */
+        bool resume();
+        
         bool stop();
         
+        /**
+         *  Flushes every stage, discarding all buffers in flight. Used when
+         *  seeking so that stale audio is never played.
+         */
+        void flush();
+        
         iterator begin();
         const_iterator begin() const;
         
@@ -0,0 +1,111 @@
+/*
+ *
+ * Copyright (c) 2013 Philip Deljanov. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ */
+
+#ifndef AYANE_RECHUNKER_H_
+#define AYANE_RECHUNKER_H_
+
+#include <cstdint>
+
+#include "Ayane/Macros.h"
+#include "Ayane/BufferPool.h"
+
+namespace Ayane {
+
+    /**
+     *  A Rechunker regroups a stream of buffers of arbitrary lengths into
+     *  blocks of a fixed number of frames, as required by devices and
+     *  block-based processing such as FFTs.
+     *
+     *  When no frames are carried over and an input buffer holds exactly
+     *  one block, the input buffer itself is passed on without copying.
+     *  Otherwise, frames are copied into blocks from an internal pool.
+     *  Each block is timestamped with the presentation time of its first
+     *  frame.
+     *
+     *  A Rechunker is typically owned by a stage and fed from a sink:
+     *
+     *      while( !mRechunker.pop(&block) ) {
+     *          if( pull(sink, &buffer) != kSuccess ) {
+     *              return;
+     *          }
+     *          mRechunker.push(buffer);
+     *      }
+     */
+    class Rechunker {
+    public:
+
+        /**
+         *  Instantiates a rechunker producing blocks of the specified number
+         *  of frames.
+         */
+        explicit Rechunker(uint32_t frames);
+
+        /**
+         *  Gets the number of frames per block.
+         */
+        uint32_t frames() const {
+            return mFrames;
+        }
+
+        /**
+         *  Sets the number of frames per block. Any buffered frames are
+         *  discarded.
+         */
+        void setFrames(uint32_t frames);
+
+        /**
+         *  Returns true if the rechunker has consumed its input buffer and
+         *  can accept another.
+         */
+        bool needsInput() const {
+            return !mInput;
+        }
+
+        /**
+         *  Takes ownership of the next input buffer. May only be called
+         *  when needsInput() is true, for example after pop() has returned
+         *  false.
+         */
+        void push(ManagedBuffer &buffer);
+
+        /**
+         *  Gets the next block. Returns false if more input is required.
+         *  A block is only shorter than the block size if it ends the
+         *  stream, or the input format changed part way through it.
+         */
+        bool pop(ManagedBuffer *outBuffer);
+
+        /**
+         *  Discards the input buffer and any partial block.
+         */
+        void clear();
+
+    private:
+        AYANE_DISALLOW_COPY_AND_ASSIGN(Rechunker);
+
+        // Recreates the pool if the input format has changed.
+        bool configure(const Buffer &buffer);
+
+        uint32_t mFrames;
+
+        // Input buffer being consumed, and the frames consumed from it.
+        ManagedBuffer mInput;
+        uint32_t mInputOffset;
+
+        // Block being filled.
+        ManagedBuffer mBlock;
+
+        // Pool of blocks in the format of the input.
+        BufferPool mPool;
+        SampleFormat mSampleFormat;
+        BufferFormat mFormat;
+    };
+
+}
+
+#endif
@@ -0,0 +1,171 @@
+/*
+ *
+ * Copyright (c) 2013 Philip Deljanov. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ */
+
+#ifndef AYANE_SAMPLEFORMATPLANNER_H_
+#define AYANE_SAMPLEFORMATPLANNER_H_
+
+#include <map>
+#include <ostream>
+#include <vector>
+
+#include "Ayane/Macros.h"
+#include "Ayane/SampleFormats.h"
+#include "Ayane/Stage.h"
+
+namespace Ayane {
+
+    /**
+     *  SampleFormatCosts is a table of the cost of converting one sample
+     *  between every pair of sample formats.
+     */
+    class SampleFormatCosts {
+    public:
+
+        /** The number of sample formats in the table. */
+        static const unsigned int kFormatCount = kFloat64 + 1;
+
+        /**
+         *  Instantiates a table with nominal costs. Identity conversions
+         *  are free, integer to integer conversions are cheapest, and float
+         *  to integer conversions (which round and clip) are the most
+         *  expensive.
+         */
+        SampleFormatCosts();
+
+        /**
+         *  Measures the conversion kernels on the host. Each cost is the
+         *  time in nanoseconds to convert one sample.
+         */
+        static SampleFormatCosts measure(unsigned int samples = 4096);
+
+        /**
+         *  Gets the cost of converting a sample from one format to another.
+         */
+        double cost(SampleFormat from, SampleFormat to) const {
+            return mCosts[from][to];
+        }
+
+        /**
+         *  Sets the cost of converting a sample from one format to another.
+         */
+        void setCost(SampleFormat from, SampleFormat to, double cost) {
+            mCosts[from][to] = cost;
+        }
+
+    private:
+        double mCosts[kFormatCount][kFormatCount];
+    };
+
+
+    /**
+     *  A SampleFormatPlanner assigns sample formats across a graph of linked
+     *  Stages so that the total cost of sample format conversions is
+     *  minimized.
+     *
+     *  Each Stage is assigned a processing format from its supported sample
+     *  formats, and each link is assigned the format its buffers are
+     *  carried in. A link costs the conversion from the upstream processing
+     *  format to the link format, plus the conversion from the link format
+     *  to the downstream processing format. Ties are broken towards each
+     *  Stage's preferred sample format.
+     */
+    class SampleFormatPlanner {
+    public:
+
+        /** The planned formats of a link. */
+        typedef struct Link {
+
+            /** The upstream Stage's source. */
+            Stage::Source *source;
+
+            /** The upstream Stage's processing format. */
+            SampleFormat from;
+
+            /** The format buffers are carried in on the link. */
+            SampleFormat format;
+
+            /** The downstream Stage's processing format. */
+            SampleFormat to;
+
+            /** The conversion cost of the link per sample. */
+            double cost;
+
+        } Link;
+
+        explicit SampleFormatPlanner(const SampleFormatCosts &costs = SampleFormatCosts());
+
+        /**
+         *  Plans the sample formats of the Stages and the links between
+         *  them. Links to Stages that are not part of the collection are
+         *  ignored. Graphs with few enough format combinations are searched
+         *  exhaustively, larger graphs are improved one Stage at a time
+         *  until no change lowers the cost.
+         */
+        void plan(const std::vector<Stage*> &stages);
+
+        /**
+         *  Assigns the planned formats to the Stages and their sources.
+         */
+        void apply() const;
+
+        /**
+         *  Gets the planned processing format of a Stage.
+         */
+        SampleFormat processingFormat(const Stage *stage) const;
+
+        /**
+         *  Gets the planned links.
+         */
+        const std::vector<Link> &links() const {
+            return mLinks;
+        }
+
+        /**
+         *  Gets the total conversion cost per sample of the plan.
+         */
+        double totalCost() const {
+            return mTotalCost;
+        }
+
+        /**
+         *  Gets the number of sample format conversions in the plan.
+         */
+        unsigned int conversionCount() const;
+
+        /**
+         *  Writes a description of the plan.
+         */
+        void report(std::ostream &out) const;
+
+    private:
+
+        /** Gets the cheapest link format between two processing formats. */
+        SampleFormat linkFormat(SampleFormat from, SampleFormat to,
+                                double *outCost) const;
+
+        /** Gets the total cost of an assignment of processing formats. */
+        double assignmentCost(const std::vector<unsigned int> &assignment) const;
+
+        SampleFormatCosts mCosts;
+
+        // Stages, and their candidate processing formats (preferred first).
+        std::vector<Stage*> mStages;
+        std::vector<std::vector<SampleFormat>> mCandidates;
+
+        // Links as pairs of stage indicies.
+        std::vector<std::pair<unsigned int, unsigned int>> mEdges;
+
+        // Plan.
+        std::map<const Stage*, SampleFormat> mFormats;
+        std::vector<Link> mLinks;
+        double mTotalCost;
+    };
+
+}
+
+#endif
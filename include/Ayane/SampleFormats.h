@@ -115,6 +115,19 @@ namespace Ayane {
     /** Data type that should be used when representing a sample rate. */
     typedef unsigned int SampleRate;
     
+    /**
+     *  Sample format set. Bit n is set if SampleFormat n is in the set.
+     */
+    typedef uint32_t SampleFormatSet;
+    
+    /** Sample format set containing every sample format. */
+    const SampleFormatSet kAllSampleFormats = (1u << (kFloat64 + 1)) - 1;
+    
+    /** Gets the sample format set containing only the specified format. */
+    inline SampleFormatSet sampleFormatSet(SampleFormat format) {
+        return (1u << format);
+    }
+    
     
     class SampleFormats
     {
@@ -15,13 +15,17 @@
 #include "Ayane/BufferPool.h"
 #include "Ayane/BufferQueue.h"
 #include "Ayane/ClockProvider.h"
+#include "Ayane/DelayLine.h"
 #include "Ayane/MessageBus.h"
+#include "Ayane/ThreadAttributes.h"
 
+#include <atomic>
+#include <chrono>
 #include <memory>
 #include <mutex>
 #include <thread>
 #include <string>
-#include <unordered_map>
+#include <vector>
 
 namespace Ayane {
     
@@ -38,11 +42,21 @@ namespace Ayane {
         class Sink;
         
         
-        /** Collection type for sources. */
-        typedef std::unordered_map<std::string, std::unique_ptr<Source>> SourceCollection;
+        /**
+         *  Handle to a source or sink port. A handle is the index of the port
+         *  in its collection, and is stable until a port added before it is
+         *  removed.
+         */
+        typedef uint32_t PortHandle;
+        
+        /** Handle returned when a port could not be added or found. */
+        static const PortHandle kInvalidPortHandle = 0xffffffff;
         
-        /** Collection type for sinks. */
-        typedef std::unordered_map<std::string, std::unique_ptr<Sink>> SinkCollection;
+        /** Collection type for sources. Indexed by port handle. */
+        typedef std::vector<std::unique_ptr<Source>> SourceCollection;
+        
+        /** Collection type for sinks. Indexed by port handle. */
+        typedef std::vector<std::unique_ptr<Sink>> SinkCollection;
         
         typedef SourceCollection::iterator SourceIterator;
         typedef SourceCollection::const_iterator ConstSourceIterator;
@@ -72,7 +86,14 @@ namespace Ayane {
             /** Synchronous operating mode. The Stage pushes buffers to its
              *  source ports only when a pull request is made.
              */
-            kSynchronous
+            kSynchronous,
+            
+            /** Scheduled operating mode. The Stage is run by a
+             *  LevelScheduler. Buffers are queued as in asynchronous mode,
+             *  but pulls never wait since the scheduler always runs a
+             *  producer before its consumers.
+             */
+            kScheduled
             
         }
         SynchronicityMode;
@@ -89,7 +110,13 @@ namespace Ayane {
             kActivated,
             
             /** The Stage is playing. */
-            kPlaying
+            kPlaying,
+            
+            /**
+             *  The Stage is paused. Its processing thread, clock, and
+             *  resources are kept, but no process runs occur.
+             */
+            kPaused
             
         } State;
         
@@ -104,14 +131,43 @@ namespace Ayane {
         
         
         /**
-         *  Attempts to retreive a source port by name.
+         *  Gets a source port by handle. The handle must be valid.
+         */
+        Source *source( PortHandle handle ) const {
+            return mSources[handle].get();
+        }
+        
+        /**
+         *  Gets a sink port by handle. The handle must be valid.
+         */
+        Sink *sink( PortHandle handle ) const {
+            return mSinks[handle].get();
+        }
+        
+        /**
+         *  Attempts to retreive a source port by name, or null if no source
+         *  has the name. Intended for pipeline setup, use handles while
+         *  processing.
+         */
+        Source *source( const std::string &name ) const;
+        
+        /**
+         *  Attempts to retreive a sink by name, or null if no sink has the
+         *  name. Intended for pipeline setup, use handles while processing.
+         */
+        Sink *sink( const std::string &name ) const;
+        
+        /**
+         *  Gets the handle of the source with the given name, or
+         *  kInvalidPortHandle if no source has the name.
          */
-        bool source( const std::string &name, Source *outSource );
+        PortHandle sourceHandle( const std::string &name ) const;
         
         /**
-         *  Attempts to retreive a sink by name.
+         *  Gets the handle of the sink with the given name, or
+         *  kInvalidPortHandle if no sink has the name.
          */
-        bool sink( const std::string &name, Sink *outSink );
+        PortHandle sinkHandle( const std::string &name ) const;
         
         /**
          *  Gets an iterator begin/end pair for sources.
@@ -144,16 +200,25 @@ namespace Ayane {
         /**
          *  Unlinks the current source, from the sink, and replaces it with
          *  the next source.
+         *
+         *  Linking never blocks processing. The new links are published to
+         *  the affected stages, which pick them up at the start of their
+         *  next process run. The call returns once the sink's stage is no
+         *  longer using the previous link, so the current source may be
+         *  destroyed immediately afterwards. Must not be called from a
+         *  process() callback.
          */
         static bool replace(Source *current, Source *next, Sink *sink);
         
         /**
-         *  Links the specified source and sink together.
+         *  Links the specified source and sink together. See replace for
+         *  how links are published.
          */
         static bool link( Source *source, Sink *sink );
         
         /**
-         *  Unlinks the specified source from the sink.
+         *  Unlinks the specified source from the sink. See replace for how
+         *  links are published.
          */
         static void unlink( Source *source, Sink *sink );
         
@@ -177,15 +242,115 @@ namespace Ayane {
         
         /**
          *  Starts playback. Once called, the stage will produce buffers
-         *  clocked by the clock provider. Thread-safe.
+         *  clocked by the clock provider. Returns false if the stage is
+         *  not activated or paused, or if its clock could not be
+         *  registered with the clock provider. Thread-safe.
+         */
+        bool play(ClockProvider &clockProvider);
+        
+        /**
+         *  Pauses playback. The stage keeps its processing thread, clock,
+         *  buffers, and devices, so that playback resumes without
+         *  reinitializing. Returns once any process run in progress has
+         *  finished. Since a process run may be waiting for a buffer from
+         *  upstream, downstream stages should be paused first. Thread-safe.
+         */
+        bool pause();
+        
+        /**
+         *  Resumes playback of a paused stage. Calling play() on a paused
+         *  stage also resumes it. Thread-safe.
          */
-        void play(ClockProvider &clockProvider);
+        bool resume();
         
         /**
          *  Stops playback. Thread-safe.
          */
         void stop();
         
+        /**
+         *  Flushes the stage and every stage downstream of it, for example
+         *  after seeking. Buffers queued on the affected links, or pushed by
+         *  a process run already in progress, are discarded when pulled
+         *  instead of being processed. Each flushed stage has flushed()
+         *  called before its next process run. Returns immediately without
+         *  waiting for queues to drain. Thread-safe.
+         */
+        void flush();
+        
+        /**
+         *  Gets the attributes applied to the stage's processing thread.
+         *  Thread-safe.
+         */
+        ThreadAttributes threadAttributes() const;
+        
+        /**
+         *  Sets the attributes applied to the stage's processing thread.
+         *  The attributes take effect the next time the processing thread
+         *  starts, and are only used if the stage runs asynchronously.
+         *  Thread-safe.
+         */
+        void setThreadAttributes(const ThreadAttributes &attributes);
+        
+        /**
+         *  Gets the attributes that failed to apply when the processing
+         *  thread last started. Failures are also traced, and posted to the
+         *  message bus as a WarningMessage. Thread-safe.
+         */
+        ThreadAttributes::Failures threadAttributeFailures() const;
+        
+        /**
+         *  Gets the sample format the stage should process in as planned by
+         *  a SampleFormatPlanner, or the preferred sample format if the
+         *  stage has not been planned.
+         */
+        SampleFormat plannedSampleFormat() const;
+        
+        /**
+         *  Gets the processing latency of the stage in seconds. That is, how
+         *  far the audio pushed on the stage's sources lags the audio pulled
+         *  on its sinks, for example due to look-ahead. Used by Pipeline to
+         *  align parallel branches. The default implementation returns 0.
+         */
+        virtual double latency() const;
+        
+        /**
+         *  Gets the length of the longest buffer the stage pushes on the
+         *  source. Used to preallocate storage downstream, such as the
+         *  delay lines of compensated sinks, before playback begins. The
+         *  default implementation returns 100ms.
+         */
+        virtual BufferLength maximumBufferLength(const Source &source) const;
+        
+        /**
+         *  Gets the clock provider the stage offers to drive a pipeline, or
+         *  null. Stages paced by a device, such as audio outputs, should
+         *  return the device's clock provider. Pipeline plays with the first
+         *  one offered. The default implementation returns null.
+         */
+        virtual ClockProvider *providedClockProvider();
+        
+        /**
+         *  Gets the clock provider the stage must be played with instead of
+         *  the pipeline's, or null. Stages that bridge two clock domains,
+         *  such as ClockBridge, return the provider of the domain they
+         *  produce for. Such stages run on their own processing thread,
+         *  even in the level-parallel execution mode. The default
+         *  implementation returns null.
+         */
+        virtual ClockProvider *requiredClockProvider();
+        
+        /**
+         *  Sets a delay, in seconds, applied to buffers pulled on the sink to
+         *  align them with the stage's other sinks. The delay line is
+         *  allocated when the stage begins playing, for the sink's
+         *  negotiated format and the linked stage's maximumBufferLength(),
+         *  and never while processing. Buffers that do not fit are passed
+         *  through undelayed. Set by Pipeline when playback begins. Only
+         *  valid while the stage is not playing. Thread-safe.
+         */
+        bool setCompensationDelay(Sink *sink, double delay);
+        
 
     protected:
                 
@@ -199,9 +364,10 @@ namespace Ayane {
              *  Output: Hints that the process callback can be called
              *  atleast one more time. This flag is only useful for pure
              *  sink nodes that implement their own buffering scheme and
-             *  would like an extra process run to occur to fill their
-             *  internal buffer. This hint will be ignored if the stage is
-             *  not run asynchronously, or sources are present on the stage.
+             *  would like an extra process run in the same batch to fill
+             *  their internal buffer. This hint will be ignored if the stage
+             *  is not run asynchronously, or sources are present on the
+             *  stage.
              */
             kProcessMoreHint = 1<<0
             
@@ -231,10 +397,41 @@ namespace Ayane {
              *  The requested operation is only valid on an asynchronous
              *  source.
              */
-            kNotAsynchronous
+            kNotAsynchronous,
+            
+            /**
+             *  The sink is not linked as of the start of the current
+             *  process run.
+             */
+            kNotLinked,
+            
+            /** The deadline passed before a buffer was pushed. */
+            kTimedOut
             
         } PullResult;
         
+        /**
+         *  Enumeration of possible results from push operations.
+         */
+        typedef enum
+        {
+            /** The buffer was queued on the source. */
+            kPushed = 0,
+            
+            /**
+             *  The source has no credits (its buffer queue is full). The
+             *  buffer is not consumed and remains owned by the caller.
+             */
+            kNoCredits,
+            
+            /**
+             *  The sink passed to forward has no in-place source. The
+             *  buffer remains owned by the caller.
+             */
+            kNotInPlace
+            
+        } PushResult;
+        
         /**
          *  Process input/output flags set. Bits in this type can be tested
          *  against the flags in ProcessIOFlag.
@@ -248,22 +445,28 @@ namespace Ayane {
         
         
         /**
-         *  Adds a sources with the given name to the source list.
+         *  Adds a sources with the given name to the source list. Returns
+         *  the handle of the new source, or kInvalidPortHandle if the stage
+         *  is not deactivated or the name is taken.
          */
-        void addSource( const std::string &name );
+        PortHandle addSource( const std::string &name );
         
         /**
-         *  Removes a source with the given name from the source list.
+         *  Removes a source with the given name from the source list. The
+         *  handles of sources added after it are decremented.
          */
         void removeSource( const std::string &name );
         
         /**
-         *  Adds a sink with the given name to the sink list.
+         *  Adds a sink with the given name to the sink list. Returns the
+         *  handle of the new sink, or kInvalidPortHandle if the stage is not
+         *  deactivated or the name is taken.
          */
-        void addSink( const std::string &name );
+        PortHandle addSink( const std::string &name );
         
         /**
-         *  Removes a sink with the given name from the sink list.
+         *  Removes a sink with the given name from the sink list. The
+         *  handles of sinks added after it are decremented.
          */
         void removeSink( const std::string &name );
         
@@ -271,10 +474,30 @@ namespace Ayane {
          *  Requests a buffer from the linked source. This function will
          *  wait until the source services the request. The returned buffer
          *  may be a different format between successive calls, but the sink
-         *  will issue a port-specific reconfigureSink() event.
+         *  will issue a port-specific reconfigureSink() event. A Stage
+         *  driven by a scheduler never waits; if a source outside the
+         *  scheduler has not pushed a buffer, kBufferQueueEmpty is returned.
          */
         PullResult pull(Sink *sink, ManagedBuffer *outBuffer);
         
+        /**
+         *  Requests a buffer from the linked source, waiting no later than
+         *  the deadline. If no buffer was pushed by then, kTimedOut is
+         *  returned and the sink's deadline miss count is incremented, so
+         *  that a realtime consumer may output silence instead of stalling.
+         *  The deadline only bounds the wait on asynchronous links. On
+         *  synchronous links, the upstream stages run to completion.
+         */
+        PullResult pull(Sink *sink, ManagedBuffer *outBuffer,
+                        const std::chrono::steady_clock::time_point &deadline);
+        
+        /**
+         *  Requests a buffer from the linked source, waiting at most the
+         *  timeout. See the deadline variant.
+         */
+        PullResult pull(Sink *sink, ManagedBuffer *outBuffer,
+                        std::chrono::nanoseconds timeout);
+        
         /**
          *  Attempts to pull a buffer from the linked source. This
          *  function will never block, but it may not always return a
@@ -288,10 +511,49 @@ namespace Ayane {
         void cancelPull(Sink *sink);
         
         /**
-         *  Attempts to push buffer to the source. If the source buffer
-         *  queue is full, this function will drop the buffer.
+         *  Attempts to push buffer to the source. If the source has no
+         *  credits, kNoCredits is returned and the buffer is left with the
+         *  caller so that it may be pushed again later.
+         */
+        PushResult push(Source *source, ManagedBuffer &buffer );
+        
+        /**
+         *  Declares that buffers pulled on the sink may be modified in place
+         *  and pushed on the source with forward(), instead of being copied
+         *  into a buffer from the stage's own pool. Both ports must belong to
+         *  the stage, and each port may only be part of one pair. Passing a
+         *  null source removes the pair. Only valid while deactivated.
+         */
+        bool setInPlace(Sink *sink, Source *source);
+        
+        /**
+         *  Pushes a buffer pulled on an in-place sink to the sink's paired
+         *  source without copying. The buffer keeps its pool, and therefore
+         *  returns to the upstream stage's pool once released downstream.
+         *  Upstream pools must hold enough buffers to cover the longer path.
+         *  The buffer's format must not be changed. As with push, the
+         *  buffer remains owned by the caller unless kPushed is returned.
+         */
+        PushResult forward(Sink *sink, ManagedBuffer &buffer);
+        
+        /**
+         *  Gets the number of credits on the source. A credit is a free slot
+         *  in the source's buffer queue, and guarantees that a push will
+         *  succeed. Credits are returned as the linked sink pulls buffers.
          */
-        void push(Source *source, ManagedBuffer &buffer );
+        uint32_t credits(const Source *source) const;
+        
+        /**
+         *  Waits until the source has at least one credit. Returns false if
+         *  the wait was cancelled, either by cancelAwaitCredit or because
+         *  the stage is stopping.
+         */
+        bool awaitCredit(Source *source);
+        
+        /**
+         *  Cancels any waiting awaitCredit calls on the source.
+         */
+        void cancelAwaitCredit(Source *source);
         
         /**
          *  Resets a source port.
@@ -326,16 +588,29 @@ namespace Ayane {
          */
         virtual void process(ProcessIOFlags *ioFlags) = 0;
         
+        /**
+         *  Called by an asynchronous Stage once per clock wake-up to do up to
+         *  maxRuns process runs. maxRuns is the fewest free queue slots on
+         *  any linked source, so every linked source may be pushed maxRuns
+         *  buffers without running out of credits. This lets a stage catch
+         *  up after a stall, or pre-roll at start, in a single wake-up.
+         *
+         *  The default implementation calls process maxRuns times. Stages
+         *  that can produce several buffers more cheaply at once may
+         *  override it. Returns the number of runs done.
+         */
+        virtual uint32_t processBatch(uint32_t maxRuns, ProcessIOFlags *ioFlags);
+        
         /**
          *  Called by the Stage when source or sink port availability
          *  changes. Source or sink ports may be linked or unlinked between
          *  reconfigureIO calls, and therefore this is the correct function
          *  to probe the number of input and ouputs.
          *
-         *  This function will only be called after last process() event
-         *  finishes execution, and blocks any further processing events
-         *  till completion. As with all Stage callbacks, no synchronization
-         *  is required.
+         *  This function is called on the processing thread at the start of
+         *  the first process run after the links change, and blocks any
+         *  further processing events till completion. As with all Stage
+         *  callbacks, no synchronization is required.
          */
         virtual bool reconfigureIO() = 0;
         
@@ -350,6 +625,49 @@ namespace Ayane {
         virtual bool reconfigureInputFormat(const Sink &sink,
                                             const BufferFormat &format) = 0;
         
+        /**
+         *  Called by the Stage to test if a buffer format would be accepted
+         *  on a sink. Used by Sink::checkFormatSupport during format
+         *  negotiation. The default implementation accepts all formats.
+         *
+         *  This function may be called from any thread, and must not modify
+         *  the stage.
+         */
+        virtual bool supportsInputFormat(const Sink &sink,
+                                         const BufferFormat &format) const;
+        
+        /**
+         *  Called by the Stage after beginPlayback to get the format the
+         *  stage will produce on a linked source. If a valid format is
+         *  returned and the linked sink supports it, the format is
+         *  proposed to the sink's stage, which configures itself for the
+         *  format before it processes its first buffer rather than when the
+         *  first buffer arrives.
+         *
+         *  Sinks that were proposed a format have it set as their
+         *  configured format before this is called, so stages that pass
+         *  their input format through may propagate it. The default
+         *  implementation returns the configured format of the source's
+         *  in-place sink, if it has one. Otherwise, an invalid format is
+         *  returned, leaving negotiation to the first pulled buffer. As with
+         *  all Stage callbacks, no synchronization is required.
+         */
+        virtual BufferFormat proposeOutputFormat(const Source &source);
+        
+        /**
+         *  Gets the sample formats the stage is able to process in. Used by
+         *  SampleFormatPlanner. The default implementation returns all
+         *  sample formats.
+         */
+        virtual SampleFormatSet supportedSampleFormats() const;
+        
+        /**
+         *  Gets the sample format the stage prefers to process in. Used by
+         *  SampleFormatPlanner to break ties. The default implementation
+         *  returns kFloat32.
+         */
+        virtual SampleFormat preferredSampleFormat() const;
+        
         /**
          *  Called by the Stage when transitioning from Activated to
          *  Playing.
@@ -372,19 +690,84 @@ namespace Ayane {
          *  is required.
          */
         virtual bool stoppedPlayback() = 0;
+        
+        /**
+         *  Called by the Stage when transitioning from Playing to Paused,
+         *  after the last process run has finished. Stages driving a device
+         *  may halt it here without closing it. The default implementation
+         *  does nothing.
+         */
+        virtual void pausedPlayback();
+        
+        /**
+         *  Called by the Stage when transitioning from Paused to Playing,
+         *  before the next process run. The default implementation does
+         *  nothing.
+         */
+        virtual void resumedPlayback();
+        
+        /**
+         *  Called by the Stage before the first process run after a flush.
+         *  Stages holding buffered state, such as filter histories or
+         *  partially consumed buffers, should discard it here. The default
+         *  implementation does nothing.
+         */
+        virtual void flushed();
 
         /**
-         *  Map of sources. Keyed by name.
+         *  List of sources. Indexed by port handle.
          */
         SourceCollection mSources;
         
         /**
-         *  Map of sinks. Keyed by name.
+         *  List of sinks. Indexed by port handle.
          */
         SinkCollection mSinks;
         
     private:
         class SourceSinkPrivate;
+        
+        friend class LevelScheduler;
+        friend class LevelSchedulerPrivate;
+        friend class Pipeline;
+        friend class SampleFormatPlanner;
+
+        /**
+         *  Hands control of processing to a scheduler. While attached, the
+         *  Stage will not create a processing thread or clock of its own,
+         *  and uses the scheduler's clock instead. Only valid while not
+         *  playing.
+         */
+        void attachScheduler(Clock *clock);
+        
+        /**
+         *  Returns control of processing to the Stage.
+         */
+        void detachScheduler();
+        
+        /**
+         *  Sets the attributes applied to the processing thread if the
+         *  stage has no thread attributes of its own. The stage's own
+         *  attributes are left untouched.
+         */
+        void setInheritedThreadAttributes(const ThreadAttributes &attributes);
+        
+        /**
+         *  Performs one process run on behalf of the scheduler.
+         */
+        void processScheduled();
+        
+        /**
+         *  Sets the sample format planned by a SampleFormatPlanner.
+         */
+        void setPlannedSampleFormat(SampleFormat format);
+        
+        /**
+         *  Pulls a buffer, bounding the wait on asynchronous links by the
+         *  deadline if it is not null.
+         */
+        PullResult pullUntil(Sink *sink, ManagedBuffer *outBuffer,
+                             const std::chrono::steady_clock::time_point *deadline);
 
         AYANE_DISALLOW_COPY_AND_ASSIGN(Stage);
         
@@ -416,6 +799,18 @@ namespace Ayane {
          */
         bool isLinked() const;
         
+        /**
+         *  Gets the sink linked to the source, or null if not linked.
+         */
+        Sink *linkedSink() const {
+            return mLinkedSink;
+        }
+        
+        /**
+         *  Gets the Stage the source belongs to.
+         */
+        Stage *stage() const;
+        
         /**
          *  Checks if the linked sink supports the specified buffer format.
          */
@@ -427,13 +822,30 @@ namespace Ayane {
          */
         SynchronicityMode linkSynchronicity() const;
         
+        /**
+         *  Gets the sample format buffers should be pushed in as planned by
+         *  a SampleFormatPlanner. Stages may convert into this format
+         *  before pushing to avoid conversions downstream.
+         */
+        SampleFormat plannedSampleFormat() const {
+            return mPlannedSampleFormat;
+        }
+        
     private:
         AYANE_DISALLOW_COPY_AND_ASSIGN(Source);
         
+        friend class SampleFormatPlanner;
+        
         Source(StagePrivate *stage);
         
         StagePrivate *mStage;
-        Sink  *mLinkedSink;
+        std::atomic<Sink*> mLinkedSink;
+        
+        SampleFormat mPlannedSampleFormat;
+        
+        // Link generation buffers pushed in the current process run are
+        // tagged with. Only accessed by the processing thread.
+        uint32_t mPushGeneration;
         
         std::unique_ptr<SourceSinkPrivate> mShared;
     };
@@ -487,6 +899,18 @@ namespace Ayane {
          */
         bool isLinked() const;
         
+        /**
+         *  Gets the source linked to the sink, or null if not linked.
+         */
+        Source *linkedSource() const {
+            return mLinkedSource;
+        }
+        
+        /**
+         *  Gets the Stage the sink belongs to.
+         */
+        Stage *stage() const;
+        
         /**
          *  Tests if the buffer format is compatible with the sink.
          */
@@ -512,6 +936,21 @@ namespace Ayane {
          */
         SynchronicityMode linkSynchronicity() const;
         
+        /**
+         *  Gets the source buffers pulled on the sink may be forwarded to
+         *  in place, or null if the sink is not in-place capable.
+         */
+        Source *inPlaceSource() const {
+            return mInPlaceSource;
+        }
+        
+        /**
+         *  Gets the delay, in seconds, applied to buffers pulled on the sink.
+         */
+        double compensationDelay() const {
+            return mDelayLine ? mDelayLine->delay() : 0.0;
+        }
+        
         /**
          *  Gets the buffer format the sink is currently configured for.
          *  Note that the format may not be valid, test with
@@ -521,21 +960,44 @@ namespace Ayane {
             return mBufferFormat;
         }
         
+        /**
+         *  Gets the number of timed pulls on the sink that passed their
+         *  deadline. Thread-safe.
+         */
+        uint64_t deadlineMisses() const {
+            return mDeadlineMisses.load(std::memory_order_relaxed);
+        }
+        
     private:
         AYANE_DISALLOW_COPY_AND_ASSIGN(Sink);
         
         Sink(StagePrivate *stage);
         
         StagePrivate  *mStage;
-        Source *mLinkedSource;
+        std::atomic<Source*> mLinkedSource;
+        
+        // Format proposed by the linked source's stage, waiting to be
+        // configured by the processing thread.
+        std::atomic<BufferFormat*> mProposedFormat;
         
         SchedulingMode m_scheduling;
         
+        // Source buffers may be forwarded to in place.
+        Source *mInPlaceSource;
+        
+        // Latency compensation, or null if the sink is not delayed.
+        std::unique_ptr<DelayLine> mDelayLine;
+        
+        // The link as seen by the processing thread. Only updated at the
+        // start of a process run, or while the stage is not playing.
         SourceSinkPrivate *mShared;
         
         BufferFormat mBufferFormat;
         
         volatile bool mPullCancelled;
+        
+        // Timed pulls that passed their deadline.
+        std::atomic<uint64_t> mDeadlineMisses;
     };
     
 }
@@ -0,0 +1,125 @@
+/*
+ *
+ * Copyright (c) 2013 Philip Deljanov. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ */
+
+#ifndef AYANE_THREADATTRIBUTES_H_
+#define AYANE_THREADATTRIBUTES_H_
+
+#include <cstddef>
+#include <cstdint>
+
+namespace Ayane {
+
+    /**
+     *  ThreadAttributes describes the scheduling and execution environment
+     *  of a processing thread. Attributes are applied by the thread itself
+     *  when it starts.
+     */
+    typedef struct ThreadAttributes {
+    public:
+
+        /** Enumeration of thread scheduling policies. */
+        typedef enum {
+
+            /** The operating system's default (time-sharing) policy. */
+            kDefaultPolicy = 0,
+
+            /** Real-time first-in, first-out policy (SCHED_FIFO). */
+            kFifo,
+
+            /** Real-time round-robin policy (SCHED_RR). */
+            kRoundRobin
+
+        } SchedulingPolicy;
+
+        /** Enumeration of attributes that could fail to apply. */
+        typedef enum {
+
+            /** All attributes were applied. */
+            kNone               = 0,
+
+            /** The scheduling policy or priority could not be set. */
+            kPolicyFailed       = 1<<0,
+
+            /** The CPU affinity could not be set. */
+            kAffinityFailed     = 1<<1,
+
+            /** The floating-point (FTZ/DAZ) modes could not be set. */
+            kFloatingPointFailed = 1<<2,
+
+            /** The process memory could not be locked. */
+            kMemoryLockFailed   = 1<<3
+
+        } Failure;
+
+        /**
+         *  Failure flags set. Bits in this type can be tested against the
+         *  flags in Failure.
+         */
+        typedef uint32_t Failures;
+
+        /** The scheduling policy. */
+        SchedulingPolicy policy;
+
+        /**
+         *  The real-time priority. Only used by the kFifo and kRoundRobin
+         *  policies.
+         */
+        int priority;
+
+        /**
+         *  CPU affinity mask. Bit n allows the thread to run on CPU n. A mask
+         *  of 0 allows the thread to run on any CPU.
+         */
+        uint64_t affinity;
+
+        /**
+         *  If true, denormal floats are flushed to zero (FTZ) and treated as
+         *  zero (DAZ) on the thread.
+         */
+        bool flushDenormals;
+
+        /**
+         *  If true, all current and future pages of the process are locked
+         *  into memory (mlockall).
+         */
+        bool lockMemory;
+
+        /**
+         *  The number of bytes of stack to touch when the thread starts so
+         *  that it will not page fault while processing.
+         */
+        size_t prefaultStack;
+
+        ThreadAttributes() :
+        policy(kDefaultPolicy),
+        priority(0),
+        affinity(0),
+        flushDenormals(false),
+        lockMemory(false),
+        prefaultStack(0)
+        {
+
+        }
+
+        /**
+         *  Returns true if no attributes differ from the defaults.
+         */
+        bool isDefault() const;
+
+        /**
+         *  Applies the attributes to the calling thread, and prepares it
+         *  for logging (see Trace::prepareThread()). Returns the set of
+         *  attributes that could not be applied.
+         */
+        Failures apply() const;
+
+    } ThreadAttributes;
+
+}
+
+#endif
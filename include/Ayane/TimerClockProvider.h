@@ -0,0 +1,132 @@
+/*
+ *
+ * Copyright (c) 2013 Philip Deljanov. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ */
+
+#ifndef AYANE_TIMERCLOCKPROVIDER_H_
+#define AYANE_TIMERCLOCKPROVIDER_H_
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+
+#include "Ayane/ClockProvider.h"
+#include "Ayane/ThreadAttributes.h"
+
+namespace Ayane {
+
+    /**
+     *  TimerJitter summarizes how late a TimerClockProvider woke for its
+     *  clock events. All times are in nanoseconds.
+     */
+    typedef struct TimerJitter {
+
+        /** Number of clock events published. */
+        uint64_t ticks;
+
+        /** Mean wake-up lateness. */
+        uint64_t mean;
+
+        /** Largest wake-up lateness. */
+        uint64_t max;
+
+        /**
+         *  Number of periods that were skipped because a wake-up was more
+         *  than a period late. Skipped periods are folded into the next
+         *  clock event so that time does not drift.
+         */
+        uint64_t overruns;
+
+    } TimerJitter;
+
+    /**
+     *  A TimerClockProvider publishes clock events at a fixed period from
+     *  the system's monotonic clock, for pipelines without an audio device
+     *  to pace them, such as on headless servers.
+     *
+     *  Each event is scheduled at an absolute deadline, a whole number of
+     *  periods from the start, so that wake-up latency does not accumulate.
+     *  On Linux, the provider sleeps with clock_nanosleep on
+     *  CLOCK_MONOTONIC. Lateness is measured on every event and reported by
+     *  jitter().
+     */
+    class TimerClockProvider : public ClockProvider {
+
+    public:
+
+        /**
+         *  Instantiates a provider with the specified period in nanoseconds.
+         *  Periods from 1ms to 1s are supported.
+         */
+        explicit TimerClockProvider(uint64_t period = 10000000);
+        ~TimerClockProvider();
+
+        /**
+         *  Starts publishing clock events. The clock period may only be
+         *  changed while stopped.
+         */
+        void start();
+
+        /**
+         *  Stops publishing clock events. Blocks until the timer thread has
+         *  exited.
+         */
+        void stop();
+
+        /**
+         *  Gets whether clock events are being published.
+         */
+        bool isRunning() const {
+            return mRunning.load(std::memory_order_acquire);
+        }
+
+        /**
+         *  Gets the attributes applied to the timer thread.
+         */
+        const ThreadAttributes &threadAttributes() const {
+            return mThreadAttributes;
+        }
+
+        /**
+         *  Sets the attributes applied to the timer thread, such as a
+         *  realtime priority. Takes effect the next time the provider
+         *  starts.
+         */
+        void setThreadAttributes(const ThreadAttributes &attributes) {
+            mThreadAttributes = attributes;
+        }
+
+        /**
+         *  Gets the wake-up jitter measured since the provider started, or
+         *  the statistics were last reset. Thread-safe.
+         */
+        TimerJitter jitter() const;
+
+        /**
+         *  Resets the jitter statistics. Thread-safe.
+         */
+        void resetJitter();
+
+    private:
+        AYANE_DISALLOW_COPY_AND_ASSIGN(TimerClockProvider);
+
+        void run(uint64_t period);
+
+        ThreadAttributes mThreadAttributes;
+
+        std::atomic<bool> mRunning;
+        std::thread mThread;
+
+        // Jitter statistics. Written by the timer thread only.
+        std::atomic<uint64_t> mTicks;
+        std::atomic<uint64_t> mTotalLateness;
+        std::atomic<uint64_t> mMaxLateness;
+        std::atomic<uint64_t> mOverruns;
+    };
+
+}
+
+#endif
@@ -9,9 +9,16 @@
 #ifndef AYANE_TRACE_H_
 #define AYANE_TRACE_H_
 
-#include "Ayane/Macros.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
 #include <ostream>
-#include <mutex>
+#include <string>
+#include <type_traits>
+
+#include "Ayane/Macros.h"
+#include "Ayane/DPointer.h"
 
 
 #if defined(NDEBUG)
@@ -22,31 +29,69 @@
 #define DEBUG_ONLY(statement) statement
 #endif
 
-#define ERROR(signature)        Ayane::Trace::instance().error(signature)
-#define ERROR_THIS(signature)   Ayane::Trace::instance().error(signature, this)
+/*
+ * The lowest priority of message compiled in, as the value of a
+ * Trace::Priority. Messages of a lower priority compile to nothing. Defaults
+ * to Info (4) in release builds, and Trace (5) otherwise.
+ */
+#if !defined(AYANE_TRACE_PRIORITY)
+#if defined(NDEBUG)
+#define AYANE_TRACE_PRIORITY 4
+#else
+#define AYANE_TRACE_PRIORITY 5
+#endif
+#endif
 
-#define WARNING(signature)      Ayane::Trace::instance().warning(signature)
-#define WARNING_THIS(signature) Ayane::Trace::instance().warning(signature, this)
+/*
+ * Guards a logging statement, so that nothing streamed into it is evaluated
+ * unless the priority is enabled. The else form keeps the macros safe to use
+ * as the body of an unbraced if.
+ */
+#define AYANE_TRACE_IF(priority) \
+    if( !Ayane::Trace::isEnabled(Ayane::Trace::priority) ) {} else
 
-#define NOTICE(signature)       Ayane::Trace::instance().notice(signature)
-#define NOTICE_THIS(signature)  Ayane::Trace::instance().notice(signature, this)
+#define ERROR(signature)        AYANE_TRACE_IF(kError) Ayane::Trace::instance().error(signature)
+#define ERROR_THIS(signature)   AYANE_TRACE_IF(kError) Ayane::Trace::instance().error(signature, this)
 
-#define INFO(signature)         Ayane::Trace::instance().info(signature)
-#define INFO_THIS(signature)    Ayane::Trace::instance().info(signature, this)
+#define WARNING(signature)      AYANE_TRACE_IF(kWarning) Ayane::Trace::instance().warning(signature)
+#define WARNING_THIS(signature) AYANE_TRACE_IF(kWarning) Ayane::Trace::instance().warning(signature, this)
 
-#define TRACE(signature)        Ayane::Trace::instance().trace(signature)
-#define TRACE_THIS(signature)   Ayane::Trace::instance().trace(signature, this)
+#define NOTICE(signature)       AYANE_TRACE_IF(kNotice) Ayane::Trace::instance().notice(signature)
+#define NOTICE_THIS(signature)  AYANE_TRACE_IF(kNotice) Ayane::Trace::instance().notice(signature, this)
+
+#define INFO(signature)         AYANE_TRACE_IF(kInfo) Ayane::Trace::instance().info(signature)
+#define INFO_THIS(signature)    AYANE_TRACE_IF(kInfo) Ayane::Trace::instance().info(signature, this)
+
+#define TRACE(signature)        AYANE_TRACE_IF(kTrace) Ayane::Trace::instance().trace(signature)
+#define TRACE_THIS(signature)   AYANE_TRACE_IF(kTrace) Ayane::Trace::instance().trace(signature, this)
 
 
 namespace Ayane {
     
+    class TraceRecord;
+    class TracePrivate;
+    
+    /**
+     *  Trace is the library's logging backend.
+     *
+     *  Logging never blocks or allocates on the calling thread. Each
+     *  message is encoded as a compact binary TraceRecord, and written to a
+     *  lock-free ring owned by the calling thread. A background thread
+     *  formats the records and writes them to the output. Messages from one
+     *  thread are written in order. If a thread's ring is full, its
+     *  messages are dropped, and the number dropped is reported.
+     *
+     *  The instance is never destroyed, so threads may log at any point
+     *  during static destruction. Messages still queued when the program
+     *  exits are written by an atexit() handler.
+     */
     class Trace {
         
     public:
         
         static Trace &instance() {
-            static Trace trace;
-            return trace;
+            static Trace *trace = new Trace;
+            return *trace;
         }
         
         /** 
@@ -75,32 +120,238 @@ namespace Ayane {
             
         } Priority;
         
+        /**
+         *  Enumeration of outputs messages can be written to.
+         */
+        typedef enum {
+            
+            /** Standard output, with ANSI colour coding. */
+            kStandardOutput = 0,
+            
+            /** Standard error, with ANSI colour coding. */
+            kStandardError,
+            
+            /** A file, set with setOutputFile(). */
+            kFile,
+            
+            /** The system log, at the matching syslog priority. */
+            kSystemLog
+            
+        } Output;
+        
         ~Trace();
         
+        /**
+         *  Gets whether messages of the priority are logged. A single load
+         *  and compare, and constant false for priorities below
+         *  AYANE_TRACE_PRIORITY, so it may be used to skip preparing a
+         *  message in hot paths. The logging macros check it before
+         *  evaluating anything streamed into the message.
+         */
+        static bool isEnabled(Priority priority) {
+            return (priority <= AYANE_TRACE_PRIORITY) &&
+                   (mMaximumPriority.load(std::memory_order_relaxed) >= priority);
+        }
+        
         Priority priority() const;
         void setPriority(Priority priority);
         
-        std::ostream &trace(const char *signature);
-        std::ostream &info(const char *signature);
-        std::ostream &notice(const char *signature);
-        std::ostream &warning(const char *signature);
-        std::ostream &error(const char *signature);
+        /**
+         *  Gets the output messages are written to.
+         */
+        Output output() const;
         
-        std::ostream &trace(const char *signature, const void *instance);
-        std::ostream &info(const char *signature, const void *instance);
-        std::ostream &notice(const char *signature, const void *instance);
-        std::ostream &warning(const char *signature, const void *instance);
-        std::ostream &error(const char *signature, const void *instance);
+        /**
+         *  Sets the output messages are written to. Messages already
+         *  logged, but not yet written, are written to the new output.
+         *  Setting kFile reopens the last file set with setOutputFile().
+         */
+        void setOutput(Output output);
+        
+        /**
+         *  Opens the file at the path, appending to it if it exists, and
+         *  writes messages to it. Returns false, and leaves the output
+         *  unchanged, if the file can not be opened.
+         */
+        bool setOutputFile(const std::string &path);
+        
+        /**
+         *  Writes all messages logged so far to the output. Blocks, so
+         *  must not be called from a realtime thread.
+         */
+        void flush();
+        
+        /**
+         *  Claims a ring for the calling thread. Happens automatically on
+         *  the thread's first message, but claiming a ring the first time
+         *  may allocate, so realtime threads should call this before they
+         *  start processing. ThreadAttributes::apply() calls this.
+         */
+        void prepareThread();
+        
+        /**
+         *  Gets the number of messages dropped because a ring was full, or
+         *  no ring was available.
+         */
+        uint64_t droppedMessages() const;
+        
+        TraceRecord trace(const char *signature);
+        TraceRecord info(const char *signature);
+        TraceRecord notice(const char *signature);
+        TraceRecord warning(const char *signature);
+        TraceRecord error(const char *signature);
+        
+        TraceRecord trace(const char *signature, const void *instance);
+        TraceRecord info(const char *signature, const void *instance);
+        TraceRecord notice(const char *signature, const void *instance);
+        TraceRecord warning(const char *signature, const void *instance);
+        TraceRecord error(const char *signature, const void *instance);
         
         
     private:
         AYANE_DISALLOW_DEFAULT_CTOR_COPY_AND_ASSIGN(Trace);
-
-        Priority mMaximumPriority;
         
-        std::mutex mMutex;
+        friend class TraceRecord;
+        
+        TraceRecord record(Priority priority, const char *signature, const void *instance);
+        void commit(const TraceRecord &record);
+        
+        static std::atomic<Priority> mMaximumPriority;
+        
+        TracePrivate *d_ptr;
+        AYANE_DECLARE_PRIVATE(Trace);
+    };
+    
+    /**
+     *  A TraceRecord is a single message being logged. Values streamed into
+     *  it are stored in binary, and only formatted by Trace's background
+     *  thread. Strings are copied. Any other value must be trivially
+     *  copyable, and is formatted with its usual operator<<. Stream
+     *  manipulators such as std::endl and std::hex are applied when the
+     *  message is formatted.
+     *
+     *  The message is committed when the record is destroyed, normally at
+     *  the end of the logging statement. Messages longer than kCapacity
+     *  bytes are truncated. The signature is stored as a pointer, so must
+     *  be a string literal.
+     */
+    class TraceRecord {
+        friend class Trace;
+        friend class TracePrivate;
+        
+    public:
+        
+        /** Size of a record's encoded values. */
+        static const size_t kCapacity = 480;
+        
+        TraceRecord(TraceRecord &&other);
+        ~TraceRecord();
+        
+        TraceRecord &operator<<(const char *string) {
+            if( mActive ) {
+                appendString(string, std::strlen(string));
+            }
+            return *this;
+        }
+        
+        TraceRecord &operator<<(char *string) {
+            return *this << static_cast<const char*>(string);
+        }
+        
+        // Streams print signed and unsigned character pointers as strings
+        // too, so they are copied rather than stored as pointers.
+        TraceRecord &operator<<(const signed char *string) {
+            return *this << reinterpret_cast<const char*>(string);
+        }
+        
+        TraceRecord &operator<<(signed char *string) {
+            return *this << reinterpret_cast<const char*>(string);
+        }
+        
+        TraceRecord &operator<<(const unsigned char *string) {
+            return *this << reinterpret_cast<const char*>(string);
+        }
+        
+        TraceRecord &operator<<(unsigned char *string) {
+            return *this << reinterpret_cast<const char*>(string);
+        }
+        
+        TraceRecord &operator<<(const std::string &string) {
+            if( mActive ) {
+                appendString(string.data(), string.size());
+            }
+            return *this;
+        }
+        
+        TraceRecord &operator<<(std::ostream &(*manipulator)(std::ostream&)) {
+            if( mActive ) {
+                appendPointer(kStreamManipulator, reinterpret_cast<void(*)()>(manipulator));
+            }
+            return *this;
+        }
+        
+        TraceRecord &operator<<(std::ios_base &(*manipulator)(std::ios_base&)) {
+            if( mActive ) {
+                appendPointer(kBaseManipulator, reinterpret_cast<void(*)()>(manipulator));
+            }
+            return *this;
+        }
+        
+        template<typename T>
+        TraceRecord &operator<<(const std::atomic<T> &value) {
+            return *this << value.load();
+        }
+        
+        // Values are taken by copy, as an ostream takes arithmetic values,
+        // so static constants need no definition.
+        template<typename T>
+        TraceRecord &operator<<(T value) {
+            
+            static_assert(std::is_trivially_copyable<T>::value,
+                          "Only trivially copyable values can be traced.");
+            static_assert(sizeof(T) < 256, "Value is too large to be traced.");
+            
+            if( mActive ) {
+                appendValue(&TraceRecord::format<T>, &value, sizeof(T));
+            }
+            return *this;
+        }
+        
+    private:
+        AYANE_DISALLOW_COPY_AND_ASSIGN(TraceRecord);
+        
+        typedef enum {
+            kString = 1,
+            kValue,
+            kStreamManipulator,
+            kBaseManipulator
+        } Kind;
+        
+        typedef void (*Formatter)(std::ostream &stream, const unsigned char *data);
+        
+        TraceRecord();
+        TraceRecord(Trace::Priority priority, const char *signature, const void *instance);
+        
+        template<typename T>
+        static void format(std::ostream &stream, const unsigned char *data) {
+            typename std::aligned_storage<sizeof(T), alignof(T)>::type value;
+            std::memcpy(&value, data, sizeof(T));
+            stream << *reinterpret_cast<const T*>(&value);
+        }
+        
+        void appendString(const char *string, size_t length);
+        void appendPointer(Kind kind, void (*pointer)());
+        void appendValue(Formatter formatter, const void *value, size_t size);
+        
+        bool mActive;
+        Trace::Priority mPriority;
+        const char *mSignature;
+        const void *mInstance;
+        
+        size_t mLength;
+        unsigned char mData[kCapacity];
     };
         
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,96 @@
+/*
+ *
+ * Copyright (c) 2013 Philip Deljanov. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ */
+
+#ifndef AYANE_VARIABLERESAMPLER_H_
+#define AYANE_VARIABLERESAMPLER_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "Ayane/Macros.h"
+
+namespace Ayane {
+
+    /**
+     *  A VariableResampler interpolates a signal at arbitrary fractional
+     *  positions, so that it may be resampled by a ratio that changes from
+     *  one output frame to the next.
+     *
+     *  The interpolator is a Kaiser windowed sinc filter tabulated at a
+     *  fixed number of phases. Positions between two phases are linearly
+     *  interpolated between their filters, so the ratio is not limited to
+     *  a rational number.
+     *
+     *  The resampler holds no signal itself. The caller owns the input
+     *  frames, and passes a pointer to the frame at or before each position
+     *  to interpolate. history() frames before that frame, and future()
+     *  frames after it, must also be readable.
+     */
+    class VariableResampler {
+    public:
+
+        /**
+         *  Instantiates a resampler with a filter of the specified number
+         *  of taps, which must be even. More taps give a sharper cutoff and
+         *  a lower noise floor.
+         */
+        explicit VariableResampler(uint32_t taps = 48);
+
+        /**
+         *  Gets the number of filter taps.
+         */
+        uint32_t taps() const {
+            return mTaps;
+        }
+
+        /**
+         *  Gets the number of frames before the interpolated frame that are
+         *  read.
+         */
+        uint32_t history() const {
+            return (mTaps / 2) - 1;
+        }
+
+        /**
+         *  Gets the number of frames after the interpolated frame that are
+         *  read.
+         */
+        uint32_t future() const {
+            return mTaps / 2;
+        }
+
+        /**
+         *  Designs the filter for the nominal ratio of input frames to
+         *  output frames. When downsampling, the cutoff is lowered to the
+         *  output's Nyquist frequency. Must be called before interpolate().
+         */
+        void configure(double ratio);
+
+        /**
+         *  Interpolates the signal at the specified fraction, from 0 up to
+         *  but excluding 1, of a frame past the frame pointed to by input.
+         */
+        float interpolate(const float *input, double fraction) const;
+
+        /** Number of tabulated filter phases. */
+        static const uint32_t kPhases = 256;
+
+    private:
+        AYANE_DISALLOW_COPY_AND_ASSIGN(VariableResampler);
+
+        uint32_t mTaps;
+
+        // kPhases + 1 filters of mTaps coefficients. The last filter is the
+        // first shifted by one frame, so that any fraction has a phase after
+        // it to interpolate with.
+        std::vector<float> mFilters;
+    };
+
+}
+
+#endif
@@ -0,0 +1,79 @@
+/*
+ *
+ * Copyright (c) 2013 Philip Deljanov. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ */
+
+#ifndef AYANE_WAKESOURCE_H_
+#define AYANE_WAKESOURCE_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+#if !defined(__linux__)
+#include <condition_variable>
+#include <mutex>
+#endif
+
+#include "Ayane/Macros.h"
+
+namespace Ayane {
+
+    /**
+     *  A WakeSource wakes any number of waiting threads with a single
+     *  generation counter. Waiters read the generation, check their
+     *  condition, and then wait for the generation to change. Wakers
+     *  change their state, and then call wakeAll().
+     *
+     *  On Linux, waiting and waking are a single futex call, and wakeAll()
+     *  makes no system call at all when nothing is waiting. Elsewhere, a
+     *  mutex and condition variable are used.
+     */
+    class WakeSource {
+    public:
+
+        WakeSource();
+
+        /**
+         *  Gets the current generation.
+         */
+        uint32_t generation() const {
+            return mGeneration.load();
+        }
+
+        /**
+         *  Blocks until the generation differs from the specified one. May
+         *  return spuriously, so the caller's condition must be rechecked.
+         */
+        void wait(uint32_t generation);
+
+        /**
+         *  Blocks until the generation differs from the specified one, or
+         *  the timeout elapses. May return spuriously, so the caller's
+         *  condition must be rechecked.
+         */
+        void wait(uint32_t generation, std::chrono::nanoseconds timeout);
+
+        /**
+         *  Advances the generation, and wakes every waiting thread.
+         */
+        void wakeAll();
+
+    private:
+        AYANE_DISALLOW_COPY_AND_ASSIGN(WakeSource);
+
+        std::atomic<uint32_t> mGeneration;
+        std::atomic<uint32_t> mWaiters;
+
+#if !defined(__linux__)
+        std::mutex mMutex;
+        std::condition_variable mCondition;
+#endif
+    };
+
+}
+
+#endif
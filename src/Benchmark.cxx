@@ -197,8 +197,8 @@ public:
     }
     
     virtual void process(){
-        COUT("TestSource::process: Clock reads: " << clock()->presentationTime()
-             << " (delta=" << clock()->deltaTime() << ").")
+        COUT("TestSource::process: Clock reads: " << clock()->presentationTime().totalSeconds()
+             << " (delta=" << clock()->deltaTime().totalSeconds() << ").")
         
         
         auto b = std::shared_ptr<Buffer>( BufferFactory::make(kFloat32, m_format, m_length) );
@@ -245,8 +245,8 @@ public:
     }
     
     virtual void process(){
-        COUT("TestDSP::process: Clock reads: " << clock()->presentationTime()
-             << " (delta=" << clock()->deltaTime() << ").")
+        COUT("TestDSP::process: Clock reads: " << clock()->presentationTime().totalSeconds()
+             << " (delta=" << clock()->deltaTime().totalSeconds() << ").")
         
         
         std::shared_ptr<Buffer> b = input()->pull();
@@ -297,8 +297,8 @@ public:
     }
     
     virtual void process(){
-        COUT("TestSink::process: Clock reads: " << clock()->presentationTime()
-             << " (delta=" << clock()->deltaTime() << ").")
+        COUT("TestSink::process: Clock reads: " << clock()->presentationTime().totalSeconds()
+             << " (delta=" << clock()->deltaTime().totalSeconds() << ").")
         
         std::unique_ptr<Buffer> b( input()->pull() );
         
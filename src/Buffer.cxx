@@ -16,8 +16,8 @@ using namespace Ayane;
 
 Buffer::Buffer ( const BufferFormat &format, const BufferLength &length ) :
     mFormat(format),
-    mLength(length),
-    mTimestamp(0),
+    mFrames(length.frames(format.sampleRate())),
+    mTimestamp(),
     mFlags(kNone),
     mWriteIndex(0),
     mReadIndex(0)
@@ -30,7 +30,7 @@ Buffer::~Buffer()
 
 Duration Buffer::duration() const
 {
-    return Duration ( mLength.duration ( mFormat.mSampleRate ) );
+    return Duration::fromFrames ( mFrames, mFormat.mSampleRate );
 }
 
 const Duration& Buffer::timestamp() const
@@ -48,43 +48,25 @@ const BufferFormat& Buffer::format() const
     return mFormat;
 }
 
-unsigned int Buffer::frames() const
-{
-    return mLength.frames ( mFormat.mSampleRate );
-}
-
-unsigned int Buffer::available() const {
-    // Frames that can be read!
-    return mWriteIndex - mReadIndex;
-}
-
-unsigned int Buffer::space() const {
-    // Frames that can be written!
-    return frames() - mWriteIndex;
-}
-
 void Buffer::reset() {
     mWriteIndex = 0;
     mReadIndex = 0;
     mFlags = kNone;
-    mTimestamp = 0;
+    mTimestamp = Duration();
 }
 
 template<typename T>
 TypedBuffer<T>::TypedBuffer( const BufferFormat &format, const BufferLength &length ) :
     Buffer( format, length )
 {
-    // Calculate the number of frames in the buffer.
-    unsigned int frames = length.frames( format.sampleRate() );
-    
     // Calculate the number of actual samples the buffer must store.
-    unsigned int samples = frames * format.channelCount();
+    unsigned int samples = mFrames * format.channelCount();
     
     // Allocate the buffer with 16 byte alignment.
     T *buffer = AlignedMemory::allocate16<T>(samples);
     
     // Build the channel map.
-    buildChannelMap(mChannels, format.channels(), buffer, frames);
+    buildChannelMap(mChannels, format.channels(), buffer, mFrames);
 }
 
 template<typename T>
@@ -278,11 +260,9 @@ template< typename T >
 template< typename OutSampleType >
 void TypedBuffer<T>::read(TypedBuffer<OutSampleType> &buffer)
 {
-    // Compatability check first. Buffers must be equal length in frames, and sample
-    // rate. Required, or else resampling will need to be performed.
-    if((buffer.mFormat.sampleRate() != mFormat.sampleRate()) ||
-       (buffer.frames() != frames())
-       )
+    // Compatability check first. Buffers must have the same sample rate, or
+    // else resampling will need to be performed.
+    if(buffer.mFormat.sampleRate() != mFormat.sampleRate())
     {
         // TODO: Raise an exception?
         return;
@@ -292,7 +272,9 @@ void TypedBuffer<T>::read(TypedBuffer<OutSampleType> &buffer)
     // Apply the channel mask to prevent crash-causing inputs.
     Channels channels = (buffer.mFormat.channels() & mFormat.channels()) & kChannelMask;
     
-    // Number of frames to copy.
+    // Number of frames to copy. Like reading into a RawBuffer, the copy
+    // streams from this buffer's read index to the other's write index, so
+    // buffers of different lengths may be split or joined.
     unsigned int length = std::min(buffer.space(), mWriteIndex - mReadIndex);
 
     // Loop over each possible channel. As channels are converted and written,
@@ -303,12 +285,16 @@ void TypedBuffer<T>::read(TypedBuffer<OutSampleType> &buffer)
     {
         if( channels & CanonicalChannels::get(i) )
         {
-            SampleFormats::convertMany<T, OutSampleType>(mChannels[i], buffer.mChannels[i], length);
+            SampleFormats::convertMany<T, OutSampleType>(mChannels[i] + mReadIndex,
+                                                         buffer.mChannels[i] + buffer.mWriteIndex,
+                                                         length);
             channels ^= CanonicalChannels::get(i);
         }
         ++i;
     }
     
+    buffer.mWriteIndex += length;
+    mReadIndex += length;
 }
 
 template< typename T >
@@ -486,45 +472,17 @@ void TypedBuffer<T>::write( const MultiChannel7<InSampleType> &i )
 
 template< typename T >
 template< typename InSampleType >
-void TypedBuffer<T>::write(const TypedBuffer<InSampleType> &buffer)
+void TypedBuffer<T>::write(TypedBuffer<InSampleType> &buffer)
 {
-    // Compatability check first. Buffers must be equal length in frames, and sample
-    // rate. Required, or else resampling will need to be performed.
-    if((buffer.mFormat.sampleRate() != mFormat.sampleRate()) ||
-       (buffer.frames() != frames())
-       )
-    {
-        // TODO: Raise an exception?
-        return;
-    }
-    
-    // Determine the channels that need to be copied (union of the channel layouts).
-    // Apply the channel mask to prevent crash-causing inputs.
-    Channels channels = (buffer.mFormat.channels() & mFormat.channels()) & kChannelMask;
-    
-    // Number of frames to copy.
-    unsigned int length = std::min(buffer.available(), frames() - mWriteIndex);
-    
-    // Loop over each possible channel. As channels are converted and written,
-    // unset that channel's bit. Loop will exit as soon as all channels present
-    // have been processed.
-    int i = 0;
-    while(channels)
-    {
-        if( channels & CanonicalChannels::get(i) )
-        {
-            SampleFormats::convertMany<InSampleType, T>(buffer.mChannels[i], mChannels[i], length);
-            channels ^= CanonicalChannels::get(i);
-        }
-        ++i;
-    }
-    
+    // Writing from a buffer is reading it into this one, so both stream
+    // from the other buffer's read index to this buffer's write index.
+    buffer.read(*this);
 }
 
 template< typename T >
 void TypedBuffer<T>::write( RawBuffer &buffer ) {
     
-    unsigned int length = std::min(buffer.available(), frames() - mWriteIndex);
+    unsigned int length = std::min(buffer.available(), mFrames - mWriteIndex);
 
     // Loop through each channel available in the raw buffer.
     for( uint32_t i = 0; i < buffer.mChannelCount; ++i ){
@@ -589,21 +547,21 @@ TypedBuffer<T> &TypedBuffer<T>::operator>>(RawBuffer &buffer) {
 
 // A wild buffer appears!
 template<typename T>
-TypedBuffer<T> &TypedBuffer<T>::operator<< (const Buffer& buffer )
+TypedBuffer<T> &TypedBuffer<T>::operator<< (Buffer& buffer )
 {
     switch(buffer.sampleFormat())
     {
         case kInt16:
-            write(static_cast<const Int16Buffer&>(buffer));
+            write(static_cast<Int16Buffer&>(buffer));
             break;
         case kInt32:
-            write(static_cast<const Int32Buffer&>(buffer));
+            write(static_cast<Int32Buffer&>(buffer));
             break;
         case kFloat32:
-            write(static_cast<const Float32Buffer&>(buffer));
+            write(static_cast<Float32Buffer&>(buffer));
             break;
         case kFloat64:
-            write(static_cast<const Float64Buffer&>(buffer));
+            write(static_cast<Float64Buffer&>(buffer));
             break;
         default:
             // This should never happen.
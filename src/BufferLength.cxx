@@ -11,17 +11,17 @@
 using namespace Ayane;
 
 BufferLength::BufferLength() :
-    mUnits(kFrames), mDuration(0.0), mFrames(0)
+    mUnits(kFrames), mDuration(), mFrames(0)
 {
 }
 
 BufferLength::BufferLength (const Duration &duration) :
-    mUnits(kTime), mDuration(duration.totalSeconds()), mFrames ( 0 )
+    mUnits(kTime), mDuration(duration), mFrames ( 0 )
 {
 }
 
 BufferLength::BufferLength ( unsigned int frames ) :
-    mUnits(kFrames), mDuration(0), mFrames(frames)
+    mUnits(kFrames), mDuration(), mFrames(frames)
 {
 }
 
@@ -30,19 +30,20 @@ BufferLength::BufferLength ( const BufferLength& other ) :
 {
 }
 
-double BufferLength::duration(SampleRate rate) const {
+Duration BufferLength::duration(SampleRate rate) const {
     
-    return ((mUnits == kTime) ? mDuration : (mFrames * rate));
+    return ((mUnits == kTime) ? mDuration : Duration::fromFrames(mFrames, rate));
 }
 
 unsigned int BufferLength::frames ( SampleRate rate ) const {
     
-    return ((mUnits == kFrames) ? mFrames : (mDuration * rate));
+    return ((mUnits == kFrames) ? mFrames :
+            static_cast<unsigned int>(mDuration.frames(rate)));
 }
 
 bool BufferLength::isNil() const {
     
-    if ((mFrames == 0) && (mDuration == 0.0)){
+    if ((mFrames == 0) && (mDuration.ticks() == 0)){
         return true;
     }
     
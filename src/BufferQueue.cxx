@@ -11,7 +11,8 @@
 using namespace Ayane;
 
 BufferQueue::BufferQueue( uint32_t count ) :
-mCount(++count), mWriteIndex(0), mReadIndex(0), mElements(mCount)
+mCount(++count), mWriteIndex(0), mReadIndex(0), mElements(mCount),
+mGenerations(mCount, 0)
 {
 }
 
@@ -22,6 +23,18 @@ uint32_t BufferQueue::capacity() const {
     return mCount - 1;
 }
 
+uint32_t BufferQueue::size() const {
+    
+    uint32_t writeIndex = mWriteIndex.load(std::memory_order_acquire);
+    uint32_t readIndex = mReadIndex.load(std::memory_order_acquire);
+    
+    return (writeIndex + mCount - readIndex) % mCount;
+}
+
+uint32_t BufferQueue::space() const {
+    return capacity() - size();
+}
+
 bool BufferQueue::full() const {
 
     int writeIndex = mWriteIndex.load(std::memory_order_relaxed);
@@ -37,18 +50,25 @@ bool BufferQueue::empty() const {
 
 void BufferQueue::clear() {
 
-    // Swap a new vector in place. This will force a reallocation
-    // (unlike clear()!!) which will cause the ManagedBuffer to destroy the
-    // actual buffer. vector::clear() DOES NOT WORK!
-    std::vector<ManagedBuffer>(mCount).swap(mElements);
+    // Release every element in place, returning the buffers to their pools
+    // without reallocating the elements array.
+    for(std::vector<ManagedBuffer>::iterator iter = mElements.begin(),
+        end = mElements.end(); iter != end; ++iter)
+    {
+        iter->reset();
+    }
+    
     mReadIndex = 0;
     mWriteIndex = 0;
 }
 
-bool BufferQueue::push( ManagedBuffer &inBuffer) {
+bool BufferQueue::push( ManagedBuffer &inBuffer, uint32_t generation ) {
     
     int writeIndex = mWriteIndex.load(std::memory_order_relaxed);
-    int readIndex = mReadIndex.load(std::memory_order_relaxed);
+    
+    // Acquire the read index so the consumer is done with the slot before
+    // it is overwritten.
+    int readIndex = mReadIndex.load(std::memory_order_acquire);
     
     int newWriteIndex = (writeIndex + 1) % mCount;
     
@@ -60,16 +80,18 @@ bool BufferQueue::push( ManagedBuffer &inBuffer) {
     
     // Pass ownership of the buffer to the queue.
     mElements[writeIndex] = std::move(inBuffer);
+    mGenerations[writeIndex] = generation;
     
-    // Store the new write index.
-    mWriteIndex.store(newWriteIndex, std::memory_order_relaxed);
+    // Store the new write index. Publishes the buffer to the consumer.
+    mWriteIndex.store(newWriteIndex, std::memory_order_release);
     
     return true;
 }
 
-bool BufferQueue::pop( ManagedBuffer *outBuffer) {
+bool BufferQueue::pop( ManagedBuffer *outBuffer, uint32_t *outGeneration ) {
     
-    int writeIndex = mWriteIndex.load(std::memory_order_relaxed);
+    // Acquire the write index so the pushed buffer is visible.
+    int writeIndex = mWriteIndex.load(std::memory_order_acquire);
     int readIndex = mReadIndex.load(std::memory_order_relaxed);
     
     // If the read index is equal to the write index, the queue is
@@ -81,9 +103,13 @@ bool BufferQueue::pop( ManagedBuffer *outBuffer) {
     // Pass ownership of the buffer from the queue to the caller.
     *outBuffer = std::move(mElements[readIndex]);
     
+    if( outGeneration != nullptr ) {
+        *outGeneration = mGenerations[readIndex];
+    }
+    
     // Store the new read index.
     int newReadIndex = (readIndex + 1) % mCount;
-    mReadIndex.store(newReadIndex, std::memory_order_relaxed);
+    mReadIndex.store(newReadIndex, std::memory_order_release);
     
     return true;
 }
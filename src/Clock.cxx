@@ -12,10 +12,13 @@ using namespace Ayane;
 
 Clock::Clock() :
     mStarted(false),
-    mPipelineTime(0.0),
-    mPresentationTime(0.0),
-    mDeltaTime(0.0),
-    mUpdateDelta(0.0)
+    mPaused(false),
+    mPipelineTime(0),
+    mPresentationTime(0),
+    mDeltaTime(0),
+    mUpdateDelta(0),
+    mWaiting(false),
+    mWakeSource(&mOwnWakeSource)
 {
     
 }
@@ -25,61 +28,119 @@ Clock::~Clock() {
 }
 
 void Clock::start() {
-    std::lock_guard<std::mutex> lock(mStateMutex);
     
-    if( mStarted ) {
+    if( mStarted.exchange(true) ) {
         return;
     }
     
-    //m_updateDelta = 0.0;
-    mStarted = true;
-    mAdvanceNotification.notify_all();
+    wake();
 }
 
 void Clock::stop() {
-    std::lock_guard<std::mutex> lock(mStateMutex);
 
-    if( !mStarted ) {
+    if( !mStarted.exchange(false) ) {
         return;
     }
 
-    mStarted = false;
-    mAdvanceNotification.notify_all();
+    wake();
+    mIdleWakeSource.wakeAll();
 }
 
-void Clock::reset( double time ) {
-    std::unique_lock<std::mutex> lock(mStateMutex);
-    mUpdateDelta = time - mPresentationTime;
-    mAdvanceNotification.notify_all();
+void Clock::pause() {
+    mPaused = true;
 }
 
-void Clock::advancePresentation(double delta) {
-    std::unique_lock<std::mutex> lock(mStateMutex);
+void Clock::resume() {
+    mPaused = false;
+}
+
+void Clock::reset( const Duration &time ) {
+    mUpdateDelta = time.ticks() - mPresentationTime.load();
+    wake();
+}
+
+void Clock::post(int64_t delta) {
+
+    // Time does not pass for a paused clock.
+    if( mPaused.load() ) {
+        return;
+    }
+
+    mUpdateDelta.fetch_add(delta);
+}
 
-    mUpdateDelta = delta;
-    mAdvanceNotification.notify_all();
+void Clock::wake() {
+    mWakeSource.load()->wakeAll();
 }
 
-void Clock::advancePipeline(double delta) {
-    mPipelineTime += delta;
+void Clock::advancePresentation(const Duration &delta) {
+    post(delta.ticks());
+    wake();
+}
+
+void Clock::advancePipeline(const Duration &delta) {
+    mPipelineTime.store(mPipelineTime.load(std::memory_order_relaxed) + delta.ticks(),
+                        std::memory_order_relaxed);
 }
 
 bool Clock::wait() {
-    std::unique_lock<std::mutex> lock(mStateMutex);
     
-    // Only wait if the current time is the same as the current time.
-    // Only wait if the clock is started.
-    while( (mUpdateDelta == 0.0) && mStarted ) {
-        mAdvanceNotification.wait(lock);
-    }
+    bool announced = false;
     
-    // Update the times.
-    mDeltaTime = mUpdateDelta;
-    mPresentationTime += mUpdateDelta;
-    
-    // Reset update delta.
-    mUpdateDelta = 0.0;
+    for(;;) {
+        
+        // The generation is read before the state is checked, so that an
+        // advance after the check wakes the wait below.
+        WakeSource *source = mWakeSource.load();
+        uint32_t generation = source->generation();
+        
+        if( !mStarted.load() ) {
+            mWaiting = false;
+            return false;
+        }
+        
+        if( !mPaused.load() && (mUpdateDelta.load() != 0) ) {
+            
+            // No longer idle before the advance is consumed, so that
+            // waitForIdle() never sees a consumed advance as idle.
+            mWaiting = false;
+            
+            int64_t delta = mUpdateDelta.exchange(0);
+            
+            // Update the times.
+            mDeltaTime.store(delta, std::memory_order_relaxed);
+            mPresentationTime.store(mPresentationTime.load(std::memory_order_relaxed) + delta,
+                                    std::memory_order_relaxed);
+            
+            return true;
+        }
+        
+        if( !announced ) {
+            mWaiting = true;
+            mIdleWakeSource.wakeAll();
+            announced = true;
+        }
+        
+        source->wait(generation);
+    }
+}
+
+void Clock::waitForIdle() {
     
-    // Return clock state.
-    return mStarted;
-}
\ No newline at end of file
+    for(;;) {
+        
+        uint32_t generation = mIdleWakeSource.generation();
+        
+        if( !mStarted.load() ) {
+            return;
+        }
+        
+        // A paused clock's owner never consumes an advance that raced with
+        // pause(), so it is idle as soon as it waits.
+        if( mWaiting.load() && (mPaused.load() || (mUpdateDelta.load() == 0)) ) {
+            return;
+        }
+        
+        mIdleWakeSource.wait(generation);
+    }
+}
@@ -0,0 +1,629 @@
+/*
+ *
+ * Copyright (c) 2013 Philip Deljanov. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#include "Ayane/ClockBridge.h"
+#include "Ayane/Buffer.h"
+#include "Ayane/RawBuffer.h"
+#include "Ayane/Trace.h"
+#include "Ayane/VariableResampler.h"
+
+using namespace Ayane;
+
+namespace {
+
+    const double kPi = 3.14159265358979323846;
+
+    // Bandwidth of the fill level control loop in Hz. Slow enough that
+    // corrections are inaudible, fast enough to follow thermal drift.
+    const double kControlBandwidth = 0.005;
+
+    // Time constant of the filter smoothing the fill level, in seconds.
+    // Input arrives in whole buffers, so the raw level is a sawtooth.
+    const double kLevelSmoothing = 1.0;
+
+    // Largest correction applied by the control loop. Crystal oscillators
+    // rarely differ by more than a few hundred ppm.
+    const double kMaxCorrection = 0.005;
+
+    // Output block length when no output clock provider is set.
+    const double kDefaultBlockTime = 0.01;
+
+    // Describes planar float storage for each channel at the frame offset.
+    void describe(RawBuffer &raw, const BufferFormat &format, float *base,
+                  uint32_t channelStride, uint32_t offset)
+    {
+        Channels channels = format.channels() & kChannelMask;
+        uint32_t index = 0;
+
+        for(int i = 0; channels; ++i) {
+
+            Channel channel = CanonicalChannels::get(i);
+
+            if( channels & channel ) {
+                raw.mBuffers[index].mBuffer = base + (index * channelStride) + offset;
+                raw.mBuffers[index].mChannel = channel;
+                channels ^= channel;
+                ++index;
+            }
+        }
+    }
+
+}
+
+namespace Ayane {
+
+    class ClockBridgePrivate {
+    public:
+
+        ClockBridgePrivate();
+
+        // Configures for a new input format. Any buffered frames are
+        // discarded.
+        void configure(const BufferFormat &format, SampleFormat sampleFormat);
+
+        // Empties the FIFO and waits for it to refill.
+        void reset();
+
+        // Appends the buffer's frames to the FIFO. If the FIFO is full, the
+        // oldest unread frames are skipped to make room.
+        void append(Buffer &buffer);
+
+        // Updates the resampling ratio after the specified elapsed time.
+        void control(double elapsed);
+
+        // Resamples up to the requested number of frames into the scratch
+        // storage. Returns the number of frames produced. Sets endOfStream
+        // if the stream ended.
+        uint32_t render(uint32_t frames, bool *endOfStream);
+
+        // Drops frames no longer needed by the resampler.
+        void compact();
+
+        uint32_t channelCount() const {
+            return mInputFormat.channelCount();
+        }
+
+        // Frames in the FIFO not yet consumed.
+        double available() const {
+            return mFill - mPosition;
+        }
+
+        Stage::PortHandle mInput;
+        Stage::PortHandle mOutput;
+
+        ClockProvider *mOutputClockProvider;
+        ClockProvider *mInputClockProvider;
+
+        SampleRate mOutputSampleRate;
+        double mTargetLatency;
+
+        BufferFormat mInputFormat;
+        BufferFormat mOutputFormat;
+        double mNominalRatio;
+
+        VariableResampler mResampler;
+
+        // Planar float FIFO of mCapacity frames per channel.
+        std::vector<float> mStorage;
+        uint32_t mCapacity;
+        uint32_t mFill;
+
+        // Read position in FIFO frames, and the stream time of frame 0.
+        double mPosition;
+        Duration mStorageTime;
+
+        // Set once the FIFO has filled to the target latency.
+        bool mPrimed;
+
+        // Set once the end of the stream was appended.
+        bool mEndOfStream;
+
+        // Output domain time at the last run, and output frames owed.
+        Duration mLastTime;
+        double mOwed;
+
+        // Control loop state.
+        double mLevel;
+        double mIntegral;
+        double mCorrection;
+
+        // Output blocks.
+        BufferPool mPool;
+        uint32_t mBlockFrames;
+        std::vector<float> mScratch;
+
+        // Statistics for other threads.
+        std::atomic<double> mPublishedCorrection;
+        std::atomic<double> mFillLevel;
+        std::atomic<uint64_t> mUnderruns;
+        std::atomic<uint64_t> mOverruns;
+    };
+
+}
+
+ClockBridgePrivate::ClockBridgePrivate() :
+    mInput(Stage::kInvalidPortHandle),
+    mOutput(Stage::kInvalidPortHandle),
+    mOutputClockProvider(nullptr),
+    mInputClockProvider(nullptr),
+    mOutputSampleRate(0),
+    mTargetLatency(0.05),
+    mNominalRatio(1.0),
+    mCapacity(0),
+    mFill(0),
+    mPosition(0.0),
+    mStorageTime(),
+    mPrimed(false),
+    mEndOfStream(false),
+    mLastTime(),
+    mOwed(0.0),
+    mLevel(0.0),
+    mIntegral(0.0),
+    mCorrection(1.0),
+    mBlockFrames(0),
+    mPublishedCorrection(1.0),
+    mFillLevel(0.0),
+    mUnderruns(0),
+    mOverruns(0)
+{
+
+}
+
+void ClockBridgePrivate::configure(const BufferFormat &format, SampleFormat sampleFormat) {
+
+    SampleRate outputRate = (mOutputSampleRate != 0) ? mOutputSampleRate : format.sampleRate();
+
+    mInputFormat = format;
+    mOutputFormat = BufferFormat(format.channels(), outputRate);
+    mNominalRatio = static_cast<double>(format.sampleRate()) / outputRate;
+
+    mResampler.configure(mNominalRatio);
+
+    // Room for the target latency several times over. The FIFO never
+    // grows while processing, so a longer stall and burst overruns it.
+    mCapacity = static_cast<uint32_t>(std::ceil(mTargetLatency * 4.0 * format.sampleRate())) +
+                mResampler.taps();
+    mStorage.assign(static_cast<size_t>(mCapacity) * channelCount(), 0.0f);
+
+    // Output blocks span one output clock period.
+    double blockTime = mOutputClockProvider ?
+        (mOutputClockProvider->clockPeriod() / 1000000000.0) : kDefaultBlockTime;
+
+    mBlockFrames = std::max<uint32_t>(64, static_cast<uint32_t>(std::ceil(blockTime * outputRate)));
+    mScratch.assign(static_cast<size_t>(mBlockFrames) * channelCount(), 0.0f);
+
+    mPool = BufferPoolFactory::create(sampleFormat, mOutputFormat,
+                                      BufferLength(mBlockFrames), 4);
+
+    mIntegral = 0.0;
+    mCorrection = 1.0;
+
+    reset();
+}
+
+void ClockBridgePrivate::reset() {
+
+    // The resampler reads history before the first frame, so start with
+    // that much silence.
+    uint32_t history = mResampler.history();
+
+    std::fill(mStorage.begin(), mStorage.end(), 0.0f);
+
+    mFill = history;
+    mPosition = history;
+    mStorageTime = Duration();
+    mPrimed = false;
+    mEndOfStream = false;
+    mLevel = 0.0;
+}
+
+void ClockBridgePrivate::append(Buffer &buffer) {
+
+    uint32_t frames = buffer.available();
+    bool endOfStream = (buffer.flags() & Buffer::kEndOfStream) != 0;
+
+    // Leave room for the tail of silence that flushes the resampler.
+    uint32_t required = mFill + frames + mResampler.future();
+
+    if( required > mCapacity ) {
+
+        // Overrun. Skip the oldest unread frames so that the newest audio
+        // is kept, and leave the control loop to bring the fill level back
+        // to the target latency.
+        double skip = std::min<double>(required - mCapacity, std::floor(available()));
+
+        mPosition += skip;
+        compact();
+
+        // A burst longer than the whole FIFO is truncated.
+        uint32_t limit = mCapacity - mResampler.future();
+        frames = (mFill < limit) ? std::min(frames, limit - mFill) : 0;
+
+        mOverruns.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // The first frame after a reset sets the stream time.
+    if( !mPrimed && (mFill == mResampler.history()) ) {
+        mStorageTime = buffer.timestamp() -
+                       Duration::fromFrames(mFill, mInputFormat.sampleRate());
+    }
+
+    RawBuffer raw(frames, channelCount(), kFloat32, true);
+    describe(raw, mInputFormat, &mStorage[0], mCapacity, mFill);
+    buffer >> raw;
+
+    mFill += raw.mWriteIndex;
+
+    if( endOfStream ) {
+
+        // Silence after the last frame lets the resampler reach it.
+        uint32_t tail = std::min(mResampler.future(), mCapacity - mFill);
+
+        for(uint32_t i = 0; i < channelCount(); ++i) {
+            std::fill_n(&mStorage[(i * mCapacity) + mFill], tail, 0.0f);
+        }
+
+        mFill += tail;
+        mEndOfStream = true;
+    }
+}
+
+void ClockBridgePrivate::control(double elapsed) {
+
+    double inputRate = mInputFormat.sampleRate();
+    double level = available() / inputRate;
+
+    mFillLevel.store(level, std::memory_order_relaxed);
+
+    if( !mPrimed ) {
+        mLevel = level;
+        return;
+    }
+
+    double smoothing = std::min(1.0, elapsed / kLevelSmoothing);
+    mLevel += smoothing * (level - mLevel);
+
+    // A critically damped PI controller on the smoothed fill level error.
+    // A fuller FIFO consumes input faster.
+    double omega = 2.0 * kPi * kControlBandwidth;
+    double error = mLevel - mTargetLatency;
+
+    double integral = mIntegral + ((omega * omega) * error * elapsed);
+    double correction = (2.0 * omega * error) + integral;
+
+    // Hold the integral while the correction is limited, so that it does
+    // not wind up and overshoot once the level recovers.
+    if( std::fabs(correction) < kMaxCorrection ) {
+        mIntegral = integral;
+    }
+
+    correction = std::max(-kMaxCorrection, std::min(kMaxCorrection, correction));
+
+    // Apply the drift measured by the providers directly. A slower output
+    // device consumes fewer input frames per second.
+    double drift = 1.0;
+
+    if( mInputClockProvider && mOutputClockProvider ) {
+        drift = mOutputClockProvider->rateRatio() / mInputClockProvider->rateRatio();
+    }
+
+    mCorrection = drift * (1.0 + correction);
+    mPublishedCorrection.store(mCorrection, std::memory_order_relaxed);
+}
+
+uint32_t ClockBridgePrivate::render(uint32_t frames, bool *endOfStream) {
+
+    *endOfStream = false;
+
+    if( !mPrimed ) {
+
+        double target = mTargetLatency * mInputFormat.sampleRate();
+
+        if( (available() < target) && !mEndOfStream ) {
+            return 0;
+        }
+
+        mPrimed = true;
+    }
+
+    double ratio = mNominalRatio * mCorrection;
+    uint32_t future = mResampler.future();
+    uint32_t produced = 0;
+
+    while( produced < frames ) {
+
+        uint32_t index = static_cast<uint32_t>(mPosition);
+
+        // Every frame the filter reads must be in the FIFO.
+        if( (index + future) >= mFill ) {
+
+            if( mEndOfStream ) {
+                *endOfStream = true;
+            }
+            else {
+                mUnderruns.fetch_add(1, std::memory_order_relaxed);
+
+                WARNING_THIS("ClockBridge::process") << "Underrun, refilling "
+                "to the target latency." << std::endl;
+            }
+
+            mPrimed = false;
+            break;
+        }
+
+        double fraction = mPosition - index;
+
+        for(uint32_t i = 0; i < channelCount(); ++i) {
+            mScratch[(i * mBlockFrames) + produced] =
+                mResampler.interpolate(&mStorage[(i * mCapacity) + index], fraction);
+        }
+
+        mPosition += ratio;
+        ++produced;
+    }
+
+    return produced;
+}
+
+void ClockBridgePrivate::compact() {
+
+    uint32_t index = static_cast<uint32_t>(mPosition);
+    uint32_t history = mResampler.history();
+
+    if( index <= history ) {
+        return;
+    }
+
+    uint32_t drop = std::min(index - history, mFill);
+
+    for(uint32_t i = 0; i < channelCount(); ++i) {
+        float *channel = &mStorage[i * mCapacity];
+        std::memmove(channel, channel + drop, (mFill - drop) * sizeof(float));
+    }
+
+    mFill -= drop;
+    mPosition -= drop;
+    mStorageTime += Duration::fromFrames(drop, mInputFormat.sampleRate());
+}
+
+ClockBridge::ClockBridge() : Stage(), d_ptr(new ClockBridgePrivate) {
+    A_D(ClockBridge);
+
+    d->mInput = addSink("input");
+    d->mOutput = addSource("output");
+
+    // The upstream stages stay in the input clock domain.
+    input()->setScheduling(Sink::kForceAsynchronous);
+}
+
+ClockBridge::~ClockBridge() {
+    delete d_ptr;
+}
+
+Stage::Sink *ClockBridge::input() {
+    A_D(ClockBridge);
+    return sink(d->mInput);
+}
+
+Stage::Source *ClockBridge::output() {
+    A_D(ClockBridge);
+    return source(d->mOutput);
+}
+
+void ClockBridge::setOutputClockProvider(ClockProvider *clockProvider) {
+    A_D(ClockBridge);
+    d->mOutputClockProvider = clockProvider;
+}
+
+void ClockBridge::setInputClockProvider(ClockProvider *clockProvider) {
+    A_D(ClockBridge);
+    d->mInputClockProvider = clockProvider;
+}
+
+SampleRate ClockBridge::outputSampleRate() const {
+    A_D(const ClockBridge);
+    return d->mOutputSampleRate;
+}
+
+void ClockBridge::setOutputSampleRate(SampleRate sampleRate) {
+    A_D(ClockBridge);
+    d->mOutputSampleRate = sampleRate;
+}
+
+double ClockBridge::targetLatency() const {
+    A_D(const ClockBridge);
+    return d->mTargetLatency;
+}
+
+void ClockBridge::setTargetLatency(double latency) {
+    A_D(ClockBridge);
+    d->mTargetLatency = latency;
+}
+
+double ClockBridge::correction() const {
+    A_D(const ClockBridge);
+    return d->mPublishedCorrection.load(std::memory_order_relaxed);
+}
+
+double ClockBridge::fillLevel() const {
+    A_D(const ClockBridge);
+    return d->mFillLevel.load(std::memory_order_relaxed);
+}
+
+uint64_t ClockBridge::underruns() const {
+    A_D(const ClockBridge);
+    return d->mUnderruns.load(std::memory_order_relaxed);
+}
+
+uint64_t ClockBridge::overruns() const {
+    A_D(const ClockBridge);
+    return d->mOverruns.load(std::memory_order_relaxed);
+}
+
+double ClockBridge::latency() const {
+    A_D(const ClockBridge);
+    return d->mTargetLatency;
+}
+
+ClockProvider *ClockBridge::requiredClockProvider() {
+    A_D(ClockBridge);
+    return d->mOutputClockProvider;
+}
+
+bool ClockBridge::beginPlayback() {
+    A_D(ClockBridge);
+
+    // The clock restarts from zero.
+    d->mLastTime = Duration();
+    d->mOwed = 0.0;
+
+    d->mUnderruns = 0;
+    d->mOverruns = 0;
+
+    if( d->mInputFormat.isValid() ) {
+        d->reset();
+    }
+
+    return true;
+}
+
+bool ClockBridge::stoppedPlayback() {
+    return true;
+}
+
+void ClockBridge::flushed() {
+    A_D(ClockBridge);
+
+    if( d->mInputFormat.isValid() ) {
+        d->reset();
+    }
+}
+
+void ClockBridge::process(ProcessIOFlags *) {
+    A_D(ClockBridge);
+
+    // Collect everything the input domain has queued.
+    ManagedBuffer buffer;
+
+    while( tryPull(input(), &buffer) == kSuccess ) {
+        d->append(*buffer);
+        buffer.reset();
+    }
+
+    Duration now = clock()->presentationTime();
+    double elapsed = (now - d->mLastTime).totalSeconds();
+
+    d->mLastTime = now;
+
+    if( !d->mInputFormat.isValid() ) {
+        return;
+    }
+
+    d->control(elapsed);
+
+    // Produce the output domain's elapsed time in frames. The provider's
+    // events are timed by the system clock, so scale by the device's
+    // measured rate.
+    double outputRate = d->mOutputFormat.sampleRate();
+
+    if( d->mOutputClockProvider ) {
+        outputRate /= d->mOutputClockProvider->rateRatio();
+    }
+
+    d->mOwed += elapsed * outputRate;
+
+    uint32_t frames = static_cast<uint32_t>(d->mOwed);
+    d->mOwed -= frames;
+
+    while( frames > 0 ) {
+
+        // Stamped with the input frame the block starts at.
+        Duration timestamp = d->mStorageTime +
+            Duration::fromFrames(static_cast<int64_t>(d->mPosition), d->mInputFormat.sampleRate());
+
+        bool endOfStream;
+        uint32_t produced = d->render(std::min(frames, d->mBlockFrames), &endOfStream);
+
+        if( produced > 0 || endOfStream ) {
+
+            ManagedBuffer block = d->mPool->acquire();
+
+            RawBuffer raw(produced, d->channelCount(), kFloat32, true);
+            describe(raw, d->mOutputFormat, &d->mScratch[0], d->mBlockFrames, 0);
+            raw.mWriteIndex = produced;
+            (*block) << raw;
+
+            block->setTimestamp(timestamp);
+
+            if( endOfStream ) {
+                block->setFlag(Buffer::kEndOfStream);
+            }
+
+            // Never drop a block, wait for the output domain to take it.
+            while( push(output(), block) == kNoCredits ) {
+                if( !awaitCredit(output()) ) {
+                    break;
+                }
+            }
+        }
+
+        d->compact();
+
+        // Output only resumes once the FIFO has refilled.
+        if( produced < std::min(frames, d->mBlockFrames) ) {
+
+            if( endOfStream ) {
+                d->reset();
+            }
+
+            d->mOwed = 0.0;
+            break;
+        }
+
+        frames -= produced;
+    }
+}
+
+bool ClockBridge::reconfigureIO() {
+    return true;
+}
+
+bool ClockBridge::reconfigureInputFormat(const Sink &, const BufferFormat &format) {
+    A_D(ClockBridge);
+
+    if( !format.isValid() ) {
+        return false;
+    }
+
+    d->configure(format, plannedSampleFormat());
+
+    INFO_THIS("ClockBridge::reconfigureInputFormat") << "Bridging "
+    << format.sampleRate() << "Hz to " << d->mOutputFormat.sampleRate()
+    << "Hz." << std::endl;
+
+    return true;
+}
+
+BufferFormat ClockBridge::proposeOutputFormat(const Source &) {
+    A_D(ClockBridge);
+
+    const BufferFormat &format = input()->configuredBufferFormat();
+
+    if( !format.isValid() ) {
+        return BufferFormat();
+    }
+
+    return BufferFormat(format.channels(),
+                        (d->mOutputSampleRate != 0) ? d->mOutputSampleRate : format.sampleRate());
+}
@@ -6,15 +6,31 @@
  *
  */
 
+#include <cmath>
+#include <thread>
+
 #include "Ayane/ClockProvider.h"
+#include "Ayane/Trace.h"
 
 using namespace Ayane;
 
 ClockProvider::ClockProvider(ClockCapabilities capabilities, uint64_t defaultPeriod) :
 mCapabilities(capabilities),
+mSubscriberEnd(0),
+mEpoch(0),
+mLoopPeriod(0),
+mLoopTicks(0),
+mLoopBandwidth(1.0),
+mRelock(true),
+mFilteredTime(0.0),
+mPredictedTime(0.0),
+mRateRatio(1.0),
+mJitter(0.0),
 mClockPeriod(defaultPeriod)
 {
-
+    for(size_t i = 0; i < kMaxClocks; ++i) {
+        mSubscribers[i] = nullptr;
+    }
 }
 
 ClockProvider::~ClockProvider() {
@@ -35,19 +51,159 @@ bool ClockProvider::setClockPeriod(uint64_t period) {
 
 }
 
-void ClockProvider::registerClock(Clock *clock) {
-    mSubscribers.push_back(clock);
+bool ClockProvider::registerClock(Clock *clock) {
+    
+    // The clock sleeps on the provider's wake source from now on. Wake it
+    // in case it is already sleeping on its own.
+    clock->mWakeSource = &mWakeSource;
+    clock->mOwnWakeSource.wakeAll();
+    
+    for(size_t i = 0; i < kMaxClocks; ++i) {
+        
+        Clock *expected = nullptr;
+        
+        if( mSubscribers[i].compare_exchange_strong(expected, clock) ) {
+            
+            size_t end = mSubscriberEnd.load();
+            
+            while( (end < i + 1) && !mSubscriberEnd.compare_exchange_weak(end, i + 1) ) {
+            }
+            
+            return true;
+        }
+    }
+    
+    clock->mWakeSource = &clock->mOwnWakeSource;
+    
+    ERROR_THIS("ClockProvider::registerClock") << "Too many clocks registered, "
+    "the limit is " << kMaxClocks << "." << std::endl;
+    
+    return false;
 }
 
 void ClockProvider::deregisterClock(Clock *clock) {
-    mSubscribers.remove(clock);
+    
+    size_t end = mSubscriberEnd.load();
+    
+    for(size_t i = 0; i < end; ++i) {
+        
+        Clock *expected = clock;
+        
+        if( mSubscribers[i].compare_exchange_strong(expected, nullptr) ) {
+            
+            // Move the clock back to its own wake source, and wake it in
+            // case it is sleeping on the provider's.
+            clock->mWakeSource = &clock->mOwnWakeSource;
+            mWakeSource.wakeAll();
+            
+            // The publisher may still be advancing the clock.
+            synchronize();
+            return;
+        }
+    }
+}
+
+void ClockProvider::synchronize() const {
+    
+    uint64_t epoch = mEpoch.load();
+    
+    if( epoch & 1 ) {
+        while( mEpoch.load() == epoch ) {
+            std::this_thread::yield();
+        }
+    }
+}
+
+void ClockProvider::publish(const Duration &time) {
+    
+    mEpoch.fetch_add(1);
+    
+    size_t end = mSubscriberEnd.load();
+    
+    for(size_t i = 0; i < end; ++i) {
+        
+        Clock *clock = mSubscribers[i].load();
+        
+        if( clock != nullptr ) {
+            clock->post(time.ticks());
+        }
+    }
+    
+    mEpoch.fetch_add(1);
+    
+    // One wake-up for every clock.
+    mWakeSource.wakeAll();
+}
+
+void ClockProvider::setSmoothingBandwidth(double bandwidth) {
+    mLoopBandwidth = bandwidth;
+    mRelock = true;
+}
+
+void ClockProvider::resetSmoothing() {
+    mRelock = true;
+}
+
+void ClockProvider::publishTimestamp(double time) {
+    
+    double period = static_cast<double>(mClockPeriod) / 1000000000.0;
+    Duration delta = Duration::fromNanoseconds(static_cast<int64_t>(mClockPeriod));
+    
+    bool relock = mRelock.exchange(false) || (mLoopPeriod != mClockPeriod) ||
+        (std::fabs(time - mLoop.nextTime()) > (kRelockPeriods * mLoop.period()));
+    
+    if( relock ) {
+        mLoop.setBandwidth(mLoopBandwidth);
+        mLoop.reset(time, period);
+        mLoopPeriod = mClockPeriod;
+        mLoopTicks = Duration(mLoop.time()).ticks();
+    }
+    else {
+        int64_t ticks = Duration(mLoop.update(time)).ticks();
+        delta = Duration::fromTicks(ticks - mLoopTicks);
+        mLoopTicks = ticks;
+    }
+    
+    mFilteredTime.store(mLoop.time(), std::memory_order_relaxed);
+    mPredictedTime.store(mLoop.nextTime(), std::memory_order_relaxed);
+    mRateRatio.store(mLoop.rateRatio(), std::memory_order_relaxed);
+    mJitter.store(mLoop.jitter(), std::memory_order_relaxed);
+    
+    publish(delta);
 }
 
-void ClockProvider::publish(double time) {
-    for (std::list<Clock*>::iterator iter = mSubscribers.begin(),
-         end = mSubscribers.end(); iter != end; ++iter ) {
+size_t ClockProvider::publishAndWait(const Duration &time) {
+    
+    mEpoch.fetch_add(1);
+    
+    size_t end = mSubscriberEnd.load();
+    
+    for(size_t i = 0; i < end; ++i) {
+        
+        Clock *clock = mSubscribers[i].load();
         
-        (*iter)->advancePresentation(time);
+        if( clock != nullptr ) {
+            clock->post(time.ticks());
+        }
+    }
+    
+    mWakeSource.wakeAll();
+    
+    // Subscribers process the event concurrently, so only wait once all of
+    // them have been advanced. Paused subscribers discard the event.
+    size_t active = 0;
+    
+    for(size_t i = 0; i < end; ++i) {
         
+        Clock *clock = mSubscribers[i].load();
+        
+        if( (clock != nullptr) && !clock->isPaused() ) {
+            clock->waitForIdle();
+            ++active;
+        }
     }
+    
+    mEpoch.fetch_add(1);
+    
+    return active;
 }
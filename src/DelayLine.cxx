@@ -0,0 +1,166 @@
+/*
+ *
+ * Copyright (c) 2013 Philip Deljanov. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "Ayane/DelayLine.h"
+#include "Ayane/Buffer.h"
+#include "Ayane/RawBuffer.h"
+
+using namespace Ayane;
+
+namespace {
+
+    // Describes the storage of each channel at the specified frame offset.
+    void describe(RawBuffer &raw, const BufferFormat &format, uint8_t *base,
+                  uint32_t channelStride, uint32_t offset)
+    {
+        Channels channels = format.channels() & kChannelMask;
+        uint32_t index = 0;
+
+        for(int i = 0; channels; ++i) {
+
+            Channel channel = CanonicalChannels::get(i);
+
+            if( channels & channel ) {
+                raw.mBuffers[index].mBuffer = base + (index * channelStride) + offset;
+                raw.mBuffers[index].mChannel = channel;
+                channels ^= channel;
+                ++index;
+            }
+        }
+    }
+
+}
+
+DelayLine::DelayLine(double delay) :
+    mDelay(delay),
+    mDelayFrames(0),
+    mSampleFormat(kFloat32),
+    mFramesPerChannel(0),
+    mMaxFrames(0),
+    mBypassed(0)
+{
+
+}
+
+void DelayLine::setDelay(double delay) {
+
+    mDelay = delay;
+
+    // Reserve again for the new delay.
+    if( !mStorage.empty() ) {
+        reserve(mSampleFormat, mFormat, mMaxFrames);
+    }
+}
+
+void DelayLine::reserve(SampleFormat sampleFormat, const BufferFormat &format,
+                        uint32_t maxFrames)
+{
+    // Size the storage for the widest sample format.
+    uint32_t widest = 0;
+
+    for(int i = 0; i <= kFloat64; ++i) {
+        widest = std::max(widest, SampleFormats::about(static_cast<SampleFormat>(i)).stride);
+    }
+
+    uint32_t delayFrames = (mDelay > 0.0) ?
+        static_cast<uint32_t>(std::lround(mDelay * format.sampleRate())) : 0;
+
+    mStorage.assign(static_cast<size_t>(delayFrames + maxFrames) *
+                    format.channelCount() * widest, 0);
+
+    mMaxFrames = maxFrames;
+
+    layout(sampleFormat, format, maxFrames);
+}
+
+bool DelayLine::layout(SampleFormat sampleFormat, const BufferFormat &format,
+                       uint32_t maxFrames)
+{
+    uint32_t delayFrames = (mDelay > 0.0) ?
+        static_cast<uint32_t>(std::lround(mDelay * format.sampleRate())) : 0;
+    uint32_t framesPerChannel = delayFrames + maxFrames;
+
+    size_t size = static_cast<size_t>(framesPerChannel) * format.channelCount() *
+                  SampleFormats::about(sampleFormat).stride;
+
+    if( size > mStorage.size() ) {
+        return false;
+    }
+
+    mSampleFormat = sampleFormat;
+    mFormat = format;
+    mDelayFrames = delayFrames;
+    mFramesPerChannel = framesPerChannel;
+
+    // The delayed frames of the old layout are meaningless in the new one.
+    clear();
+
+    return true;
+}
+
+void DelayLine::clear() {
+    std::fill(mStorage.begin(), mStorage.end(), 0);
+}
+
+bool DelayLine::process(Buffer &buffer) {
+
+    uint32_t frames = buffer.available();
+
+    // Lay the storage out again if the buffers changed, or are larger than
+    // expected. Never allocates.
+    if( (buffer.sampleFormat() != mSampleFormat) || (buffer.format() != mFormat) ||
+        (frames > (mFramesPerChannel - mDelayFrames)) )
+    {
+        if( !layout(buffer.sampleFormat(), buffer.format(), std::max(frames, mMaxFrames)) ) {
+            ++mBypassed;
+            return false;
+        }
+    }
+
+    if( (mDelayFrames == 0) || (frames == 0) ) {
+        return true;
+    }
+    const uint32_t sampleSize = SampleFormats::about(mSampleFormat).stride;
+    const uint32_t channelStride = mFramesPerChannel * sampleSize;
+    const uint32_t channelCount = mFormat.channelCount();
+
+    Buffer::StreamFlags flags = buffer.flags();
+    Duration timestamp = buffer.timestamp();
+
+    // Append the buffer's frames after the delayed frames.
+    RawBuffer tail(frames, channelCount, mSampleFormat, true);
+    describe(tail, mFormat, &mStorage[0], channelStride, mDelayFrames * sampleSize);
+    buffer >> tail;
+
+    // Refill the buffer with the oldest frames.
+    buffer.reset();
+
+    RawBuffer head(frames, channelCount, mSampleFormat, true);
+    describe(head, mFormat, &mStorage[0], channelStride, 0);
+    head.mWriteIndex = frames;
+    buffer << head;
+
+    // Restore the stream state cleared by the reset.
+    buffer.setTimestamp(timestamp);
+
+    if( flags & Buffer::kEndOfStream ) {
+        buffer.setFlag(Buffer::kEndOfStream);
+    }
+
+    // Shift the remaining frames to the start of each channel.
+    for(uint32_t i = 0; i < channelCount; ++i) {
+        uint8_t *channel = &mStorage[0] + (i * channelStride);
+        std::memmove(channel, channel + (frames * sampleSize), mDelayFrames * sampleSize);
+    }
+
+    return true;
+}
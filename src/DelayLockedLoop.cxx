@@ -0,0 +1,62 @@
+/*
+ *
+ * Copyright (c) 2013 Philip Deljanov. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ */
+
+#include <cmath>
+
+#include "Ayane/DelayLockedLoop.h"
+
+using namespace Ayane;
+
+DelayLockedLoop::DelayLockedLoop(double bandwidth) :
+    mBandwidth(bandwidth),
+    mB(0.0),
+    mC(0.0),
+    mNominalPeriod(0.0),
+    mTime(0.0),
+    mNextTime(0.0),
+    mPeriod(0.0),
+    mErrorPower(0.0)
+{
+
+}
+
+void DelayLockedLoop::reset(double time, double period) {
+
+    // Critically damped second order loop. See F. Adriaensen, "Using a DLL
+    // to filter time", 2005.
+    double omega = 2.0 * M_PI * mBandwidth * period;
+
+    mB = std::sqrt(2.0) * omega;
+    mC = omega * omega;
+
+    mNominalPeriod = period;
+
+    mTime = time;
+    mPeriod = period;
+    mNextTime = time + period;
+
+    mErrorPower = 0.0;
+}
+
+double DelayLockedLoop::update(double time) {
+
+    double error = time - mNextTime;
+
+    mTime = mNextTime;
+    mNextTime += (mB * error) + mPeriod;
+    mPeriod += mC * error;
+
+    // Average the error power over about the same time as the loop.
+    mErrorPower += mB * ((error * error) - mErrorPower);
+
+    return mTime;
+}
+
+double DelayLockedLoop::jitter() const {
+    return std::sqrt(mErrorPower);
+}
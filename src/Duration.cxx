@@ -12,110 +12,181 @@
 
 using namespace Ayane;
 
-Duration::Duration ( double seconds ) : mTime ( seconds )
+namespace {
+
+    const int64_t kTicksPerMinute = Duration::kTicksPerSecond * 60;
+    const int64_t kTicksPerHour = kTicksPerMinute * 60;
+    const int64_t kTicksPerDay = kTicksPerHour * 24;
+
+    // Computes value * num / den rounded to the nearest integer, without
+    // overflowing for any value as long as (den * num) fits in 63 bits.
+    int64_t scale( int64_t value, int64_t num, int64_t den )
+    {
+        int64_t whole = value / den;
+        int64_t part = value % den;
+        int64_t rest = part * num;
+
+        rest += (rest < 0) ? -(den / 2) : (den / 2);
+
+        return (whole * num) + (rest / den);
+    }
+
+    int64_t toTicks( double seconds )
+    {
+        return std::llround( seconds * Duration::kTicksPerSecond );
+    }
+
+}
+
+Duration::Duration () : mTicks ( 0 )
+{
+}
+
+Duration::Duration ( double seconds ) : mTicks ( toTicks ( seconds ) )
 {
 }
 
 Duration::Duration ( unsigned int minutes, double seconds )
 {
-    mTime = ( minutes * 60.0f ) + seconds;
+    mTicks = ( minutes * kTicksPerMinute ) + toTicks ( seconds );
 }
 
 Duration::Duration ( unsigned int hours, unsigned int minutes, double seconds )
 {
-    mTime = ( hours * 3600.0f ) + ( minutes * 60.0f ) + seconds;
+    mTicks = ( hours * kTicksPerHour ) + ( minutes * kTicksPerMinute ) + toTicks ( seconds );
 }
 
 Duration::Duration ( unsigned int days, unsigned int hours, unsigned int minutes, double seconds )
 {
-    mTime = ( days * 24.0f * 3600.0f ) + ( hours * 3600.0f ) + ( minutes * 60.0f ) + seconds;
+    mTicks = ( days * kTicksPerDay ) + ( hours * kTicksPerHour ) +
+             ( minutes * kTicksPerMinute ) + toTicks ( seconds );
+}
+
+Duration Duration::fromTicks ( int64_t ticks )
+{
+    Duration duration;
+    duration.mTicks = ticks;
+    return duration;
+}
+
+Duration Duration::fromFrames ( int64_t frames, SampleRate rate )
+{
+    if( rate == 0 ) {
+        return Duration();
+    }
+
+    // Common rates divide the tick rate, so no rounding is needed.
+    if( ( kTicksPerSecond % rate ) == 0 ) {
+        return fromTicks ( frames * ( kTicksPerSecond / rate ) );
+    }
+
+    return fromTicks ( scale ( frames, kTicksPerSecond, rate ) );
+}
+
+Duration Duration::fromNanoseconds ( int64_t nanoseconds )
+{
+    // 705600000 / 1000000000 reduced.
+    return fromTicks ( scale ( nanoseconds, 441, 625 ) );
+}
+
+int64_t Duration::frames ( SampleRate rate ) const
+{
+    if( ( rate != 0 ) && ( ( kTicksPerSecond % rate ) == 0 ) ) {
+        int64_t ticksPerFrame = kTicksPerSecond / rate;
+        return scale ( mTicks, 1, ticksPerFrame );
+    }
+
+    return scale ( mTicks, rate, kTicksPerSecond );
 }
 
 double Duration::totalSeconds() const
 {
-    return mTime;
+    return static_cast<double> ( mTicks ) / kTicksPerSecond;
 }
 
 double Duration::totalMinutes() const
 {
-    return ( mTime / 60.0f );
+    return static_cast<double> ( mTicks ) / kTicksPerMinute;
 }
 
 double Duration::totalHours() const
 {
-    return ( mTime / 3600.0f );
+    return static_cast<double> ( mTicks ) / kTicksPerHour;
 }
 
 double Duration::totalDays() const
 {
-    return ( mTime / ( 24.0f * 3600.0f ) );
+    return static_cast<double> ( mTicks ) / kTicksPerDay;
 }
 
 double Duration::seconds() const
 {
-    return fmod ( mTime, 60.0f );
+    return static_cast<double> ( mTicks % kTicksPerMinute ) / kTicksPerSecond;
 }
 
 unsigned int Duration::minutes() const
 {
-    double minutes = mTime / 60.0f;
-    return ( ( unsigned int ) minutes );
+    return static_cast<unsigned int> ( mTicks / kTicksPerMinute );
 }
 
 unsigned int Duration::hours() const
 {
-    double hours = mTime / 3600.0f;
-    return ( ( unsigned int ) hours );
+    return static_cast<unsigned int> ( mTicks / kTicksPerHour );
 }
 
 unsigned int Duration::days() const
 {
-    double days = mTime / ( 24.0f * 60.0f );
-    return ( ( unsigned int ) days );
+    return static_cast<unsigned int> ( mTicks / kTicksPerDay );
 }
 
 bool Duration::operator== ( const Duration& rhs ) const
 {
-    return ( mTime == rhs.mTime );
+    return ( mTicks == rhs.mTicks );
 }
 
 bool Duration::operator!= ( const Duration& rhs ) const
 {
-    return ( mTime != rhs.mTime );
+    return ( mTicks != rhs.mTicks );
 }
 
 bool Duration::operator< ( const Duration& rhs ) const
 {
-    return ( mTime < rhs.mTime );
+    return ( mTicks < rhs.mTicks );
 }
 
 bool Duration::operator<= ( const Duration& rhs ) const
 {
-    return ( mTime <= rhs.mTime );
+    return ( mTicks <= rhs.mTicks );
 }
 
 bool Duration::operator> ( const Duration& rhs ) const
 {
-    return ( mTime > rhs.mTime );
+    return ( mTicks > rhs.mTicks );
 }
 
 bool Duration::operator>= ( const Duration& rhs ) const
 {
-    return ( mTime >= rhs.mTime );
+    return ( mTicks >= rhs.mTicks );
 }
 
-Duration& Duration::operator= ( const Duration& rhs )
+Duration Duration::operator+ ( const Duration& rhs ) const
 {
-    mTime = rhs.mTime;
-    return *this;
+    return fromTicks ( mTicks + rhs.mTicks );
+}
+
+Duration Duration::operator- ( const Duration& rhs ) const
+{
+    return fromTicks ( mTicks - rhs.mTicks );
 }
 
-Duration Duration::operator+ ( const Duration& rhs )
+Duration& Duration::operator+= ( const Duration& rhs )
 {
-    return Duration ( mTime + rhs.mTime );
+    mTicks += rhs.mTicks;
+    return *this;
 }
 
-Duration Duration::operator- ( const Duration& rhs )
+Duration& Duration::operator-= ( const Duration& rhs )
 {
-    return Duration ( mTime - rhs.mTime );
+    mTicks -= rhs.mTicks;
+    return *this;
 }
@@ -0,0 +1,551 @@
+/*
+ *
+ * Copyright (c) 2013 Philip Deljanov. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ */
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <thread>
+
+#include "Ayane/LevelScheduler.h"
+#include "Ayane/Stage.h"
+#include "Ayane/Trace.h"
+
+namespace Ayane {
+
+    class LevelSchedulerPrivate {
+    public:
+
+        LevelSchedulerPrivate(unsigned int workers);
+        ~LevelSchedulerPrivate();
+
+        /** Scheduling loop. Runs one cycle per clock tick. */
+        void schedulerThread();
+
+        /** Worker loop. Helps run the Stages of the current level. */
+        void workerThread();
+
+        /** Runs all the levels once. */
+        void runCycle();
+
+        /**
+         *  Runs Stages of the level dispatched as the specified generation
+         *  until none are left. Returns the number of Stages run.
+         */
+        uint32_t runTasks(const std::vector<Stage*> &level, uint32_t generation);
+
+        /** Starts the worker threads. */
+        void startWorkers();
+
+        /** Stops the worker threads. */
+        void stopWorkers();
+
+        /** Applies the thread attributes to the calling thread. */
+        void applyThreadAttributes();
+
+
+        unsigned int mWorkerCount;
+
+        // Thread attributes for the scheduling and worker threads.
+        ThreadAttributes mThreadAttributes;
+        std::atomic<ThreadAttributes::Failures> mThreadAttributeFailures;
+
+        // Stages split into dependency levels.
+        std::vector<Stage*> mStages;
+        std::vector<std::vector<Stage*>> mLevels;
+
+        // Per-level statistics. Protected by mStatisticsMutex.
+        std::vector<LevelStatistics> mStatistics;
+        mutable std::mutex mStatisticsMutex;
+
+        ClockProvider *mClockProvider;
+        Clock mClock;
+
+        std::thread mSchedulerThread;
+        std::vector<std::thread> mWorkers;
+
+        // Work dispatch state.
+        std::mutex mWorkMutex;
+        std::condition_variable mWorkNotification;
+        std::condition_variable mDoneNotification;
+
+        // The task cursor packs the dispatch generation into the upper 32
+        // bits, and the index of the next Stage to run into the lower 32
+        // bits. A worker that wakes up late can therefore never claim a
+        // Stage from a newer level.
+        const std::vector<Stage*> *mCurrentLevel;
+        std::atomic<uint64_t> mTaskCursor;
+        uint32_t mPendingTasks;
+        uint32_t mGeneration;
+        bool mStopping;
+    };
+
+}
+
+using namespace Ayane;
+
+LevelSchedulerPrivate::LevelSchedulerPrivate(unsigned int workers) :
+    mWorkerCount(workers),
+    mThreadAttributeFailures(ThreadAttributes::kNone),
+    mClockProvider(nullptr),
+    mCurrentLevel(nullptr),
+    mTaskCursor(0),
+    mPendingTasks(0),
+    mGeneration(0),
+    mStopping(false)
+{
+    if( mWorkerCount == 0 ) {
+        mWorkerCount = std::thread::hardware_concurrency();
+    }
+
+    // hardware_concurrency() may return 0 if it can't be determined.
+    if( mWorkerCount == 0 ) {
+        mWorkerCount = 1;
+    }
+}
+
+LevelSchedulerPrivate::~LevelSchedulerPrivate() {
+
+}
+
+void LevelSchedulerPrivate::applyThreadAttributes() {
+
+    if( !mThreadAttributes.isDefault() ) {
+
+        ThreadAttributes::Failures failures = mThreadAttributes.apply();
+
+        if( failures != ThreadAttributes::kNone ) {
+            mThreadAttributeFailures |= failures;
+
+            WARNING_THIS("LevelScheduler::applyThreadAttributes") << "Failed "
+            "to apply thread attributes, Failures=" << failures << "."
+            << std::endl;
+        }
+    }
+}
+
+void LevelSchedulerPrivate::startWorkers() {
+
+    mStopping = false;
+    mThreadAttributeFailures = ThreadAttributes::kNone;
+
+    // The scheduling thread is a worker too.
+    for(unsigned int i = 1; i < mWorkerCount; ++i) {
+        mWorkers.push_back(std::thread(&LevelSchedulerPrivate::workerThread, this));
+    }
+}
+
+void LevelSchedulerPrivate::stopWorkers() {
+
+    {
+        std::lock_guard<std::mutex> lock(mWorkMutex);
+        mStopping = true;
+        mWorkNotification.notify_all();
+    }
+
+    for(std::vector<std::thread>::iterator iter = mWorkers.begin(),
+        end = mWorkers.end(); iter != end; ++iter)
+    {
+        iter->join();
+    }
+
+    mWorkers.clear();
+}
+
+uint32_t LevelSchedulerPrivate::runTasks(const std::vector<Stage*> &level,
+                                         uint32_t generation)
+{
+    uint32_t count = 0;
+    uint64_t cursor = mTaskCursor.load();
+
+    while( true ) {
+
+        uint32_t task = static_cast<uint32_t>(cursor);
+
+        // Stop if the level was finished, or a newer level was dispatched.
+        if( (static_cast<uint32_t>(cursor >> 32) != generation) ||
+            (task >= level.size()) )
+        {
+            break;
+        }
+
+        // Claim the Stage. On failure, cursor is reloaded.
+        if( mTaskCursor.compare_exchange_weak(cursor, cursor + 1) ) {
+            level[task]->processScheduled();
+            ++count;
+
+            cursor = mTaskCursor.load();
+        }
+    }
+
+    return count;
+}
+
+void LevelSchedulerPrivate::workerThread() {
+
+    applyThreadAttributes();
+
+    uint32_t generation = 0;
+
+    std::unique_lock<std::mutex> lock(mWorkMutex);
+
+    while( true ) {
+
+        // Wait for a new level to be dispatched.
+        while( !mStopping && (generation == mGeneration) ) {
+            mWorkNotification.wait(lock);
+        }
+
+        if( mStopping ) {
+            break;
+        }
+
+        generation = mGeneration;
+        const std::vector<Stage*> &level = *mCurrentLevel;
+
+        lock.unlock();
+        uint32_t count = runTasks(level, generation);
+        lock.lock();
+
+        mPendingTasks -= count;
+
+        if( (count > 0) && (mPendingTasks == 0) ) {
+            mDoneNotification.notify_one();
+        }
+    }
+}
+
+void LevelSchedulerPrivate::runCycle() {
+
+    typedef std::chrono::steady_clock SteadyClock;
+
+    const uint64_t deadline = mClockProvider->clockPeriod();
+
+    SteadyClock::time_point cycleStart = SteadyClock::now();
+
+    for(size_t i = 0; i < mLevels.size(); ++i) {
+
+        SteadyClock::time_point levelStart = SteadyClock::now();
+
+        uint32_t generation;
+
+        {
+            std::lock_guard<std::mutex> lock(mWorkMutex);
+
+            generation = ++mGeneration;
+
+            mCurrentLevel = &mLevels[i];
+            mTaskCursor = static_cast<uint64_t>(generation) << 32;
+            mPendingTasks = mLevels[i].size();
+
+            // A single Stage level isn't worth waking the workers for.
+            if( mLevels[i].size() > 1 ) {
+                mWorkNotification.notify_all();
+            }
+        }
+
+        uint32_t count = runTasks(mLevels[i], generation);
+
+        // Barrier. Wait for the workers to finish the level.
+        {
+            std::unique_lock<std::mutex> lock(mWorkMutex);
+
+            mPendingTasks -= count;
+
+            while( mPendingTasks > 0 ) {
+                mDoneNotification.wait(lock);
+            }
+        }
+
+        SteadyClock::time_point levelEnd = SteadyClock::now();
+
+        uint64_t duration = std::chrono::duration_cast<std::chrono::nanoseconds>(levelEnd - levelStart).count();
+        uint64_t elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(levelEnd - cycleStart).count();
+
+        std::lock_guard<std::mutex> lock(mStatisticsMutex);
+
+        LevelStatistics &statistics = mStatistics[i];
+
+        statistics.lastDuration = duration;
+
+        if( duration > statistics.maxDuration ) {
+            statistics.maxDuration = duration;
+        }
+
+        // Blame the level that was running when the deadline expired.
+        if( (elapsed > deadline) && (elapsed - duration <= deadline) ) {
+            ++statistics.deadlineMisses;
+        }
+    }
+}
+
+void LevelSchedulerPrivate::schedulerThread() {
+
+    applyThreadAttributes();
+
+    while( mClock.wait() ) {
+        runCycle();
+    }
+
+    INFO_THIS("LevelScheduler::schedulerThread") << "Scheduling thread "
+    << std::this_thread::get_id() << " exiting." << std::endl;
+}
+
+
+
+
+LevelScheduler::LevelScheduler(unsigned int workers) :
+    d_ptr(new LevelSchedulerPrivate(workers))
+{
+
+}
+
+LevelScheduler::~LevelScheduler() {
+    stop();
+    delete d_ptr;
+}
+
+bool LevelScheduler::build(const std::vector<Stage*> &stages) {
+
+    A_D(LevelScheduler);
+
+    if( d->mSchedulerThread.joinable() ) {
+        NOTICE_THIS("LevelScheduler::build") << "Can't rebuild the levels "
+        "while running." << std::endl;
+        return false;
+    }
+
+    d->mStages.clear();
+    d->mLevels.clear();
+    d->mStatistics.clear();
+
+    // Count the number of in-collection upstream Stages of each Stage.
+    std::map<Stage*, uint32_t> inDegree;
+
+    for(std::vector<Stage*>::const_iterator iter = stages.begin(),
+        end = stages.end(); iter != end; ++iter)
+    {
+        inDegree.insert(std::make_pair(*iter, 0));
+    }
+
+    for(std::map<Stage*, uint32_t>::iterator iter = inDegree.begin(),
+        end = inDegree.end(); iter != end; ++iter)
+    {
+        Stage::ConstSourceIteratorPair sources = iter->first->sourceIterator();
+
+        for(Stage::ConstSourceIterator source = sources.first;
+            source != sources.second; ++source)
+        {
+            Stage::Sink *sink = (*source)->linkedSink();
+
+            if( sink != nullptr ) {
+                std::map<Stage*, uint32_t>::iterator downstream = inDegree.find(sink->stage());
+
+                if( downstream != inDegree.end() ) {
+                    ++downstream->second;
+                }
+            }
+        }
+    }
+
+    // Peel off levels of Stages with no pending upstream Stages (Kahn's
+    // algorithm, one level at a time).
+    std::vector<Stage*> ready;
+
+    for(std::map<Stage*, uint32_t>::iterator iter = inDegree.begin(),
+        end = inDegree.end(); iter != end; ++iter)
+    {
+        if( iter->second == 0 ) {
+            ready.push_back(iter->first);
+        }
+    }
+
+    size_t scheduled = 0;
+
+    while( !ready.empty() ) {
+
+        std::vector<Stage*> next;
+
+        for(std::vector<Stage*>::iterator iter = ready.begin(),
+            end = ready.end(); iter != end; ++iter)
+        {
+            Stage::ConstSourceIteratorPair sources = (*iter)->sourceIterator();
+
+            for(Stage::ConstSourceIterator source = sources.first;
+                source != sources.second; ++source)
+            {
+                Stage::Sink *sink = (*source)->linkedSink();
+
+                if( sink != nullptr ) {
+                    std::map<Stage*, uint32_t>::iterator downstream = inDegree.find(sink->stage());
+
+                    if( (downstream != inDegree.end()) && (--downstream->second == 0) ) {
+                        next.push_back(downstream->first);
+                    }
+                }
+            }
+        }
+
+        scheduled += ready.size();
+
+        d->mLevels.push_back(std::vector<Stage*>());
+        d->mLevels.back().swap(ready);
+        ready.swap(next);
+    }
+
+    if( scheduled != inDegree.size() ) {
+        ERROR_THIS("LevelScheduler::build") << "The stages do not form an "
+        "acyclic graph." << std::endl;
+
+        d->mLevels.clear();
+        return false;
+    }
+
+    d->mStages = stages;
+    d->mStatistics.resize(d->mLevels.size());
+
+    for(size_t i = 0; i < d->mLevels.size(); ++i) {
+        d->mStatistics[i].stages = d->mLevels[i].size();
+
+        TRACE_THIS("LevelScheduler::build") << "Level " << i << ": "
+        << d->mLevels[i].size() << " stage(s)." << std::endl;
+    }
+
+    return true;
+}
+
+void LevelScheduler::attach() {
+
+    A_D(LevelScheduler);
+
+    for(std::vector<Stage*>::iterator iter = d->mStages.begin(),
+        end = d->mStages.end(); iter != end; ++iter)
+    {
+        (*iter)->attachScheduler(&d->mClock);
+    }
+}
+
+void LevelScheduler::detach() {
+
+    A_D(LevelScheduler);
+
+    for(std::vector<Stage*>::iterator iter = d->mStages.begin(),
+        end = d->mStages.end(); iter != end; ++iter)
+    {
+        (*iter)->detachScheduler();
+    }
+}
+
+bool LevelScheduler::start(ClockProvider &clockProvider) {
+
+    A_D(LevelScheduler);
+
+    if( d->mSchedulerThread.joinable() ) {
+        NOTICE_THIS("LevelScheduler::start") << "Scheduler already started."
+        << std::endl;
+        return false;
+    }
+
+    if( !clockProvider.registerClock(&d->mClock) ) {
+        ERROR_THIS("LevelScheduler::start") << "Could not register the "
+        "scheduler's clock." << std::endl;
+        return false;
+    }
+
+    d->mClockProvider = &clockProvider;
+
+    d->startWorkers();
+
+    d->mClock.start();
+    d->mSchedulerThread = std::thread(&LevelSchedulerPrivate::schedulerThread, d);
+
+    INFO_THIS("LevelScheduler::start") << "Started scheduling "
+    << d->mLevels.size() << " level(s) on " << d->mWorkerCount
+    << " worker(s)." << std::endl;
+
+    return true;
+}
+
+void LevelScheduler::stop() {
+
+    A_D(LevelScheduler);
+
+    if( d->mSchedulerThread.joinable() ) {
+
+        // Stop the clock. The scheduling thread will exit after the current
+        // cycle.
+        d->mClock.stop();
+        d->mSchedulerThread.join();
+
+        d->stopWorkers();
+
+        d->mClockProvider->deregisterClock(&d->mClock);
+        d->mClockProvider = nullptr;
+    }
+}
+
+void LevelScheduler::pause() {
+
+    A_D(LevelScheduler);
+
+    if( d->mSchedulerThread.joinable() ) {
+
+        // Ticks are discarded while paused. Wait for the scheduling thread
+        // to finish the current cycle and block on the clock.
+        d->mClock.pause();
+        d->mClock.waitForIdle();
+    }
+}
+
+void LevelScheduler::resume() {
+
+    A_D(LevelScheduler);
+
+    d->mClock.resume();
+}
+
+void LevelScheduler::setThreadAttributes(const ThreadAttributes &attributes) {
+
+    A_D(LevelScheduler);
+
+    if( d->mSchedulerThread.joinable() ) {
+        NOTICE_THIS("LevelScheduler::setThreadAttributes") << "Can't set thread "
+        "attributes while running." << std::endl;
+        return;
+    }
+
+    d->mThreadAttributes = attributes;
+}
+
+ThreadAttributes::Failures LevelScheduler::threadAttributeFailures() const {
+    A_D(const LevelScheduler);
+    return d->mThreadAttributeFailures;
+}
+
+unsigned int LevelScheduler::workerCount() const {
+    A_D(const LevelScheduler);
+    return d->mWorkerCount;
+}
+
+unsigned int LevelScheduler::levelCount() const {
+    A_D(const LevelScheduler);
+    return d->mLevels.size();
+}
+
+const std::vector<Stage*> &LevelScheduler::level(unsigned int index) const {
+    A_D(const LevelScheduler);
+    return d->mLevels.at(index);
+}
+
+LevelStatistics LevelScheduler::statistics(unsigned int index) const {
+    A_D(const LevelScheduler);
+
+    std::lock_guard<std::mutex> lock(d->mStatisticsMutex);
+    return d->mStatistics.at(index);
+}
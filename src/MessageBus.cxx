@@ -6,20 +6,96 @@
  *
  */
 
+#include <chrono>
+#include <cmath>
 #include <vector>
-#include <map>
 #include <thread>
 #include <mutex>
-#include <condition_variable>
 #include <atomic>
 
 #include "Ayane/MessageBus.h"
+#include "Ayane/AlignedMemory.h"
+#include "Ayane/WakeSource.h"
 #include "Ayane/Trace.h"
 
 using namespace Ayane;
 
+namespace {
+    
+    // Number of preallocated messages of each type.
+    const uint32_t kMessagePoolCapacity = 64;
+    
+    // Alignment of each block in a message pool.
+    const size_t kMessageAlignment = 16;
+    
+    // Number of progress sources that can be coalesced.
+    const int kCoalescingSlots = 32;
+    
+    // Marks the end of a message pool's free list.
+    const uint32_t kNoBlock = 0xffffffff;
+    
+    // Current time of the monotonic clock.
+    Duration steadyTime() {
+        return Duration::fromNanoseconds(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+    
+    // Index of a message type's bit.
+    int typeIndex(MessageType type) {
+        
+        int index = 0;
+        uint32_t bits = static_cast<uint32_t>(type);
+        
+        if( bits == 0 ) {
+            return -1;
+        }
+        
+        while( (bits & 1) == 0 ) {
+            bits >>= 1;
+            ++index;
+        }
+        
+        return index;
+    }
+    
+}
+
 namespace Ayane {
-                
+    
+    struct MessageSubscriber {
+        Subscription mSubscription;
+        MessageTypes mTypes;
+        MessageHandler mHandler;
+    };
+    
+    /*
+     * The latest progress of one source. At most one message is queued for
+     * the source at a time, and it is given the latest duration when it is
+     * dispatched. Also records when the source's progress was last
+     * delivered, and holds back progress dispatched sooner than the rate
+     * limit allows until it may be delivered.
+     */
+    struct CoalescingSlot {
+        
+        CoalescingSlot() :
+            mKey(0), mLatest(0), mQueued(false), mDelivered(false), mHeld(false)
+        {
+        }
+        
+        // The source's address plus one, or 0 if the slot is unclaimed. The
+        // offset lets progress without a source be coalesced too.
+        std::atomic<uintptr_t> mKey;
+        
+        std::atomic<int64_t> mLatest;
+        std::atomic_bool mQueued;
+        
+        // Only used by the dispatch thread.
+        Duration mLastDelivery;
+        bool mDelivered;
+        Duration mHeldProgress;
+        bool mHeld;
+    };
+    
     class MessageBusPrivate {
     public:
         
@@ -27,77 +103,391 @@ namespace Ayane {
         ~MessageBusPrivate();
         
         void post(MessageBase *message);
-        MessageBase *flush();
+        MessageBase *pop();
+        void release(MessageBase *message);
         void clear();
         
+        int claimSlot(const Stage *source);
+        bool coalesce(MessageBase *message);
+        bool throttle(const ProgressMessage *progress, const Duration &now);
+        bool deliverHeld(std::chrono::nanoseconds *timeout);
+        void resetSlots();
+        
+        void dispatch(MessageBase *message);
+        void deliver(const MessageBase &message);
         void dispatchThread();
-
+        
+        
+        static const int kTypeCount = 7;
         
         std::thread mDispatchThread;
         std::mutex mDispatchMutex;
-        std::condition_variable mDispatchNotification;
-        
-        std::map<MessageType, MessageHandler> mSubscribers;
+        WakeSource mDispatchNotification;
         
+        // Intrusive multi-producer, single-consumer queue. Producers
+        // exchange themselves into the tail, and the dispatch thread pops
+        // from the head, so messages are delivered in the order published.
+        // The stub message keeps the queue non-empty.
+        MessageBase mStub;
+        std::atomic<MessageBase*> mQueueTail;
         MessageBase *mQueueHead;
         
+        MessagePool *mPools[kTypeCount];
+        std::atomic<uint64_t> mDropped;
+        
+        std::vector<MessageSubscriber> mSubscribers;
+        Subscription mNextSubscription;
+        
+        CoalescingSlot mSlots[kCoalescingSlots];
+        std::atomic_bool mCoalesceProgress;
+        std::atomic<int64_t> mProgressInterval;
+        
         std::atomic_bool mStopping;
+        
+        ThreadAttributes mThreadAttributes;
+        std::atomic<ThreadAttributes::Failures> mThreadAttributeFailures;
     };
     
 }
 
 
-MessageBusPrivate::MessageBusPrivate() :
-    mQueueHead(new MessageBase(kNil)), mStopping(false)
+MessagePool::MessagePool(size_t size, uint32_t capacity) :
+    mStride(((size + kMessageAlignment - 1) / kMessageAlignment) * kMessageAlignment),
+    mCapacity(capacity),
+    mStorage(AlignedMemory::allocate16<unsigned char>(mStride * capacity)),
+    mNextFree(new std::atomic<uint32_t>[capacity]),
+    mFreeHead((capacity > 0) ? 0 : kNoBlock)
 {
+    for(uint32_t i = 0; i < capacity; ++i) {
+        mNextFree[i].store((i + 1 < capacity) ? (i + 1) : kNoBlock);
+    }
+}
+
+MessagePool::~MessagePool() {
+    delete [] mNextFree;
+    AlignedMemory::deallocate(mStorage);
+}
+
+void *MessagePool::acquire() {
+    
+    uint64_t head = mFreeHead.load(std::memory_order_acquire);
     
+    while(true) {
+        
+        uint32_t index = static_cast<uint32_t>(head);
+        
+        if( index == kNoBlock ) {
+            return nullptr;
+        }
+        
+        uint64_t count = (head >> 32) + 1;
+        uint64_t next = mNextFree[index].load(std::memory_order_relaxed);
+        
+        if( mFreeHead.compare_exchange_weak(head, (count << 32) | next,
+                                            std::memory_order_acquire,
+                                            std::memory_order_acquire) )
+        {
+            return mStorage + (index * mStride);
+        }
+    }
 }
 
-MessageBusPrivate::~MessageBusPrivate(){
+void MessagePool::release(void *block) {
+    
+    uint32_t index = static_cast<uint32_t>((static_cast<unsigned char*>(block) - mStorage) / mStride);
+    uint64_t head = mFreeHead.load(std::memory_order_relaxed);
     
-    if( mQueueHead ) {
-        delete mQueueHead;
+    while(true) {
+        
+        uint64_t count = (head >> 32) + 1;
+        
+        mNextFree[index].store(static_cast<uint32_t>(head), std::memory_order_relaxed);
+        
+        if( mFreeHead.compare_exchange_weak(head, (count << 32) | index,
+                                            std::memory_order_release,
+                                            std::memory_order_relaxed) )
+        {
+            return;
+        }
     }
+}
+
+
+MessageBusPrivate::MessageBusPrivate() :
+    mStub(kNil),
+    mQueueTail(&mStub),
+    mQueueHead(&mStub),
+    mDropped(0),
+    mNextSubscription(1),
+    mCoalesceProgress(false),
+    mProgressInterval(0),
+    mStopping(false),
+    mThreadAttributeFailures(ThreadAttributes::kNone)
+{
+    mPools[typeIndex(kError)] = new MessagePool(sizeof(ErrorMessage), kMessagePoolCapacity);
+    mPools[typeIndex(kWarning)] = new MessagePool(sizeof(WarningMessage), kMessagePoolCapacity);
+    mPools[typeIndex(kTrace)] = new MessagePool(sizeof(TraceMessage), kMessagePoolCapacity);
+    mPools[typeIndex(kDuration)] = new MessagePool(sizeof(DurationMessage), kMessagePoolCapacity);
+    mPools[typeIndex(kProgress)] = new MessagePool(sizeof(ProgressMessage), kMessagePoolCapacity);
+    mPools[typeIndex(kEndOfStream)] = new MessagePool(sizeof(EndOfStreamMessage), kMessagePoolCapacity);
+    mPools[typeIndex(kClockLost)] = new MessagePool(sizeof(ClockLostMessage), kMessagePoolCapacity);
+}
+
+MessageBusPrivate::~MessageBusPrivate(){
     
+    // Release any undelivered messages before their pools are destroyed.
     clear();
+    
+    for(int i = 0; i < kTypeCount; ++i) {
+        delete mPools[i];
+    }
 }
 
 void MessageBusPrivate::post(MessageBase *message){
     
-    MessageBase *expectedHeadNext = nullptr;
+    message->mNext.store(nullptr, std::memory_order_relaxed);
     
-    do {
-        expectedHeadNext = mQueueHead->mNext.load(std::memory_order_relaxed);
-        message->mNext = expectedHeadNext;
-    }
-    while(!std::atomic_compare_exchange_weak(&mQueueHead->mNext,
-                                             &expectedHeadNext,
-                                             message));
+    MessageBase *previous = mQueueTail.exchange(message, std::memory_order_acq_rel);
+    previous->mNext.store(message, std::memory_order_release);
     
     // Send notification to consumer thread.
-    mDispatchNotification.notify_one();
+    mDispatchNotification.wakeAll();
 }
 
-MessageBase *MessageBusPrivate::flush() {
+MessageBase *MessageBusPrivate::pop() {
+    
+    MessageBase *head = mQueueHead;
+    MessageBase *next = head->mNext.load(std::memory_order_acquire);
+    
+    // Skip over the stub.
+    if( head == &mStub ) {
+        
+        if( next == nullptr ) {
+            return nullptr;
+        }
+        
+        mQueueHead = next;
+        head = next;
+        next = next->mNext.load(std::memory_order_acquire);
+    }
+    
+    if( next != nullptr ) {
+        mQueueHead = next;
+        return head;
+    }
+    
+    // A publisher has exchanged itself into the tail, but not yet linked
+    // itself in. It wakes the dispatch thread once it has.
+    if( head != mQueueTail.load(std::memory_order_acquire) ) {
+        return nullptr;
+    }
+    
+    // The head is the last message. Requeue the stub behind it so it can
+    // be popped without leaving the queue empty.
+    post(&mStub);
     
-    MessageBase *expectedHeadNext = nullptr;
+    next = head->mNext.load(std::memory_order_acquire);
     
-    do {
-        expectedHeadNext = mQueueHead->mNext.load(std::memory_order_relaxed);
-    } while(!std::atomic_compare_exchange_weak(&mQueueHead->mNext,
-                                                &expectedHeadNext,
-                                                (MessageBase*)nullptr));
+    if( next != nullptr ) {
+        mQueueHead = next;
+        return head;
+    }
     
-    return expectedHeadNext;
+    return nullptr;
+}
+
+void MessageBusPrivate::release(MessageBase *message) {
+    
+    MessagePool *pool = message->mPool;
+    
+    if( pool ) {
+        message->~MessageBase();
+        pool->release(message);
+    }
+    else {
+        delete message;
+    }
 }
 
 void MessageBusPrivate::clear() {
-    MessageBase *currentQueueItem = flush();
     
-    while( currentQueueItem != nullptr ){
-        MessageBase *item = currentQueueItem;
-        currentQueueItem = item->mNext;
-        delete currentQueueItem;
+    MessageBase *message = nullptr;
+    
+    while( (message = pop()) != nullptr ){
+        release(message);
+    }
+}
+
+int MessageBusPrivate::claimSlot(const Stage *source) {
+    
+    uintptr_t key = reinterpret_cast<uintptr_t>(source) + 1;
+    
+    // Slots are claimed in order and never released while running, so
+    // every publisher tries to claim the same first free slot, and a source
+    // can't end up with two slots.
+    for(int i = 0; i < kCoalescingSlots; ++i) {
+        
+        uintptr_t current = mSlots[i].mKey.load();
+        
+        if( current == 0 ) {
+            mSlots[i].mKey.compare_exchange_strong(current, key);
+            
+            if( current == 0 ) {
+                return i;
+            }
+        }
+        
+        if( current == key ) {
+            return i;
+        }
+    }
+    
+    return -1;
+}
+
+bool MessageBusPrivate::coalesce(MessageBase *message) {
+    
+    if( (message->mType != kProgress) || !mCoalesceProgress.load(std::memory_order_relaxed) ) {
+        return false;
+    }
+    
+    ProgressMessage *progress = static_cast<ProgressMessage*>(message);
+    
+    int index = claimSlot(progress->source());
+    
+    if( index < 0 ) {
+        return false;
+    }
+    
+    CoalescingSlot &slot = mSlots[index];
+    
+    // Store the latest progress before checking for a queued message. The
+    // dispatcher clears the queued flag before reading the latest, so
+    // either it reads this progress, or this publish queues a new message.
+    slot.mLatest.store(progress->mDuration.ticks());
+    
+    if( slot.mQueued.exchange(true) ) {
+        release(message);
+        return true;
+    }
+    
+    message->mCoalescingSlot = index;
+    return false;
+}
+
+bool MessageBusPrivate::throttle(const ProgressMessage *progress, const Duration &now) {
+    
+    int64_t interval = mProgressInterval.load(std::memory_order_relaxed);
+    
+    if( interval <= 0 ) {
+        return false;
+    }
+    
+    int index = (progress->mCoalescingSlot >= 0) ?
+        progress->mCoalescingSlot : claimSlot(progress->source());
+    
+    if( index < 0 ) {
+        return false;
+    }
+    
+    CoalescingSlot &slot = mSlots[index];
+    
+    // Too soon, hold the progress back in place of any held before it.
+    if( slot.mDelivered && ((now - slot.mLastDelivery).ticks() < interval) ) {
+        slot.mHeldProgress = progress->mDuration;
+        slot.mHeld = true;
+        return true;
+    }
+    
+    slot.mLastDelivery = now;
+    slot.mDelivered = true;
+    slot.mHeld = false;
+    return false;
+}
+
+bool MessageBusPrivate::deliverHeld(std::chrono::nanoseconds *timeout) {
+    
+    int64_t interval = mProgressInterval.load(std::memory_order_relaxed);
+    Duration now = steadyTime();
+    
+    bool held = false;
+    int64_t earliest = 0;
+    
+    for(int i = 0; i < kCoalescingSlots; ++i) {
+        
+        CoalescingSlot &slot = mSlots[i];
+        
+        if( !slot.mHeld ) {
+            continue;
+        }
+        
+        int64_t remaining = interval - (now - slot.mLastDelivery).ticks();
+        
+        if( remaining > 0 ) {
+            
+            if( !held || (remaining < earliest) ) {
+                earliest = remaining;
+            }
+            
+            held = true;
+            continue;
+        }
+        
+        slot.mLastDelivery = now;
+        slot.mHeld = false;
+        
+        const Stage *source = reinterpret_cast<const Stage*>(slot.mKey.load() - 1);
+        deliver(ProgressMessage(slot.mHeldProgress, source));
+    }
+    
+    // Round up, so the wait doesn't end just before the interval.
+    if( held ) {
+        *timeout = std::chrono::nanoseconds(static_cast<int64_t>(
+            std::ceil(Duration::fromTicks(earliest).totalSeconds() * 1000000000.0)));
+    }
+    
+    return held;
+}
+
+void MessageBusPrivate::resetSlots() {
+    for(int i = 0; i < kCoalescingSlots; ++i) {
+        mSlots[i].mKey.store(0);
+        mSlots[i].mQueued.store(false);
+        mSlots[i].mDelivered = false;
+        mSlots[i].mHeld = false;
+    }
+}
+
+void MessageBusPrivate::dispatch(MessageBase *message) {
+    
+    if( message->mCoalescingSlot >= 0 ) {
+        
+        CoalescingSlot &slot = mSlots[message->mCoalescingSlot];
+        
+        slot.mQueued.store(false);
+        
+        ProgressMessage *progress = static_cast<ProgressMessage*>(message);
+        progress->mDuration = Duration::fromTicks(slot.mLatest.load());
+    }
+    
+    // Progress from a source delivered too recently is held back.
+    if( (message->mType == kProgress) &&
+        throttle(static_cast<const ProgressMessage*>(message), steadyTime()) )
+    {
+        return;
+    }
+    
+    deliver(*message);
+}
+
+void MessageBusPrivate::deliver(const MessageBase &message) {
+    
+    std::vector<MessageSubscriber>::const_iterator subscriber;
+    
+    for(subscriber = mSubscribers.begin(); subscriber != mSubscribers.end(); ++subscriber) {
+        if( subscriber->mTypes & message.mType ) {
+            subscriber->mHandler(message);
+        }
     }
 }
 
@@ -105,33 +495,56 @@ void MessageBusPrivate::dispatchThread() {
     INFO_THIS("MessageBusPrivate::dispatchThread") << "Started message bus "
     "dispatch thread " << std::this_thread::get_id() << "." << std::endl;
     
-    MessageBase *message = nullptr;
+    if( !mThreadAttributes.isDefault() ) {
+        
+        mThreadAttributeFailures = mThreadAttributes.apply();
+        
+        if( mThreadAttributeFailures != ThreadAttributes::kNone ) {
+            WARNING_THIS("MessageBusPrivate::dispatchThread") << "Failed to "
+            "apply thread attributes, Failures=" << mThreadAttributeFailures
+            << "." << std::endl;
+        }
+    }
     
-    while (!mStopping) {
+    while (true) {
         
-        // Obtain the dispatch lock to protect the subscriber map.
-        std::unique_lock<std::mutex> lock(mDispatchMutex);
+        // Read the generation first, so a wake-up from stop() or post()
+        // after the checks below is never missed.
+        uint32_t generation = mDispatchNotification.generation();
         
-        while(!mStopping && (message = flush()) == nullptr){
-            mDispatchNotification.wait(lock);
+        if( mStopping ) {
+            break;
         }
         
-        // Process the messages.
-        while(message != nullptr){
-            
-            std::map<MessageType, MessageHandler>::const_iterator handler;
-            handler = mSubscribers.find(message->mType);
+        MessageBase *message = pop();
+        
+        std::chrono::nanoseconds timeout;
+        bool held;
+        
+        {
+            // Obtain the dispatch lock to protect the subscriber map.
+            std::unique_lock<std::mutex> lock(mDispatchMutex);
             
-            if(handler != mSubscribers.end()) {
-                handler->second(*message);
+            // Process the messages.
+            while(message != nullptr){
+                
+                dispatch(message);
+                release(message);
+                
+                message = mStopping ? nullptr : pop();
             }
             
-            MessageBase *lastMessage = message;
-            message = message->mNext;
-            delete lastMessage;
+            // Deliver held back progress that is now due.
+            held = deliverHeld(&timeout);
         }
         
-        message = nullptr;
+        // Wake in time for the earliest held back progress.
+        if( held ) {
+            mDispatchNotification.wait(generation, timeout);
+        }
+        else {
+            mDispatchNotification.wait(generation);
+        }
     }
     
     
@@ -163,11 +576,12 @@ void MessageBus::stop(){
     
     if(d->mDispatchThread.joinable()){
         d->mStopping = true;
-        d->mDispatchNotification.notify_one();
+        d->mDispatchNotification.wakeAll();
         d->mDispatchThread.join();
         
         // Clear any remaining messages.
         d->clear();
+        d->resetSlots();
     }
 }
 
@@ -176,32 +590,99 @@ bool MessageBus::isRunning() const{
     return d->mDispatchThread.joinable();
 }
 
+void MessageBus::setThreadAttributes(const ThreadAttributes &attributes) {
+    A_D(MessageBus);
+    
+    if(d->mDispatchThread.joinable()){
+        NOTICE_THIS("MessageBus::setThreadAttributes") << "Can't set thread "
+        "attributes while running." << std::endl;
+        return;
+    }
+    
+    d->mThreadAttributes = attributes;
+}
+
+ThreadAttributes::Failures MessageBus::threadAttributeFailures() const {
+    A_D(const MessageBus);
+    return d->mThreadAttributeFailures;
+}
+
 void MessageBus::publish(MessageBase *message) {
     A_D(MessageBus);
-    d->post(message);
+    
+    if( !d->coalesce(message) ) {
+        d->post(message);
+    }
 }
 
-void MessageBus::subscribe(MessageType type, MessageHandler &handler){
+uint64_t MessageBus::droppedMessages() const {
+    A_D(const MessageBus);
+    return d->mDropped.load();
+}
+
+MessagePool *MessageBus::pool(MessageType type) {
+    A_D(MessageBus);
+    
+    int index = typeIndex(type);
+    
+    if( (index < 0) || (index >= MessageBusPrivate::kTypeCount) ) {
+        return nullptr;
+    }
+    
+    return d->mPools[index];
+}
+
+void MessageBus::dropped() {
+    A_D(MessageBus);
+    d->mDropped.fetch_add(1, std::memory_order_relaxed);
+}
+
+void MessageBus::setCoalesceProgress(bool coalesce) {
+    A_D(MessageBus);
+    d->mCoalesceProgress = coalesce;
+}
+
+bool MessageBus::coalesceProgress() const {
+    A_D(const MessageBus);
+    return d->mCoalesceProgress;
+}
+
+void MessageBus::setProgressInterval(const Duration &interval) {
+    A_D(MessageBus);
+    d->mProgressInterval = interval.ticks();
+}
+
+Duration MessageBus::progressInterval() const {
+    A_D(const MessageBus);
+    return Duration::fromTicks(d->mProgressInterval);
+}
+
+Subscription MessageBus::subscribe(MessageTypes types, const MessageHandler &handler){
     A_D(MessageBus);
     
     std::lock_guard<std::mutex> lock(d->mDispatchMutex);
     
-    d->mSubscribers.insert(std::make_pair(type, handler));
+    MessageSubscriber subscriber;
+    subscriber.mSubscription = d->mNextSubscription++;
+    subscriber.mTypes = types;
+    subscriber.mHandler = handler;
+    
+    d->mSubscribers.push_back(subscriber);
+    
+    return subscriber.mSubscription;
 }
 
-void MessageBus::unsubscribe(MessageType type, MessageHandler &handler){
+void MessageBus::unsubscribe(Subscription subscription){
     A_D(MessageBus);
     
     std::lock_guard<std::mutex> lock(d->mDispatchMutex);
     
-    std::map<MessageType,MessageHandler>::iterator handlerIter;
-    handlerIter = d->mSubscribers.find(type);
+    std::vector<MessageSubscriber>::iterator subscriber;
     
-    if(handlerIter != d->mSubscribers.end()){
-        d->mSubscribers.erase(handlerIter);
+    for(subscriber = d->mSubscribers.begin(); subscriber != d->mSubscribers.end(); ++subscriber) {
+        if( subscriber->mSubscription == subscription ) {
+            d->mSubscribers.erase(subscriber);
+            return;
+        }
     }
 }
-
-
-
-
@@ -0,0 +1,98 @@
+/*
+ *
+ * Copyright (c) 2013 Philip Deljanov. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ */
+
+#include <chrono>
+
+#include "Ayane/OfflineClockProvider.h"
+#include "Ayane/Trace.h"
+
+using namespace Ayane;
+
+namespace {
+
+    uint64_t periodOf(uint32_t sampleRate, uint32_t frames) {
+        return (static_cast<uint64_t>(frames) * 1000000000) / sampleRate;
+    }
+
+}
+
+OfflineClockProvider::OfflineClockProvider(uint32_t sampleRate,
+                                           uint32_t framesPerTick) :
+    ClockProvider(ClockCapabilities(periodOf(sampleRate, framesPerTick),
+                                    periodOf(sampleRate, framesPerTick)),
+                  periodOf(sampleRate, framesPerTick)),
+    mSampleRate(sampleRate),
+    mFramesPerTick(framesPerTick),
+    mFrameLimit(0),
+    mFrames(0),
+    mRunning(false)
+{
+
+}
+
+OfflineClockProvider::~OfflineClockProvider() {
+    stop();
+}
+
+void OfflineClockProvider::start() {
+
+    if( mRunning ) {
+        NOTICE_THIS("OfflineClockProvider::start") << "Already started."
+        << std::endl;
+        return;
+    }
+
+    // The thread may have exited on reaching the frame limit.
+    if( mThread.joinable() ) {
+        mThread.join();
+    }
+
+    mRunning = true;
+    mThread = std::thread(&OfflineClockProvider::run, this);
+}
+
+void OfflineClockProvider::stop() {
+
+    mRunning = false;
+
+    if( mThread.joinable() ) {
+        mThread.join();
+    }
+}
+
+void OfflineClockProvider::run() {
+
+    while( mRunning.load(std::memory_order_acquire) ) {
+
+        uint64_t frames = mFrames.load(std::memory_order_relaxed);
+        uint64_t limit = mFrameLimit.load(std::memory_order_relaxed);
+
+        if( (limit != 0) && (frames >= limit) ) {
+            break;
+        }
+
+        // Derive the delta from the frame positions, rather than adding a
+        // fixed period, so that rounding never accumulates.
+        Duration delta = Duration::fromFrames(static_cast<int64_t>(frames + mFramesPerTick), mSampleRate) -
+                         Duration::fromFrames(static_cast<int64_t>(frames), mSampleRate);
+
+        // Time only advances when there is someone to consume it, so a
+        // paused pipeline does not skip ahead.
+        if( publishAndWait(delta) == 0 ) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            continue;
+        }
+
+        mFrames.store(frames + mFramesPerTick, std::memory_order_release);
+    }
+
+    mRunning = false;
+
+    INFO_THIS("OfflineClockProvider::run") << "Stopped after " << frames()
+    << " frames." << std::endl;
+}
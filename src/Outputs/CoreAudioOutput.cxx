@@ -112,6 +112,12 @@ namespace Ayane {
         
         /// The current buffer being used
         ManagedBuffer mCurrentBuffer;
+        
+        /// Handle of the input sink
+        Stage::PortHandle mInputSink;
+        
+        /// Was the output running when playback was paused?
+        bool mResumeOutput;
     };
     
 }
@@ -163,7 +169,9 @@ mAUChannelLayout(nullptr),
 mMaxFramesPerSlice(0),
 mLastClockTickHostTime(0),
 mClockProvider(ClockCapabilities(0, 1000000000), 100000000),
-mBuffers(2)
+mBuffers(2),
+mInputSink(Stage::kInvalidPortHandle),
+mResumeOutput(false)
 {
     /*
      * The AU graph will always use the canonical Core Audio format since the
@@ -1365,8 +1373,10 @@ AudioBufferList * CoreAudioOutputPrivate::allocateABL(UInt32 channelsPerFrame,
 
 
 CoreAudioOutput::CoreAudioOutput() : Stage(), d_ptr(new CoreAudioOutputPrivate) {
+    A_D(CoreAudioOutput);
+    
     // Add output sink to stage.
-    addSink("input");
+    d->mInputSink = addSink("input");
 }
 
 CoreAudioOutput::~CoreAudioOutput() {
@@ -1501,7 +1511,8 @@ bool CoreAudioOutput::setSharingMode(SharingMode mode)
 
 Stage::Sink *CoreAudioOutput::input()
 {
-    return mSinks["input"].get();
+    A_D(CoreAudioOutput);
+    return sink(d->mInputSink);
 }
 
 bool CoreAudioOutput::beginPlayback() {
@@ -1525,12 +1536,31 @@ bool CoreAudioOutput::beginPlayback() {
     // Don't actually start the device till a buffer is received.
     
 
-    double clockPeriodInSeconds = ((double)d->mClockProvider.clockPeriod() / 1000000000.0);
-    d->mClockProvider.publish(clockPeriodInSeconds);
+    d->mClockProvider.publish(Duration::fromNanoseconds(d->mClockProvider.clockPeriod()));
 
     return true;
 }
 
+void CoreAudioOutput::pausedPlayback() {
+    A_D(CoreAudioOutput);
+    
+    // Halt the device, but keep it open and configured.
+    d->mResumeOutput = d->isOutputRunning();
+    
+    if( d->mResumeOutput ) {
+        d->stopOutput();
+    }
+}
+
+void CoreAudioOutput::resumedPlayback() {
+    A_D(CoreAudioOutput);
+    
+    if( d->mResumeOutput ) {
+        d->startOutput();
+        d->mResumeOutput = false;
+    }
+}
+
 bool CoreAudioOutput::stoppedPlayback() {
     A_D(CoreAudioOutput);
     
@@ -1744,6 +1774,11 @@ ClockProvider &CoreAudioOutput::clockProvider() {
     return d->mClockProvider;
 }
 
+ClockProvider *CoreAudioOutput::providedClockProvider() {
+    A_D(CoreAudioOutput);
+    return &d->mClockProvider;
+}
+
 
 OSStatus CoreAudioOutputPrivate::renderNotify(AudioUnitRenderActionFlags *ioActionFlags,
                                          const AudioTimeStamp *inTimeStamp,
@@ -1766,22 +1801,22 @@ OSStatus CoreAudioOutputPrivate::renderNotify(AudioUnitRenderActionFlags *ioActi
 
         // Our configured nominal clock period is mClockPeriod. Calculate the
         // delta between the mLastClockTickHostTime and mHostTime. If the delta
-        // is larger than mClockPeriod, publish the delta to the clock provider
-        // and update mLastClockTickHostTime.
+        // is larger than mClockPeriod, publish the host time to the clock
+        // provider, which smooths out the callback jitter, and update
+        // mLastClockTickHostTime.
         
         UInt64 delta = inTimeStamp->mHostTime - mLastClockTickHostTime;
         
         if (delta > mClockProvider.clockPeriod()) {
             
             mLastClockTickHostTime = inTimeStamp->mHostTime;
-            double deltaInSeconds = ((double)delta / 1000000000.0);
 
-            mClockProvider.publish(deltaInSeconds);
+            mClockProvider.publishTimestamp((double)inTimeStamp->mHostTime / 1000000000.0);
             
             /*
             if(mCurrentBuffer) {
                 A_Q(CoreAudio);
-                q->messageBus().publish(new ProgressMessage(mCurrentBuffer->timestamp()));
+                q->messageBus()->publish<ProgressMessage>(mCurrentBuffer->timestamp());
             }
              */
         }
@@ -6,9 +6,16 @@
  *
  */
 
+#include <algorithm>
+#include <map>
+#include <sstream>
+#include <string>
+
 #include "Ayane/Pipeline.h"
+#include "Ayane/LevelScheduler.h"
 #include "Ayane/MessageBus.h"
 #include "Ayane/Stage.h"
+#include "Ayane/TimerClockProvider.h"
 #include "Ayane/Trace.h"
 
 using namespace Ayane;
@@ -17,19 +24,80 @@ namespace Ayane {
         
     class PipelinePrivate {
     public:
-        PipelinePrivate() : mState(Stage::kDeactivated)
+        PipelinePrivate() :
+            mState(Stage::kDeactivated),
+            mExecutionMode(Pipeline::kStageThreads),
+            mWorkerCount(0),
+            mFormatNegotiation(false),
+            mClockProvider(nullptr),
+            mLatency(0.0)
         {
         }
         
         /**
-         *  Searches the Stages inserted into the pipeline for clock 
-         *  providers, and chooses the slowest one.
+         *  Chooses the pipeline's clock provider: the one set with
+         *  Pipeline::setClockProvider() if any, otherwise the first one
+         *  provided by a Stage in insertion order, otherwise a
+         *  TimerClockProvider paced by the system clock.
+         */
+        ClockProvider *selectPipelineClockProvider();
+        
+        /** Returns true if the pipeline is playing or paused. */
+        bool isStarted() const {
+            return (mState == Stage::kPlaying) || (mState == Stage::kPaused);
+        }
+        
+        /** Stop function without locking. */
+        void stopNoLock();
+        
+        /**
+         *  Gets the order in which the Stages should be played. If format
+         *  negotiation is enabled, upstream Stages come first.
+         */
+        std::vector<Stage*> playOrder() const;
+        
+        /**
+         *  Gets the Stages with upstream Stages first. Returns false, and
+         *  the Stages in insertion order, if they are not acyclic.
+         */
+        bool topologicalOrder(std::vector<Stage*> *order) const;
+        
+        /**
+         *  Sums the latency along every path through the Stages, delays the
+         *  sinks on shorter paths so that all sinks of a Stage are aligned,
+         *  and records the total latency.
          */
-        ClockProvider *selectPipelineClockProvider() const;
+        void compensateLatency(const std::vector<Stage*> &order);
         
         // Pipeline state (same as Stage states)
         Stage::State mState;
         std::mutex mStateMutex;
+        
+        // Execution mode.
+        Pipeline::ExecutionMode mExecutionMode;
+        unsigned int mWorkerCount;
+        
+        // Level scheduler (only exists while playing in kLevelParallel).
+        std::unique_ptr<LevelScheduler> mScheduler;
+        
+        // Processing thread attributes.
+        ThreadAttributes mThreadAttributes;
+        
+        // Format negotiation.
+        bool mFormatNegotiation;
+        
+        // Clock provider override.
+        ClockProvider *mClockProvider;
+        
+        // Clock provider used when no Stage provides one. Only running
+        // while the pipeline is playing.
+        std::unique_ptr<TimerClockProvider> mTimerClockProvider;
+        
+        // Total latency of the graph.
+        double mLatency;
+        
+        // Sample format plan.
+        SampleFormatPlanner mSampleFormatPlanner;
 
         // Message bus
         MessageBus mMessageBus;
@@ -40,11 +108,173 @@ namespace Ayane {
 
 }
 
-ClockProvider *PipelinePrivate::selectPipelineClockProvider() const {
+ClockProvider *PipelinePrivate::selectPipelineClockProvider() {
+    
+    if( mClockProvider ) {
+        return mClockProvider;
+    }
     
     // Use the first clock provider we find.
+    for (Pipeline::const_iterator iter = mStages.begin(), end = mStages.end();
+         iter != end; ++iter)
+    {
+        ClockProvider *clockProvider = (*iter)->providedClockProvider();
+        
+        if( clockProvider != nullptr ) {
+            return clockProvider;
+        }
+    }
     
-    return nullptr;
+    // Nothing paces the pipeline, so pace it from the system clock.
+    INFO_THIS("Pipeline::play") << "No stage provides a clock, using a timer."
+    << std::endl;
+    
+    if( !mTimerClockProvider ) {
+        mTimerClockProvider.reset(new TimerClockProvider());
+    }
+    
+    mTimerClockProvider->setThreadAttributes(mThreadAttributes);
+    
+    return mTimerClockProvider.get();
+}
+
+std::vector<Stage*> PipelinePrivate::playOrder() const {
+    
+    std::vector<Stage*> order;
+    
+    if( mFormatNegotiation ) {
+        if( !topologicalOrder(&order) ) {
+            WARNING_THIS("Pipeline::play") << "Could not order the pipeline for "
+            "format negotiation." << std::endl;
+        }
+        
+        return order;
+    }
+    
+    for (Pipeline::const_iterator iter = mStages.begin(), end = mStages.end();
+         iter != end; ++iter)
+    {
+        order.push_back(iter->get());
+    }
+    
+    return order;
+}
+
+bool PipelinePrivate::topologicalOrder(std::vector<Stage*> *order) const {
+    
+    std::vector<Stage*> stages;
+    
+    for (Pipeline::const_iterator iter = mStages.begin(), end = mStages.end();
+         iter != end; ++iter)
+    {
+        stages.push_back(iter->get());
+    }
+    
+    // Reuse the scheduler's levels if there is one, otherwise split the
+    // Stages into levels just for ordering.
+    LevelScheduler levels;
+    const LevelScheduler *scheduler = mScheduler.get();
+    
+    if( scheduler == nullptr ) {
+        
+        if( !levels.build(stages) ) {
+            *order = stages;
+            return false;
+        }
+        
+        scheduler = &levels;
+    }
+    
+    order->clear();
+    order->reserve(stages.size());
+    
+    for(unsigned int i = 0; i < scheduler->levelCount(); ++i) {
+        const std::vector<Stage*> &level = scheduler->level(i);
+        order->insert(order->end(), level.begin(), level.end());
+    }
+    
+    return true;
+}
+
+void PipelinePrivate::compensateLatency(const std::vector<Stage*> &order) {
+    
+    // Latency of the audio arriving at each Stage's sinks once aligned.
+    std::map<const Stage*, double> arrival;
+    
+    mLatency = 0.0;
+    
+    for (std::vector<Stage*>::const_iterator stage = order.begin(),
+         end = order.end(); stage != end; ++stage)
+    {
+        Stage::ConstSinkIteratorPair range = (*stage)->sinkIterator();
+        std::vector<double> paths;
+        double latest = 0.0;
+        
+        // Latency of the path into each sink. Sinks linked to Stages outside
+        // the pipeline are treated as having no latency.
+        for(Stage::ConstSinkIterator sink = range.first; sink != range.second;
+            ++sink)
+        {
+            Stage::Source *source = (*sink)->linkedSource();
+            double path = 0.0;
+            
+            if( source != nullptr ) {
+                
+                std::map<const Stage*, double>::const_iterator upstream =
+                    arrival.find(source->stage());
+                
+                if( upstream != arrival.end() ) {
+                    path = upstream->second + source->stage()->latency();
+                }
+            }
+            
+            paths.push_back(path);
+            latest = std::max(latest, path);
+        }
+        
+        // Delay every sink on a shorter path to the longest one.
+        for(size_t i = 0; i < paths.size(); ++i) {
+            (*stage)->setCompensationDelay((range.first + i)->get(),
+                                           latest - paths[i]);
+        }
+        
+        arrival.insert(std::make_pair(*stage, latest));
+        
+        // Pure sinks are the outputs of the graph.
+        if( (*stage)->sourceCount() == 0 ) {
+            mLatency = std::max(mLatency, latest + (*stage)->latency());
+        }
+    }
+}
+
+void PipelinePrivate::stopNoLock() {
+    
+    if( isStarted() ) {
+        
+        if( mTimerClockProvider ) {
+            mTimerClockProvider->stop();
+        }
+        
+        // Stop scheduling first so no process runs are in flight while the
+        // stages stop.
+        if( mScheduler ) {
+            mScheduler->stop();
+        }
+        
+        for (Pipeline::iterator iter = mStages.begin(), end = mStages.end();
+             iter != end; ++iter)
+        {
+            (*iter)->stop();
+        }
+        
+        if( mScheduler ) {
+            mScheduler->detach();
+            mScheduler.reset();
+        }
+        
+        // Record new state.
+        mState = Stage::kActivated;
+    }
 }
 
 
@@ -64,6 +294,117 @@ MessageBus &Pipeline::messageBus() {
     return d->mMessageBus;
 }
 
+Pipeline::ExecutionMode Pipeline::executionMode() const {
+    A_D(const Pipeline);
+    return d->mExecutionMode;
+}
+
+bool Pipeline::setExecutionMode(ExecutionMode mode, unsigned int workers) {
+    A_D(Pipeline);
+    
+    std::lock_guard<std::mutex> lock(d->mStateMutex);
+    
+    if( d->isStarted() ) {
+        WARNING_THIS("Pipeline::setExecutionMode") << "Can't change the "
+        "execution mode while playing." << std::endl;
+        return false;
+    }
+    
+    d->mExecutionMode = mode;
+    d->mWorkerCount = workers;
+    return true;
+}
+
+const LevelScheduler *Pipeline::levelScheduler() const {
+    A_D(const Pipeline);
+    return d->mScheduler.get();
+}
+
+ThreadAttributes Pipeline::threadAttributes() const {
+    A_D(const Pipeline);
+    return d->mThreadAttributes;
+}
+
+double Pipeline::latency() const {
+    A_D(const Pipeline);
+    return d->mLatency;
+}
+
+ClockProvider *Pipeline::clockProvider() const {
+    A_D(const Pipeline);
+    return d->mClockProvider;
+}
+
+bool Pipeline::setClockProvider(ClockProvider *clockProvider) {
+    A_D(Pipeline);
+    
+    std::lock_guard<std::mutex> lock(d->mStateMutex);
+    
+    if( d->isStarted() ) {
+        WARNING_THIS("Pipeline::setClockProvider") << "Can't change the clock "
+        "provider while playing." << std::endl;
+        return false;
+    }
+    
+    d->mClockProvider = clockProvider;
+    return true;
+}
+
+bool Pipeline::formatNegotiation() const {
+    A_D(const Pipeline);
+    return d->mFormatNegotiation;
+}
+
+bool Pipeline::setFormatNegotiation(bool enabled) {
+    A_D(Pipeline);
+    
+    std::lock_guard<std::mutex> lock(d->mStateMutex);
+    
+    if( d->isStarted() ) {
+        WARNING_THIS("Pipeline::setFormatNegotiation") << "Can't change format "
+        "negotiation while playing." << std::endl;
+        return false;
+    }
+    
+    d->mFormatNegotiation = enabled;
+    return true;
+}
+
+bool Pipeline::setSampleFormatCosts(const SampleFormatCosts &costs) {
+    A_D(Pipeline);
+    
+    std::lock_guard<std::mutex> lock(d->mStateMutex);
+    
+    if( d->isStarted() ) {
+        WARNING_THIS("Pipeline::setSampleFormatCosts") << "Can't change sample "
+        "format costs while playing." << std::endl;
+        return false;
+    }
+    
+    d->mSampleFormatPlanner = SampleFormatPlanner(costs);
+    return true;
+}
+
+const SampleFormatPlanner &Pipeline::sampleFormatPlan() const {
+    A_D(const Pipeline);
+    return d->mSampleFormatPlanner;
+}
+
+bool Pipeline::setThreadAttributes(const ThreadAttributes &attributes) {
+    A_D(Pipeline);
+    
+    std::lock_guard<std::mutex> lock(d->mStateMutex);
+    
+    if( d->isStarted() ) {
+        WARNING_THIS("Pipeline::setThreadAttributes") << "Can't change the "
+        "thread attributes while playing." << std::endl;
+        return false;
+    }
+    
+    d->mThreadAttributes = attributes;
+    return true;
+}
+
 Pipeline::iterator Pipeline::begin(){
     A_D(Pipeline);
     return d->mStages.begin();
@@ -156,10 +497,8 @@ bool Pipeline::deactivate() {
         return false;
     }
     
-    // If playing stop first.
-    if( d->mState == Stage::kPlaying ) {
-        stop();
-    }
+    // If playing stop first. Use no-lock variant since we have the state lock.
+    d->stopNoLock();
     
     if( d->mState == Stage::kActivated ) {
         
@@ -198,12 +537,110 @@ bool Pipeline::play() {
         
         // TODO: Configure the clock provider.
         
+        // Stages running their own threads fall back to the pipeline's
+        // attributes when they have none of their own.
         for (iterator iter = d->mStages.begin(), end = d->mStages.end();
              iter != end; ++iter)
         {
-            (*iter)->play(*clockProvider);
+            (*iter)->setInheritedThreadAttributes(d->mThreadAttributes);
+        }
+        
+        if( d->mExecutionMode == kLevelParallel ) {
+            
+            std::vector<Stage*> stages;
+            
+            // Stages in another clock domain keep their own threads.
+            for (iterator iter = d->mStages.begin(), end = d->mStages.end();
+                 iter != end; ++iter)
+            {
+                if( (*iter)->requiredClockProvider() == nullptr ) {
+                    stages.push_back(iter->get());
+                }
+            }
+            
+            d->mScheduler.reset(new LevelScheduler(d->mWorkerCount));
+            d->mScheduler->setThreadAttributes(d->mThreadAttributes);
+            
+            if( !d->mScheduler->build(stages) ) {
+                ERROR_THIS("Pipeline::play") << "Could not split the pipeline "
+                "into levels." << std::endl;
+                d->mScheduler.reset();
+                return false;
+            }
+            
+            // Stages must be attached before they play so that they use
+            // the scheduler's clock.
+            d->mScheduler->attach();
         }
         
+        std::vector<Stage*> order = d->playOrder();
+        
+        // Plan the sample formats before the Stages begin playback so that
+        // they may allocate their buffers in the planned formats.
+        d->mSampleFormatPlanner.plan(order);
+        d->mSampleFormatPlanner.apply();
+        
+        // Log the plan a line at a time, as each message is of limited size.
+        std::stringstream plan;
+        d->mSampleFormatPlanner.report(plan);
+        
+        std::string line;
+        
+        while( std::getline(plan, line) ) {
+            INFO_THIS("Pipeline::play") << line << std::endl;
+        }
+        
+        // Align parallel branches before any buffers flow.
+        std::vector<Stage*> topological;
+        
+        if( d->topologicalOrder(&topological) ) {
+            d->compensateLatency(topological);
+            
+            INFO_THIS("Pipeline::play") << "Pipeline latency is "
+            << d->mLatency << "s." << std::endl;
+        }
+        else {
+            WARNING_THIS("Pipeline::play") << "Could not order the pipeline for "
+            "latency compensation." << std::endl;
+        }
+        
+        bool played = true;
+        
+        for (std::vector<Stage*>::iterator iter = order.begin(), end = order.end();
+             iter != end; ++iter)
+        {
+            ClockProvider *required = (*iter)->requiredClockProvider();
+            
+            if( !(*iter)->play(required ? *required : *clockProvider) ) {
+                played = false;
+                break;
+            }
+        }
+        
+        if( played && d->mScheduler ) {
+            played = d->mScheduler->start(*clockProvider);
+        }
+        
+        if( !played ) {
+            
+            ERROR_THIS("Pipeline::play") << "Could not start playback."
+            << std::endl;
+            
+            // Stop whatever was started, and detach the scheduler.
+            d->mState = Stage::kPlaying;
+            d->stopNoLock();
+            
+            return false;
+        }
+        
+        // The timer is started last, once every clock is registered.
+        if( clockProvider == d->mTimerClockProvider.get() ) {
+            d->mTimerClockProvider->start();
+        }
+        
+        // Record new state.
+        d->mState = Stage::kPlaying;
+        
         // Success
         return true;
     }
@@ -218,21 +655,84 @@ bool Pipeline::play() {
     
 }
 
+bool Pipeline::pause() {
+    A_D(Pipeline);
+    
+    std::lock_guard<std::mutex> lock(d->mStateMutex);
+    
+    if( d->mState != Stage::kPlaying ) {
+        WARNING_THIS("Pipeline::pause") << "The pipeline is not playing."
+        << std::endl;
+        return false;
+    }
+    
+    if( d->mScheduler ) {
+        d->mScheduler->pause();
+    }
+    
+    // A Stage may be waiting on a buffer from upstream, so pause downstream
+    // Stages first.
+    std::vector<Stage*> order;
+    d->topologicalOrder(&order);
+    
+    for (std::vector<Stage*>::reverse_iterator iter = order.rbegin(),
+         end = order.rend(); iter != end; ++iter)
+    {
+        (*iter)->pause();
+    }
+    
+    d->mState = Stage::kPaused;
+    return true;
+}
+
+bool Pipeline::resume() {
+    A_D(Pipeline);
+    
+    std::lock_guard<std::mutex> lock(d->mStateMutex);
+    
+    if( d->mState != Stage::kPaused ) {
+        WARNING_THIS("Pipeline::resume") << "The pipeline is not paused."
+        << std::endl;
+        return false;
+    }
+    
+    std::vector<Stage*> order;
+    d->topologicalOrder(&order);
+    
+    for (std::vector<Stage*>::iterator iter = order.begin(), end = order.end();
+         iter != end; ++iter)
+    {
+        (*iter)->resume();
+    }
+    
+    if( d->mScheduler ) {
+        d->mScheduler->resume();
+    }
+    
+    d->mState = Stage::kPlaying;
+    return true;
+}
+
+void Pipeline::flush() {
+    A_D(Pipeline);
+    
+    std::lock_guard<std::mutex> lock(d->mStateMutex);
+    
+    for (Pipeline::iterator iter = d->mStages.begin(), end = d->mStages.end();
+         iter != end; ++iter)
+    {
+        (*iter)->flush();
+    }
+}
+
 bool Pipeline::stop() {
     A_D(Pipeline);
     
     std::lock_guard<std::mutex> lock(d->mStateMutex);
 
-    if( d->mState == Stage::kPlaying ) {
+    if( d->isStarted() ) {
         
-        for (iterator iter = d->mStages.begin(), end = d->mStages.end();
-             iter != end; ++iter)
-        {
-            (*iter)->stop();
-        }
-        
-        // Record new state.
-        d->mState = Stage::kActivated;
+        d->stopNoLock();
         
         // Success
         return true;
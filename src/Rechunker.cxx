@@ -0,0 +1,141 @@
+/*
+ *
+ * Copyright (c) 2013 Philip Deljanov. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ */
+
+#include "Ayane/Rechunker.h"
+#include "Ayane/Buffer.h"
+#include "Ayane/Trace.h"
+
+using namespace Ayane;
+
+Rechunker::Rechunker(uint32_t frames) :
+    mFrames(frames),
+    mInput(),
+    mInputOffset(0),
+    mBlock(),
+    mPool(),
+    mSampleFormat(kFloat32),
+    mFormat()
+{
+
+}
+
+void Rechunker::setFrames(uint32_t frames) {
+
+    clear();
+
+    mFrames = frames;
+
+    // Blocks of the old size are released as they are returned.
+    mPool.reset();
+}
+
+void Rechunker::push(ManagedBuffer &buffer) {
+
+    if( mInput ) {
+        WARNING_THIS("Rechunker::push") << "Input buffer replaced before it "
+        "was consumed." << std::endl;
+    }
+
+    mInput = std::move(buffer);
+    mInputOffset = 0;
+}
+
+void Rechunker::clear() {
+    mInput.reset();
+    mInputOffset = 0;
+    mBlock.reset();
+}
+
+bool Rechunker::configure(const Buffer &buffer) {
+
+    if( mPool && (buffer.sampleFormat() == mSampleFormat) &&
+        (buffer.format() == mFormat) )
+    {
+        return true;
+    }
+
+    if( !buffer.format().isValid() ) {
+        return false;
+    }
+
+    mSampleFormat = buffer.sampleFormat();
+    mFormat = buffer.format();
+    mPool = BufferPoolFactory::create(mSampleFormat, mFormat,
+                                      BufferLength(mFrames), 2);
+    return true;
+}
+
+bool Rechunker::pop(ManagedBuffer *outBuffer) {
+
+    while( mInput ) {
+
+        uint32_t available = mInput->available();
+
+        // Pass the input through untouched if it is exactly one block, or
+        // an empty buffer ending the stream.
+        if( !mBlock && ((available == mFrames) ||
+                        ((available == 0) && (mInput->flags() & Buffer::kEndOfStream))) )
+        {
+            if( mInputOffset > 0 ) {
+                mInput->setTimestamp(mInput->timestamp() +
+                    Duration::fromFrames(mInputOffset, mInput->format().sampleRate()));
+            }
+
+            *outBuffer = std::move(mInput);
+            mInputOffset = 0;
+            return true;
+        }
+
+        // A block never spans a format change, so end the current one early.
+        if( mBlock && ((mBlock->sampleFormat() != mInput->sampleFormat()) ||
+                       (mBlock->format() != mInput->format())) )
+        {
+            *outBuffer = std::move(mBlock);
+            return true;
+        }
+
+        if( !mBlock && (available > 0) ) {
+
+            if( !configure(*mInput) ) {
+                mInput.reset();
+                return false;
+            }
+
+            mBlock = mPool->acquire();
+
+            // The block starts at the first unconsumed input frame.
+            mBlock->setTimestamp(mInput->timestamp() +
+                Duration::fromFrames(mInputOffset, mInput->format().sampleRate()));
+        }
+
+        if( mBlock ) {
+            uint32_t space = mBlock->space();
+            (*mInput) >> (*mBlock);
+            mInputOffset += space - mBlock->space();
+        }
+
+        bool endOfStream = false;
+
+        if( mInput->available() == 0 ) {
+            endOfStream = (mInput->flags() & Buffer::kEndOfStream) != 0;
+            mInput.reset();
+        }
+
+        if( mBlock && (endOfStream || (mBlock->space() == 0)) ) {
+
+            if( endOfStream ) {
+                mBlock->setFlag(Buffer::kEndOfStream);
+            }
+
+            *outBuffer = std::move(mBlock);
+            return true;
+        }
+    }
+
+    return false;
+}
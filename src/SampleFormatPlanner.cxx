@@ -0,0 +1,459 @@
+/*
+ *
+ * Copyright (c) 2013 Philip Deljanov. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ */
+
+#include <chrono>
+#include <limits>
+
+#include "Ayane/SampleFormatPlanner.h"
+#include "Ayane/Trace.h"
+
+using namespace Ayane;
+
+namespace {
+
+    // Above this many processing format combinations, the planner improves
+    // the plan one Stage at a time instead of searching exhaustively.
+    const uint64_t kExhaustiveSearchLimit = 65536;
+
+    // Maximum number of improvement sweeps over all the Stages.
+    const unsigned int kMaxSweeps = 16;
+
+    // Cost added for each Stage not processing in its preferred format. Only
+    // used to break ties, so it is far smaller than any conversion.
+    const double kPreferenceCost = 1e-9;
+
+    template<typename InSampleType, typename OutSampleType>
+    double measurePair(unsigned int samples) {
+
+        std::vector<InSampleType> in(samples, InSampleType());
+        std::vector<OutSampleType> out(samples);
+
+        double best = std::numeric_limits<double>::max();
+
+        // Take the fastest of several runs to reject preemption.
+        for(int run = 0; run < 8; ++run) {
+
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+            SampleFormats::convertMany<InSampleType, OutSampleType>(&in[0], &out[0], samples);
+
+            std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+
+            // Keep the conversion from being optimized away.
+            volatile OutSampleType sink = out[samples / 2];
+            (void)sink;
+
+            double ns = std::chrono::duration<double, std::nano>(end - start).count();
+
+            if( ns < best ) {
+                best = ns;
+            }
+        }
+
+        return best / samples;
+    }
+
+    template<typename InSampleType>
+    double measureFrom(SampleFormat to, unsigned int samples) {
+
+        switch(to) {
+            case kUInt8:
+                return measurePair<InSampleType, SampleUInt8>(samples);
+            case kInt16:
+                return measurePair<InSampleType, SampleInt16>(samples);
+            case kInt24:
+                return measurePair<InSampleType, SampleInt24>(samples);
+            case kInt32:
+                return measurePair<InSampleType, SampleInt32>(samples);
+            case kFloat32:
+                return measurePair<InSampleType, SampleFloat32>(samples);
+            case kFloat64:
+                return measurePair<InSampleType, SampleFloat64>(samples);
+        }
+
+        return 0.0;
+    }
+
+    double measureConversion(SampleFormat from, SampleFormat to,
+                             unsigned int samples)
+    {
+        switch(from) {
+            case kUInt8:
+                return measureFrom<SampleUInt8>(to, samples);
+            case kInt16:
+                return measureFrom<SampleInt16>(to, samples);
+            case kInt24:
+                return measureFrom<SampleInt24>(to, samples);
+            case kInt32:
+                return measureFrom<SampleInt32>(to, samples);
+            case kFloat32:
+                return measureFrom<SampleFloat32>(to, samples);
+            case kFloat64:
+                return measureFrom<SampleFloat64>(to, samples);
+        }
+
+        return 0.0;
+    }
+
+    bool isFloat(SampleFormat format) {
+        return (format == kFloat32) || (format == kFloat64);
+    }
+
+}
+
+
+
+/* SampleFormatCosts */
+
+const unsigned int SampleFormatCosts::kFormatCount;
+
+SampleFormatCosts::SampleFormatCosts() {
+
+    for(unsigned int from = 0; from < kFormatCount; ++from) {
+        for(unsigned int to = 0; to < kFormatCount; ++to) {
+
+            SampleFormat f = static_cast<SampleFormat>(from);
+            SampleFormat t = static_cast<SampleFormat>(to);
+
+            if( from == to ) {
+                mCosts[from][to] = 0.0;
+            }
+            else if( !isFloat(f) && !isFloat(t) ) {
+                // Shift.
+                mCosts[from][to] = 1.0;
+            }
+            else if( isFloat(f) && isFloat(t) ) {
+                // Precision change.
+                mCosts[from][to] = 1.0;
+            }
+            else if( isFloat(t) ) {
+                // Integer to float, scale.
+                mCosts[from][to] = 1.5;
+            }
+            else {
+                // Float to integer, scale, round, and clip.
+                mCosts[from][to] = 3.0;
+            }
+        }
+    }
+}
+
+SampleFormatCosts SampleFormatCosts::measure(unsigned int samples) {
+
+    SampleFormatCosts costs;
+
+    if( samples == 0 ) {
+        return costs;
+    }
+
+    for(unsigned int from = 0; from < kFormatCount; ++from) {
+        for(unsigned int to = 0; to < kFormatCount; ++to) {
+
+            // Identity conversions are never performed.
+            if( from != to ) {
+                costs.mCosts[from][to] = measureConversion(static_cast<SampleFormat>(from),
+                                                           static_cast<SampleFormat>(to),
+                                                           samples);
+            }
+        }
+    }
+
+    return costs;
+}
+
+
+
+/* SampleFormatPlanner */
+
+SampleFormatPlanner::SampleFormatPlanner(const SampleFormatCosts &costs) :
+    mCosts(costs),
+    mTotalCost(0.0)
+{
+
+}
+
+SampleFormat SampleFormatPlanner::linkFormat(SampleFormat from, SampleFormat to,
+                                             double *outCost) const
+{
+    // Prefer carrying the upstream format so that any conversion happens
+    // once, at the consumer.
+    SampleFormat best = from;
+    double bestCost = mCosts.cost(from, to);
+
+    for(unsigned int i = 0; i < SampleFormatCosts::kFormatCount; ++i) {
+
+        SampleFormat format = static_cast<SampleFormat>(i);
+        double cost = mCosts.cost(from, format) + mCosts.cost(format, to);
+
+        if( cost < bestCost ) {
+            best = format;
+            bestCost = cost;
+        }
+    }
+
+    *outCost = bestCost;
+    return best;
+}
+
+double SampleFormatPlanner::assignmentCost(const std::vector<unsigned int> &assignment) const {
+
+    double total = 0.0;
+
+    for(size_t i = 0; i < assignment.size(); ++i) {
+        if( assignment[i] != 0 ) {
+            total += kPreferenceCost;
+        }
+    }
+
+    for(size_t i = 0; i < mEdges.size(); ++i) {
+
+        double cost;
+        linkFormat(mCandidates[mEdges[i].first][assignment[mEdges[i].first]],
+                   mCandidates[mEdges[i].second][assignment[mEdges[i].second]],
+                   &cost);
+
+        total += cost;
+    }
+
+    return total;
+}
+
+void SampleFormatPlanner::plan(const std::vector<Stage*> &stages) {
+
+    mStages = stages;
+    mCandidates.clear();
+    mEdges.clear();
+    mFormats.clear();
+    mLinks.clear();
+    mTotalCost = 0.0;
+
+    std::map<Stage*, unsigned int> index;
+
+    // Candidate processing formats, with the preferred format first so
+    // that index 0 is always the preferred choice. Only supported formats
+    // are candidates.
+    for(unsigned int i = 0; i < mStages.size(); ++i) {
+
+        Stage *stage = mStages[i];
+        SampleFormatSet supported = stage->supportedSampleFormats();
+        SampleFormat preferred = stage->preferredSampleFormat();
+
+        if( !(supported & sampleFormatSet(preferred)) ) {
+
+            if( (supported & kAllSampleFormats) == 0 ) {
+
+                // Nothing else to offer, so keep the preferred format.
+                WARNING_THIS("SampleFormatPlanner::plan") << "Stage " << stage
+                << " supports no sample formats." << std::endl;
+
+                supported = sampleFormatSet(preferred);
+            }
+            else {
+
+                // Prefer the first supported format instead.
+                for(unsigned int f = 0; f < SampleFormatCosts::kFormatCount; ++f) {
+                    if( supported & sampleFormatSet(static_cast<SampleFormat>(f)) ) {
+                        preferred = static_cast<SampleFormat>(f);
+                        break;
+                    }
+                }
+            }
+        }
+
+        std::vector<SampleFormat> candidates(1, preferred);
+
+        for(unsigned int f = 0; f < SampleFormatCosts::kFormatCount; ++f) {
+
+            SampleFormat format = static_cast<SampleFormat>(f);
+
+            if( (format != preferred) && (supported & sampleFormatSet(format)) ) {
+                candidates.push_back(format);
+            }
+        }
+
+        mCandidates.push_back(candidates);
+        index.insert(std::make_pair(stage, i));
+    }
+
+    // Links between Stages in the collection.
+    std::vector<Stage::Source*> sources;
+
+    for(unsigned int i = 0; i < mStages.size(); ++i) {
+
+        Stage::ConstSourceIteratorPair range = mStages[i]->sourceIterator();
+
+        for(Stage::ConstSourceIterator source = range.first;
+            source != range.second; ++source)
+        {
+            Stage::Sink *sink = (*source)->linkedSink();
+
+            if( sink == nullptr ) {
+                continue;
+            }
+
+            std::map<Stage*, unsigned int>::iterator downstream = index.find(sink->stage());
+
+            if( downstream != index.end() ) {
+                mEdges.push_back(std::make_pair(i, downstream->second));
+                sources.push_back(source->get());
+            }
+        }
+    }
+
+    // Count the combinations to decide how to search.
+    uint64_t combinations = 1;
+
+    for(size_t i = 0; i < mCandidates.size(); ++i) {
+
+        combinations *= mCandidates[i].size();
+
+        if( combinations > kExhaustiveSearchLimit ) {
+            break;
+        }
+    }
+
+    std::vector<unsigned int> assignment(mStages.size(), 0);
+    std::vector<unsigned int> best(assignment);
+    double bestCost = assignmentCost(assignment);
+
+    if( combinations <= kExhaustiveSearchLimit ) {
+
+        // Count through every combination like an odometer.
+        for(;;) {
+
+            size_t digit = 0;
+
+            while( digit < assignment.size() ) {
+                if( ++assignment[digit] < mCandidates[digit].size() ) {
+                    break;
+                }
+
+                assignment[digit++] = 0;
+            }
+
+            if( digit == assignment.size() ) {
+                break;
+            }
+
+            double cost = assignmentCost(assignment);
+
+            if( cost < bestCost ) {
+                best = assignment;
+                bestCost = cost;
+            }
+        }
+    }
+    else {
+
+        TRACE_THIS("SampleFormatPlanner::plan") << "Too many combinations for "
+        "an exhaustive search, improving one stage at a time." << std::endl;
+
+        bool improved = true;
+
+        for(unsigned int sweep = 0; improved && (sweep < kMaxSweeps); ++sweep) {
+
+            improved = false;
+
+            for(size_t i = 0; i < best.size(); ++i) {
+
+                assignment = best;
+
+                for(unsigned int c = 0; c < mCandidates[i].size(); ++c) {
+
+                    assignment[i] = c;
+                    double cost = assignmentCost(assignment);
+
+                    if( cost < bestCost ) {
+                        best[i] = c;
+                        bestCost = cost;
+                        improved = true;
+                    }
+                }
+            }
+        }
+    }
+
+    // Record the plan.
+    for(size_t i = 0; i < mStages.size(); ++i) {
+        mFormats.insert(std::make_pair(mStages[i], mCandidates[i][best[i]]));
+    }
+
+    for(size_t i = 0; i < mEdges.size(); ++i) {
+
+        Link link;
+        link.source = sources[i];
+        link.from = mCandidates[mEdges[i].first][best[mEdges[i].first]];
+        link.to = mCandidates[mEdges[i].second][best[mEdges[i].second]];
+        link.format = linkFormat(link.from, link.to, &link.cost);
+
+        mTotalCost += link.cost;
+        mLinks.push_back(link);
+    }
+}
+
+void SampleFormatPlanner::apply() const {
+
+    for(std::map<const Stage*, SampleFormat>::const_iterator iter = mFormats.begin(),
+        end = mFormats.end(); iter != end; ++iter)
+    {
+        const_cast<Stage*>(iter->first)->setPlannedSampleFormat(iter->second);
+    }
+
+    for(std::vector<Link>::const_iterator iter = mLinks.begin(),
+        end = mLinks.end(); iter != end; ++iter)
+    {
+        iter->source->mPlannedSampleFormat = iter->format;
+    }
+}
+
+SampleFormat SampleFormatPlanner::processingFormat(const Stage *stage) const {
+
+    std::map<const Stage*, SampleFormat>::const_iterator iter = mFormats.find(stage);
+
+    if( iter == mFormats.end() ) {
+        return stage->plannedSampleFormat();
+    }
+
+    return iter->second;
+}
+
+unsigned int SampleFormatPlanner::conversionCount() const {
+
+    unsigned int count = 0;
+
+    for(std::vector<Link>::const_iterator iter = mLinks.begin(),
+        end = mLinks.end(); iter != end; ++iter)
+    {
+        count += (iter->from != iter->format) ? 1 : 0;
+        count += (iter->format != iter->to) ? 1 : 0;
+    }
+
+    return count;
+}
+
+void SampleFormatPlanner::report(std::ostream &out) const {
+
+    out << "Sample format plan: " << mStages.size() << " stages, "
+    << mLinks.size() << " links, " << conversionCount() << " conversions, "
+    << mTotalCost << " cost per sample." << std::endl;
+
+    for(size_t i = 0; i < mStages.size(); ++i) {
+        out << "  Stage " << mStages[i] << " processes "
+        << SampleFormats::about(processingFormat(mStages[i])).name << std::endl;
+    }
+
+    for(std::vector<Link>::const_iterator iter = mLinks.begin(),
+        end = mLinks.end(); iter != end; ++iter)
+    {
+        out << "  Link " << iter->source->stage() << ":" << iter->source
+        << ": " << SampleFormats::about(iter->from).name << " -> "
+        << SampleFormats::about(iter->format).name << " -> "
+        << SampleFormats::about(iter->to).name << " (cost " << iter->cost
+        << ")" << std::endl;
+    }
+}
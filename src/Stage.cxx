@@ -6,24 +6,25 @@
  *
  */
 
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <set>
+
 #include "Ayane/Stage.h"
 #include "Ayane/Trace.h"
 
 namespace Ayane {
     
-    /**
-     *  ReconfigureData stores state information used between the
-     *  begin/endReconfiguration function pair.
-     */
-    class StageReconfigurationData {
-    public:
-        Stage::State mState;
-    };
-    
-    
     class StagePrivate {
     public:
         
+        /**
+         *  LinkSnapshot is an immutable copy of the links of a Stage's
+         *  sinks. Indexed by port handle.
+         */
+        typedef std::vector<Stage::SourceSinkPrivate*> LinkSnapshot;
+        
         StagePrivate(Stage *q);
         ~StagePrivate();
         
@@ -53,19 +54,130 @@ namespace Ayane {
          */
         bool shouldRunAsynchronous() const;
         
+        /**
+         *  Gets the number of process runs that may be batched into one
+         *  clock wake-up. This is the fewest credits on any linked source,
+         *  so 0 means a linked source can't accept a buffer. Stages without
+         *  linked sources get a single run, or for pure sinks, up to
+         *  kMaxSinkBatch runs while they hint for more.
+         */
+        uint32_t batchCapacity() const;
+        
+        /** The most process runs a pure sink may batch per wake-up. */
+        static const uint32_t kMaxSinkBatch = 32;
+        
+        /**
+         *  Prepares a process run. Applies link, format, and flush changes,
+         *  and snapshots the link generations pushed buffers are tagged
+         *  with. Must be called from the processing thread.
+         */
+        void prepareProcess();
+        
+        /** Cancels all awaitCredit calls on the stage's sources. */
+        void cancelCreditWaits();
+        
+        /** Finds the index of a name in a port name list. */
+        static Stage::PortHandle findPort(const std::vector<std::string> &names,
+                                          const std::string &name);
+        
+        
+        /**
+         *  Publishes a snapshot of the current links to the processing
+         *  thread. If the stage is not playing, the snapshot is applied
+         *  immediately. Must be called with the link mutex held.
+         */
+        void publishLinks();
+        
+        /**
+         *  Applies the pending link snapshot, if there is one. If
+         *  reconfigure is true, reconfigureIO is called after the
+         *  snapshot is applied. Returns true if a snapshot was applied.
+         */
+        bool applyLinks(bool reconfigure);
+        
+        /**
+         *  Waits until the stage has finished any process run that started
+         *  before the call.
+         */
+        void synchronize() const;
+        
+        /** Returns true if the stage is playing or paused. */
+        bool isStarted() const {
+            Stage::State state = mState;
+            return (state == Stage::kPlaying) || (state == Stage::kPaused);
+        }
+        
+        /** Marks the start of a process run. */
+        void enterProcess() {
+            mEpoch.fetch_add(1);
+        }
+        
+        /** Marks the end of a process run. */
+        void leaveProcess() {
+            mEpoch.fetch_add(1);
+        }
+        
+        /** List of formats proposed on sources. */
+        typedef std::vector<std::pair<Stage::Source*, BufferFormat>> FormatProposals;
+        
+        /**
+         *  Gets the formats from proposeOutputFormat for the stage's linked
+         *  sources. Must be called with the state lock held.
+         */
+        void collectOutputFormats(FormatProposals &proposals);
+        
+        /**
+         *  Proposes formats to the sinks linked to the sources. Must be
+         *  called without the state lock held.
+         */
+        static void proposeOutputFormats(const FormatProposals &proposals);
+        
+        /**
+         *  Configures the stage's sinks for any formats proposed by
+         *  upstream stages.
+         */
+        void applyProposedFormats();
+        
+        /**
+         *  Allocates the sinks' delay lines for their negotiated formats.
+         *  Must be called before any buffers are processed.
+         */
+        void reserveDelayLines();
         
-        void beginReconfiguration(StageReconfigurationData&);
+        /**
+         *  Delays a pulled buffer by the sink's compensation delay, warning
+         *  once if it does not fit the reserved delay line.
+         */
+        static void compensate(Stage::Sink *sink, Buffer &buffer);
         
-        void endReconfiguration(StageReconfigurationData&);
+        /** Gets the mutex serializing link changes across all stages. */
+        static std::mutex &linkMutex();
         
         
         Stage *q_ptr;
         AYANE_DECLARE_PUBLIC(Stage);
         
         
-        // State tracking.
-        std::mutex mStateMutex;
-        Stage::State mState;
+        // State tracking. The state mutex is only held by control functions,
+        // process runs read the state atomically.
+        mutable std::mutex mStateMutex;
+        std::atomic<Stage::State> mState;
+        
+        // Process run epoch. Odd while a process run is in progress.
+        std::atomic<uint64_t> mEpoch;
+        
+        // Link snapshot waiting to be picked up by the processing thread.
+        std::atomic<LinkSnapshot*> mPendingLinks;
+        
+        // Set when a sink has been proposed a format.
+        std::atomic<bool> mFormatsProposed;
+        
+        // Set by flush() until the processing thread handles the flush.
+        std::atomic<bool> mFlushPending;
+        
+        // Sample format planned by a SampleFormatPlanner.
+        SampleFormat mPlannedSampleFormat;
+        bool mSampleFormatPlanned;
         
         // Thread for asynchronous processing.
         std::thread mProcessingThread;
@@ -76,7 +188,23 @@ namespace Ayane {
         // mClock is points to a Clock owned by another Stage and should be
         // reset to null when stopped.
         Clock *mClock;
-        uint32_t mBufferQueuesReportedNotFull;
+        
+        // Provider the owned clock is registered with.
+        ClockProvider *mClockProvider;
+        
+        // Clock owned by the attached scheduler, or null if the Stage is
+        // not driven by a scheduler.
+        Clock *mSchedulerClock;
+        
+        // Processing thread attributes, and those inherited from the owner
+        // (e.g. a Pipeline) used when the Stage has none of its own.
+        ThreadAttributes mThreadAttributes;
+        ThreadAttributes mInheritedThreadAttributes;
+        std::atomic<ThreadAttributes::Failures> mThreadAttributeFailures;
+        
+        // Port names. Indexed by port handle, parallel to the port lists.
+        std::vector<std::string> mSourceNames;
+        std::vector<std::string> mSinkNames;
         
         MessageBus *mMessageBus;
     };
@@ -89,16 +217,44 @@ namespace Ayane {
         
     public:
         
-        SourceSinkPrivate();
+        SourceSinkPrivate(Source *source);
         ~SourceSinkPrivate();
         
+        Source * const mSource;
+        
         SynchronicityMode mLinkSynchronicity;
         
         BufferQueue mBufferQueue;
         
+        // Incremented by flush(). Buffers tagged with an older generation
+        // are discarded when pulled.
+        std::atomic<uint32_t> mGeneration;
+        
         std::mutex mPushMutex;
         std::condition_variable mPushNotification;
         
+        // Set while the link is removed, so that a pull waiting on it
+        // returns. Protected by the push mutex.
+        bool mRetired;
+        
+        // Credit (free queue slot) notification for awaitCredit.
+        std::mutex mCreditMutex;
+        std::condition_variable mCreditNotification;
+        std::atomic<uint32_t> mCreditWaiters;
+        bool mCreditCancelled;
+        
+        /**
+         *  Notifies waiting producers that credits were returned. Must be
+         *  called after buffers are removed from the queue.
+         */
+        void returnCredits();
+        
+        /**
+         *  Marks the link as removed or restored. Removing it wakes any
+         *  pull waiting for a buffer.
+         */
+        void setRetired(bool retired);
+        
     };
     
 
@@ -110,11 +266,21 @@ using namespace Ayane;
 
 
 /* StagePrivate */
+const uint32_t StagePrivate::kMaxSinkBatch;
+
 StagePrivate::StagePrivate(Stage *q) :  q_ptr(q),
                                         mState(Stage::kDeactivated),
+                                        mEpoch(0),
+                                        mPendingLinks(nullptr),
+                                        mFormatsProposed(false),
+                                        mFlushPending(false),
+                                        mPlannedSampleFormat(kFloat32),
+                                        mSampleFormatPlanned(false),
                                         mAsynchronousProcessing(false),
                                         mClock(nullptr),
-                                        mBufferQueuesReportedNotFull(0),
+                                        mClockProvider(nullptr),
+                                        mSchedulerClock(nullptr),
+                                        mThreadAttributeFailures(ThreadAttributes::kNone),
                                         mMessageBus(nullptr)
 {
     
@@ -127,7 +293,7 @@ StagePrivate::~StagePrivate() {
         std::lock_guard<std::mutex> lock(mStateMutex);
         
         // Stage was playing, transition it to an activated state.
-        if( mState == Stage::kPlaying ) {
+        if( isStarted() ) {
             
             WARNING_THIS("Stage::~Stage") << "It is **highly unrecommended** to"
             " call the destructor of a playing stage. Call stop() first."
@@ -137,12 +303,14 @@ StagePrivate::~StagePrivate() {
                 stopAsyncProcess();
                 
                 if(mClock){
+                    mClockProvider->deregisterClock(mClock);
                     delete mClock;
                 }
             }
             
             // Reset clock pointer.
             mClock = nullptr;
+            mClockProvider = nullptr;
             
             // Record the state.
             mState = Stage::kActivated;
@@ -159,9 +327,32 @@ StagePrivate::~StagePrivate() {
     A_Q(Stage);
     
     // Clear the sources and sinks before Stage calls the destructors on its
-    // member. This allows the sources and sinks to unlink themselves.
-    q->mSources.clear();
-    q->mSinks.clear();
+    // member. This allows the sources and sinks to unlink themselves. Each
+    // port is removed from its list before it is destroyed, since unlinking
+    // republishes the links of the remaining ports.
+    while( !q->mSources.empty() ) {
+        std::unique_ptr<Stage::Source> source(std::move(q->mSources.back()));
+        q->mSources.pop_back();
+    }
+    
+    while( !q->mSinks.empty() ) {
+        std::unique_ptr<Stage::Sink> sink(std::move(q->mSinks.back()));
+        q->mSinks.pop_back();
+    }
+    
+    delete mPendingLinks.exchange(nullptr);
+}
+
+Stage::PortHandle StagePrivate::findPort(const std::vector<std::string> &names,
+                                         const std::string &name)
+{
+    for(size_t i = 0; i < names.size(); ++i) {
+        if( names[i] == name ) {
+            return static_cast<Stage::PortHandle>(i);
+        }
+    }
+    
+    return Stage::kInvalidPortHandle;
 }
 
 bool StagePrivate::shouldRunAsynchronous() const {
@@ -197,15 +388,16 @@ bool StagePrivate::shouldRunAsynchronous() const {
     // Only one source, check downstream parameters.
     else
     {
-        const Stage::Source *source = q->mSources.begin()->second.get();
+        const Stage::Source *source = q->mSources.front().get();
+        const Stage::Sink *sink = source->linkedSink();
         
-        if( source->isLinked() ) {
+        if( sink != nullptr ) {
             
             // Check if connected sink is forcing an asynchronous link.
-            if(source->mLinkedSink->scheduling() == Stage::Sink::kForceAsynchronous) {
+            if(sink->scheduling() == Stage::Sink::kForceAsynchronous) {
                 
                 INFO_THIS("Stage::shouldRunAsynchronous") << "Sink: "
-                << source->mLinkedSink << " (on Source: " << source
+                << sink << " (on Source: " << source
                 << ") forcing asynchronous operation." << std::endl;
                 
                 return true;
@@ -213,7 +405,7 @@ bool StagePrivate::shouldRunAsynchronous() const {
             
             // If the downstream Stage contains more than one sink, make the
             // link asynchronous.
-            if(source->mLinkedSink->mStage->q_ptr->sinkCount() > 1) {
+            if(sink->mStage->q_ptr->sinkCount() > 1) {
                 return true;
             }
             
@@ -225,10 +417,15 @@ bool StagePrivate::shouldRunAsynchronous() const {
 
 void StagePrivate::syncProcessLoop(Clock *clock) {
     
-    std::lock_guard<std::mutex> lock(mStateMutex);
+    // The epoch must be entered before the state is checked so that stop()
+    // either sees this run, or this run sees the stage stopped.
+    enterProcess();
     
     if( mState == Stage::kPlaying ) {
         
+        // Pick up any link, proposed format, and flush changes.
+        prepareProcess();
+        
         // Reset the processing IO flags
         Stage::ProcessIOFlags ioFlags = 0;
         
@@ -241,52 +438,149 @@ void StagePrivate::syncProcessLoop(Clock *clock) {
         // Do a process run.
         q->process(&ioFlags);
     }
-    else {
+    else if( mState != Stage::kPaused ) {
         NOTICE_THIS("Stage::syncProcessLoop") << "Attempted to call process() "
         "on a Stage that is not playing." << std::endl;
     }
+    
+    leaveProcess();
 }
 
 void StagePrivate::asyncProcessLoop() {
     
     A_Q(Stage);
-
-    bool doBufferRun = false;
-    Stage::ProcessIOFlags ioFlags = 0;
-    uint32_t activeSources = q->mSources.size();
     
-    while(doBufferRun || mClock->wait()) {
+    // Apply the thread attributes before any processing occurs. The Stage's
+    // own attributes take precedence over inherited ones.
+    ThreadAttributes attributes = mThreadAttributes.isDefault() ?
+        mInheritedThreadAttributes : mThreadAttributes;
+    
+    if( !attributes.isDefault() ) {
         
-        ioFlags = 0;
-        mBufferQueuesReportedNotFull = 0;
+        ThreadAttributes::Failures failures = attributes.apply();
+        mThreadAttributeFailures = failures;
         
-        {
-            // Acquire the state lock, and then do a process run.
-            std::lock_guard<std::mutex> lock(mStateMutex);
+        if( failures != ThreadAttributes::kNone ) {
+            
+            WARNING_THIS("Stage::asyncProcessLoop") << "Failed to apply thread "
+            "attributes, Failures=" << failures << "." << std::endl;
             
-            // Cancellation flag?
-            q->process(&ioFlags);
+            if( mMessageBus ) {
+                mMessageBus->publish<WarningMessage>("Failed to apply stage "
+                                                     "thread attributes.");
+            }
         }
+    }
+
+    Stage::ProcessIOFlags ioFlags = 0;
+    
+    while(mClock->wait()) {
         
-        /*
-         * Two cases where extra buffering may occur:
-         * 1. All sources have reported they can take atleast 1 more buffer.
-         * 2. There are no active sources, but the stage is using internal
-         *    buffering and it is hinting that it can buffer more.
-         */
-        doBufferRun = ((mBufferQueuesReportedNotFull > 0) && (mBufferQueuesReportedNotFull == activeSources)) ||
-        ((ioFlags & Stage::kProcessMoreHint) && (activeSources == 0));
+        enterProcess();
+        
+        // Pick up any link, proposed format, and flush changes.
+        prepareProcess();
+        
+        // Fill every free queue slot in one batch. If a linked source can't
+        // accept a buffer, wait for the next clock tick. A tick that raced
+        // with pause() is dropped.
+        uint32_t capacity = batchCapacity();
         
+        if( (capacity > 0) && (mState == Stage::kPlaying) ) {
+            q->processBatch(capacity, &ioFlags);
+        }
+        
+        leaveProcess();
     }
     
     INFO_THIS("Stage::asyncProcessLoop") << "Asynchronous processing thread "
     << std::this_thread::get_id() << " exiting." << std::endl;
 }
 
+void StagePrivate::prepareProcess() {
+    
+    A_Q(Stage);
+    
+    applyLinks(true);
+    
+    if( mFormatsProposed.load(std::memory_order_relaxed) ) {
+        applyProposedFormats();
+    }
+    
+    if( mFlushPending.exchange(false, std::memory_order_acquire) ) {
+        
+        // Delayed frames belong to the audio before the flush.
+        for(Stage::SinkCollection::iterator iter = q->mSinks.begin(),
+            end = q->mSinks.end(); iter != end; ++iter)
+        {
+            if( (*iter != nullptr) && (*iter)->mDelayLine ) {
+                (*iter)->mDelayLine->clear();
+            }
+        }
+        
+        q->flushed();
+    }
+    
+    // Buffers pushed during this run belong to the generation current at
+    // its start. A flush during the run discards them.
+    for(Stage::SourceCollection::iterator iter = q->mSources.begin(),
+        end = q->mSources.end(); iter != end; ++iter)
+    {
+        if( *iter != nullptr ) {
+            (*iter)->mPushGeneration =
+                (*iter)->mShared->mGeneration.load(std::memory_order_acquire);
+        }
+    }
+}
+
+uint32_t StagePrivate::batchCapacity() const {
+    
+    A_Q(const Stage);
+    
+    uint32_t capacity = UINT32_MAX;
+    
+    // Unlinked sources are ignored since nothing will ever return their
+    // credits.
+    for(Stage::ConstSourceIterator iter = q->mSources.begin(),
+        end = q->mSources.end(); iter != end; ++iter)
+    {
+        if( (*iter)->isLinked() ) {
+            capacity = std::min(capacity, (*iter)->mShared->mBufferQueue.space());
+        }
+    }
+    
+    if( capacity == UINT32_MAX ) {
+        return q->mSources.empty() ? kMaxSinkBatch : 1;
+    }
+    
+    return capacity;
+}
+
+void StagePrivate::cancelCreditWaits() {
+    
+    A_Q(Stage);
+    
+    for(Stage::SourceIterator iter = q->mSources.begin(), end = q->mSources.end();
+        iter != end; ++iter)
+    {
+        q->cancelAwaitCredit(iter->get());
+    }
+}
+
 void StagePrivate::startAsyncProcess(){
     
     if(!mProcessingThread.joinable()){
         
+        A_Q(Stage);
+        
+        // Clear any credit wait cancellations left over from stopping.
+        for(Stage::SourceIterator iter = q->mSources.begin(),
+            end = q->mSources.end(); iter != end; ++iter)
+        {
+            std::lock_guard<std::mutex> lock((*iter)->mShared->mCreditMutex);
+            (*iter)->mShared->mCreditCancelled = false;
+        }
+        
         // Start the clock.
         mClock->start();
         mProcessingThread = std::thread(&StagePrivate::asyncProcessLoop, this);
@@ -309,8 +603,10 @@ void StagePrivate::stopAsyncProcess() {
         TRACE_THIS("Stage::stopAsyncProcess") << "Waiting for asynchronous "
         "processing thread to stop." << std::endl;
         
-        // Stop the clock. Processing thread will exit.
+        // Stop the clock, and release any process run waiting for credits.
+        // Processing thread will exit.
         mClock->stop();
+        cancelCreditWaits();
         mProcessingThread.join();
     }
 }
@@ -319,8 +615,8 @@ void StagePrivate::deactivateNoLock() {
     
     A_Q(Stage);
     
-    // If the stage is in the playing state, stop playback.
-    if( mState == Stage::kPlaying ) {
+    // If the stage is in the playing or paused state, stop playback.
+    if( isStarted() ) {
         // Stop playback. Use no-lock variant since we have the state lock.
         stopNoLock();
     }
@@ -332,7 +628,7 @@ void StagePrivate::deactivateNoLock() {
         for(Stage::SourceIterator iter = q->mSources.begin(), end = q->mSources.end();
             iter != end; ++iter)
         {
-            q->resetPort(iter->second.get());
+            q->resetPort(iter->get());
         }
         
         // Remove the message bus.
@@ -349,23 +645,31 @@ void StagePrivate::stopNoLock() {
     
     A_Q(Stage);
     
-    if( mState == Stage::kPlaying ) {
+    if( isStarted() ) {
         
         if( mAsynchronousProcessing ) {
             // If asynchronous, stop the processing thread.
             // Wait till processing stops.
             stopAsyncProcess();
             
-            // We own the clock, so delete it.
+            // We own the clock, so deregister and delete it.
             if (mClock) {
+                mClockProvider->deregisterClock(mClock);
                 delete mClock;
             }
         }
+        else {
+            // Prevent any further synchronous or scheduled process runs, and
+            // wait for the current one to finish.
+            mState = Stage::kActivated;
+            synchronize();
+        }
         
         // Set the clock pointer to null.
         // NOTE: Even if running synchronously, the clock pointer needs to be
         // reset to null so that the Stage won't free the un-owned clock.
         mClock = nullptr;
+        mClockProvider = nullptr;
         
         // Playback stopped callback. Must occur after all buffers are
         // processed.
@@ -376,26 +680,202 @@ void StagePrivate::stopNoLock() {
     }
 }
 
-void StagePrivate::beginReconfiguration(StageReconfigurationData &data) {
+void StagePrivate::collectOutputFormats(FormatProposals &proposals) {
     
-    // Lock the state mutex. This will prevent any process() runs.
-    mStateMutex.lock();
+    A_Q(Stage);
     
-    // Store previous state.
-    data.mState = mState;
+    for(Stage::SourceIterator iter = q->mSources.begin(), end = q->mSources.end();
+        iter != end; ++iter)
+    {
+        if( !(*iter)->isLinked() ) {
+            continue;
+        }
+        
+        BufferFormat format = q->proposeOutputFormat(*(*iter));
+        
+        // No proposal, the sink will be configured by the first buffer.
+        if( format.isValid() ) {
+            proposals.push_back(std::make_pair(iter->get(), format));
+        }
+    }
 }
 
-void StagePrivate::endReconfiguration(StageReconfigurationData& data) {
+void StagePrivate::proposeOutputFormats(const FormatProposals &proposals) {
     
-    // If the previou state was playing, call the online-reconfiguration
-    // handler.
-    if( data.mState == Stage::kPlaying ) {
-        A_Q(Stage);
+    // Prevent the linked sinks from being unlinked or destroyed.
+    std::lock_guard<std::mutex> lock(linkMutex());
+    
+    for(FormatProposals::const_iterator iter = proposals.begin(),
+        end = proposals.end(); iter != end; ++iter)
+    {
+        Stage::Sink *sink = iter->first->linkedSink();
+        const BufferFormat &format = iter->second;
+        
+        if( sink == nullptr ) {
+            continue;
+        }
+        
+        if( !sink->checkFormatSupport(format) ) {
+            NOTICE("Stage::proposeOutputFormats") << "Sink " << sink
+            << " does not support the proposed format." << std::endl;
+            continue;
+        }
+        
+        delete sink->mProposedFormat.exchange(new BufferFormat(format));
+        sink->mStage->mFormatsProposed = true;
+    }
+}
+
+void StagePrivate::applyProposedFormats() {
+    
+    A_Q(Stage);
+    
+    mFormatsProposed = false;
+    
+    for(Stage::SinkIterator iter = q->mSinks.begin(), end = q->mSinks.end();
+        iter != end; ++iter)
+    {
+        std::unique_ptr<BufferFormat> format((*iter)->mProposedFormat.exchange(nullptr));
+        
+        if( !format || (*format == (*iter)->mBufferFormat) ) {
+            continue;
+        }
+        
+        if( q->reconfigureInputFormat(*(*iter), *format) ) {
+            (*iter)->mBufferFormat = *format;
+        }
+        else {
+            WARNING_THIS("Stage::applyProposedFormats") << "Sink " << iter->get()
+            << " rejected the proposed format." << std::endl;
+        }
+    }
+}
+
+void StagePrivate::reserveDelayLines() {
+    
+    A_Q(Stage);
+    
+    for(Stage::SinkIterator iter = q->mSinks.begin(), end = q->mSinks.end();
+        iter != end; ++iter)
+    {
+        Stage::Sink *sink = iter->get();
+        Stage::Source *source = sink->linkedSource();
+        
+        if( !sink->mDelayLine || (source == nullptr) ) {
+            continue;
+        }
+        
+        // Without a negotiated format, the first buffer is bypassed.
+        const BufferFormat &format = sink->mBufferFormat;
+        
+        if( !format.isValid() ) {
+            WARNING_THIS("Stage::reserveDelayLines") << "Sink " << sink
+            << " has no negotiated format to reserve a delay line for."
+            << std::endl;
+            continue;
+        }
+        
+        BufferLength length = source->stage()->maximumBufferLength(*source);
+        
+        sink->mDelayLine->reserve(source->plannedSampleFormat(), format,
+                                  static_cast<uint32_t>(length.frames(format.sampleRate())));
+    }
+}
+
+void StagePrivate::compensate(Stage::Sink *sink, Buffer &buffer) {
+    
+    // Warn only once, since this happens on every buffer that doesn't fit.
+    if( !sink->mDelayLine->process(buffer) && (sink->mDelayLine->bypassed() == 1) ) {
+        WARNING("Stage::compensate") << "Sink " << sink << " received a "
+        "buffer that does not fit its delay line, so it is not delayed."
+        << std::endl;
+    }
+}
+
+std::mutex &StagePrivate::linkMutex() {
+    static std::mutex mutex;
+    return mutex;
+}
+
+void StagePrivate::publishLinks() {
+    
+    A_Q(Stage);
+    
+    LinkSnapshot *links = new LinkSnapshot;
+    links->reserve(q->mSinks.size());
+    
+    for(Stage::SinkIterator iter = q->mSinks.begin(), end = q->mSinks.end();
+        iter != end; ++iter)
+    {
+        Stage::Source *source = (*iter)->mLinkedSource;
+        links->push_back(source ? source->mShared.get() : nullptr);
+    }
+    
+    // Replace any snapshot the processing thread has not picked up yet.
+    delete mPendingLinks.exchange(links);
+    
+    // A stage that is not playing has no processing thread to pick up the
+    // snapshot. Holding the state lock prevents the stage from starting.
+    std::lock_guard<std::mutex> lock(mStateMutex);
+    
+    if( !isStarted() ) {
+        applyLinks(false);
+    }
+}
+
+bool StagePrivate::applyLinks(bool reconfigure) {
+    
+    LinkSnapshot *links = mPendingLinks.exchange(nullptr);
+    
+    if( links == nullptr ) {
+        return false;
+    }
+    
+    A_Q(Stage);
+    
+    // Ports are only added or removed while deactivated, so the snapshot
+    // may be shorter than the sink list, but never longer.
+    for(size_t i = 0; i < links->size() && i < q->mSinks.size(); ++i) {
+        q->mSinks[i]->mShared = (*links)[i];
+    }
+    
+    delete links;
+    
+    if( reconfigure ) {
         q->reconfigureIO();
     }
     
-    // Unlock the state mutex. Process() runs can occur after this.
-    mStateMutex.unlock();
+    return true;
+}
+
+void StagePrivate::synchronize() const {
+    
+    uint64_t epoch = mEpoch.load();
+    
+    // An even epoch means no process run is in progress. Any process run
+    // started after this point will see the latest state and links.
+    if( (epoch & 1) == 0 ) {
+        return;
+    }
+    
+    // Yield briefly, then back off so that a long process run doesn't
+    // keep the waiting thread spinning.
+    std::chrono::microseconds backoff(0);
+    
+    while( mEpoch.load() == epoch ) {
+        
+        if( backoff.count() == 0 ) {
+            for(int i = 0; (i < 64) && (mEpoch.load() == epoch); ++i) {
+                std::this_thread::yield();
+            }
+            
+            backoff = std::chrono::microseconds(50);
+        }
+        else {
+            std::this_thread::sleep_for(backoff);
+            backoff = std::min(backoff * 2, std::chrono::microseconds(1000));
+        }
+    }
 }
 
 /* Stage */
@@ -454,41 +934,87 @@ void Stage::deactivate() {
     d->deactivateNoLock();
 }
 
-void Stage::play(ClockProvider &clockProvider) {
+bool Stage::play(ClockProvider &clockProvider) {
     
     A_D(Stage);
     
-    std::lock_guard<std::mutex> lock(d->mStateMutex);
+    std::unique_lock<std::mutex> lock(d->mStateMutex);
 
     // Activated (Stopped) -> Playing
     if( d->mState == kActivated ) {
         
-        // Determine synchronicity.
-        d->mAsynchronousProcessing = d->shouldRunAsynchronous();
+        SynchronicityMode mode;
         
-        TRACE_THIS("Stage::play") << "Stage will run "
-        << (d->mAsynchronousProcessing ? "asynchronously." : "synchronously.")
-        << std::endl;
+        // A scheduled Stage is driven by its scheduler's clock.
+        if( d->mSchedulerClock ) {
+            
+            d->mAsynchronousProcessing = false;
+            d->mClock = d->mSchedulerClock;
+            
+            mode = kScheduled;
+            
+            TRACE_THIS("Stage::play") << "Stage will run scheduled."
+            << std::endl;
+        }
+        else {
+            
+            // Determine synchronicity.
+            d->mAsynchronousProcessing = d->shouldRunAsynchronous();
+            
+            TRACE_THIS("Stage::play") << "Stage will run "
+            << (d->mAsynchronousProcessing ? "asynchronously." : "synchronously.")
+            << std::endl;
+            
+            mode = (d->mAsynchronousProcessing) ? kAsynchronous : kSynchronous;
+        }
         
-        // Assign synchronicity mode to the sources.
-        SynchronicityMode mode = (d->mAsynchronousProcessing) ? kAsynchronous : kSynchronous;
+        // Pick up any link changes published while stopped.
+        d->applyLinks(false);
         
+        // Assign synchronicity mode to the sources.
         for(SourceIterator iter = mSources.begin(), end = mSources.end();
             iter != end; ++iter)
         {
-            iter->second->mShared->mLinkSynchronicity = mode;
+            (*iter)->mShared->mLinkSynchronicity = mode;
         }
         
         // Start the clock
         // NOTE: Clock must be started before beginPlayback().
         if( d->mAsynchronousProcessing ){
-            d->mClock = new Clock;
-            clockProvider.registerClock(static_cast<Clock*>(d->mClock));
+            
+            Clock *clock = new Clock;
+            
+            if( !clockProvider.registerClock(clock) ) {
+                
+                delete clock;
+                
+                ERROR_THIS("Stage::play") << "Could not register the stage's "
+                "clock." << std::endl;
+                
+                return false;
+            }
+            
+            d->mClock = clock;
+            d->mClockProvider = &clockProvider;
         }
 
         // Begin playback callback.
         // NOTE: Must occur before buffers are processing.
         beginPlayback();
+        
+        // Configure the sinks for formats proposed by upstream stages, and
+        // then get the output formats to propose to downstream stages.
+        // NOTE: Must occur before buffers are processing.
+        if( d->mFormatsProposed ) {
+            d->applyProposedFormats();
+        }
+        
+        // Allocate the delay lines for the negotiated formats.
+        // NOTE: Must occur before buffers are processing.
+        d->reserveDelayLines();
+        
+        StagePrivate::FormatProposals proposals;
+        d->collectOutputFormats(proposals);
  
         // If asynchronous, start the processing thread.
         if( d->mAsynchronousProcessing ) {
@@ -499,8 +1025,80 @@ void Stage::play(ClockProvider &clockProvider) {
         d->mState = kPlaying;
         
         INFO_THIS("Stage::play") << "Playing." << std::endl;
+        
+        // Proposing requires the link lock, which must not be acquired while
+        // holding the state lock.
+        lock.unlock();
+        
+        StagePrivate::proposeOutputFormats(proposals);
+        
+        return true;
+    }
+    // Paused -> Playing
+    else if( d->mState == kPaused ) {
+        lock.unlock();
+        return resume();
+    }
+    
+    NOTICE_THIS("Stage::play") << "Can't play a stage that is not activated "
+    "or paused." << std::endl;
+    
+    return false;
+}
+
+bool Stage::pause() {
+    
+    A_D(Stage);
+    
+    std::lock_guard<std::mutex> lock(d->mStateMutex);
+    
+    if( d->mState != kPlaying ) {
+        NOTICE_THIS("Stage::pause") << "Can't pause a stage that is not "
+        "playing." << std::endl;
+        return false;
+    }
+    
+    // Park the processing thread on its clock. Scheduled and synchronous
+    // process runs are skipped once the state changes.
+    if( d->mAsynchronousProcessing ) {
+        d->mClock->pause();
+    }
+    
+    d->mState = kPaused;
+    
+    // Wait for the current process run to finish.
+    d->synchronize();
+    
+    pausedPlayback();
+    
+    INFO_THIS("Stage::pause") << "Paused." << std::endl;
+    
+    return true;
+}
+
+bool Stage::resume() {
+    
+    A_D(Stage);
+    
+    std::lock_guard<std::mutex> lock(d->mStateMutex);
+    
+    if( d->mState != kPaused ) {
+        NOTICE_THIS("Stage::resume") << "Can't resume a stage that is not "
+        "paused." << std::endl;
+        return false;
+    }
+    
+    resumedPlayback();
+    
+    d->mState = kPlaying;
+    
+    if( d->mAsynchronousProcessing ) {
+        d->mClock->resume();
     }
     
+    INFO_THIS("Stage::resume") << "Resumed." << std::endl;
+    
+    return true;
 }
 
 void Stage::stop() {
@@ -511,59 +1109,244 @@ void Stage::stop() {
     d->stopNoLock();
 }
 
+ThreadAttributes Stage::threadAttributes() const {
+    
+    A_D(const Stage);
+    
+    std::lock_guard<std::mutex> lock(d->mStateMutex);
+    return d->mThreadAttributes;
+}
+
+void Stage::setThreadAttributes(const ThreadAttributes &attributes) {
+    
+    A_D(Stage);
+    
+    std::lock_guard<std::mutex> lock(d->mStateMutex);
+    d->mThreadAttributes = attributes;
+}
+
+void Stage::setInheritedThreadAttributes(const ThreadAttributes &attributes) {
+    
+    A_D(Stage);
+    
+    std::lock_guard<std::mutex> lock(d->mStateMutex);
+    d->mInheritedThreadAttributes = attributes;
+}
+
+ThreadAttributes::Failures Stage::threadAttributeFailures() const {
+    
+    A_D(const Stage);
+    return d->mThreadAttributeFailures;
+}
+
 
-void Stage::push(Source *source, ManagedBuffer &buffer)
+Stage::PushResult Stage::push(Source *source, ManagedBuffer &buffer)
 {
     SourceSinkPrivate *shared = source->mShared.get();
     
-    if( !shared->mBufferQueue.push(buffer) ) {
-        // Buffer couldn't be inserted due to the queue being full. This should
-        // not happen unless the downstream sink isn't working properly.
-        WARNING_THIS("Stage::Source::push") << "Failed to push buffer." << std::endl;
-        return;
+    if( !shared->mBufferQueue.push(buffer, source->mPushGeneration) ) {
+        // No credits. The buffer was not moved, so the caller still owns it
+        // and may retry once credits are returned.
+        return kNoCredits;
     }
     
     if( shared->mLinkSynchronicity == kAsynchronous ) {
-        
-        // Report if the buffer queue is not full.
-        if( !shared->mBufferQueue.full() ) {
-            A_D(Stage);
-            d->mBufferQueuesReportedNotFull++;
-        }
-        
         shared->mPushNotification.notify_one();
     }
+    
+    return kPushed;
+}
+
+bool Stage::setInPlace(Sink *sink, Source *source) {
+    
+    A_D(Stage);
+    
+    std::lock_guard<std::mutex> lock(d->mStateMutex);
+    
+    if( d->mState != kDeactivated ) {
+        NOTICE_THIS("Stage::setInPlace") << "Can't pair ports unless stage is "
+        "deactivated." << std::endl;
+        return false;
+    }
+    
+    if( (sink == nullptr) || (sink->mStage != d) ||
+        ((source != nullptr) && (source->mStage != d)) )
+    {
+        ERROR_THIS("Stage::setInPlace") << "Ports must belong to the stage."
+        << std::endl;
+        return false;
+    }
+    
+    // A source may only be fed by one in-place sink.
+    if( source != nullptr ) {
+        for(SinkIterator iter = mSinks.begin(), end = mSinks.end();
+            iter != end; ++iter)
+        {
+            if( (iter->get() != sink) && ((*iter)->mInPlaceSource == source) ) {
+                ERROR_THIS("Stage::setInPlace") << "Source " << source
+                << " is already paired." << std::endl;
+                return false;
+            }
+        }
+    }
+    
+    sink->mInPlaceSource = source;
+    return true;
+}
+
+Stage::PushResult Stage::forward(Sink *sink, ManagedBuffer &buffer) {
+    
+    if( sink->mInPlaceSource == nullptr ) {
+        return kNotInPlace;
+    }
+    
+    return push(sink->mInPlaceSource, buffer);
+}
+
+uint32_t Stage::credits(const Source *source) const {
+    return source->mShared->mBufferQueue.space();
+}
+
+bool Stage::awaitCredit(Source *source) {
+    
+    SourceSinkPrivate *shared = source->mShared.get();
+    
+    if( !shared->mBufferQueue.full() ) {
+        return true;
+    }
+    
+    std::unique_lock<std::mutex> lock(shared->mCreditMutex);
+    
+    // Register as a waiter before checking the queue so that a concurrent
+    // pull either sees the waiter, or the wait sees the returned credit.
+    shared->mCreditWaiters.fetch_add(1);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    
+    while( shared->mBufferQueue.full() && !shared->mCreditCancelled ) {
+        shared->mCreditNotification.wait(lock);
+    }
+    
+    shared->mCreditWaiters.fetch_sub(1);
+    
+    if( shared->mCreditCancelled ) {
+        shared->mCreditCancelled = false;
+        return false;
+    }
+    
+    return true;
+}
+
+void Stage::cancelAwaitCredit(Source *source) {
+    
+    SourceSinkPrivate *shared = source->mShared.get();
+    
+    std::lock_guard<std::mutex> lock(shared->mCreditMutex);
+    
+    // Set cancellation flag.
+    shared->mCreditCancelled = true;
+    
+    // Notify any waiting producers that they can cancel their wait.
+    shared->mCreditNotification.notify_all();
 }
 
 Stage::PullResult Stage::pull(Sink *sink, ManagedBuffer *outBuffer)
+{
+    return pullUntil(sink, outBuffer, nullptr);
+}
+
+Stage::PullResult Stage::pull(Sink *sink, ManagedBuffer *outBuffer,
+                              const std::chrono::steady_clock::time_point &deadline)
+{
+    return pullUntil(sink, outBuffer, &deadline);
+}
+
+Stage::PullResult Stage::pull(Sink *sink, ManagedBuffer *outBuffer,
+                              std::chrono::nanoseconds timeout)
+{
+    std::chrono::steady_clock::time_point deadline =
+        std::chrono::steady_clock::now() +
+        std::chrono::duration_cast<std::chrono::steady_clock::duration>(timeout);
+    
+    return pullUntil(sink, outBuffer, &deadline);
+}
+
+Stage::PullResult Stage::pullUntil(Sink *sink, ManagedBuffer *outBuffer,
+                                   const std::chrono::steady_clock::time_point *deadline)
 {
     SourceSinkPrivate *shared = sink->mShared;
     
-    switch(shared->mLinkSynchronicity) {
-        case kAsynchronous: {
-            
-            std::unique_lock<std::mutex> lock(shared->mPushMutex);
-            
-            // Wait for a buffer to be pushed into the queue.
-            while(shared->mBufferQueue.empty()) {
-                shared->mPushNotification.wait(lock);
+    if( shared == nullptr ) {
+        return kNotLinked;
+    }
+    
+    // Buffers from before a flush are discarded, and the pull repeated.
+    for(;;) {
+        
+        switch(shared->mLinkSynchronicity) {
+            case kAsynchronous: {
+                
+                A_D(Stage);
+                
+                // A scheduled Stage must finish within its cycle, so a pull
+                // from a producer outside the scheduler (e.g. in another
+                // clock domain) takes what has been pushed without waiting.
+                if( d->mSchedulerClock != nullptr ) {
+                    break;
+                }
+                
+                std::unique_lock<std::mutex> lock(shared->mPushMutex);
                 
-                if( sink->mPullCancelled ) {
-                    sink->mPullCancelled = false;
-                    return kCancelled;
+                // Wait for a buffer to be pushed into the queue.
+                while(shared->mBufferQueue.empty()) {
+                    
+                    // The link was removed while waiting.
+                    if( shared->mRetired ) {
+                        return kNotLinked;
+                    }
+                    
+                    if( deadline == nullptr ) {
+                        shared->mPushNotification.wait(lock);
+                    }
+                    else if( (shared->mPushNotification.wait_until(lock, *deadline) ==
+                              std::cv_status::timeout) && shared->mBufferQueue.empty() )
+                    {
+                        sink->mDeadlineMisses.fetch_add(1, std::memory_order_relaxed);
+                        return kTimedOut;
+                    }
+                    
+                    if( sink->mPullCancelled ) {
+                        sink->mPullCancelled = false;
+                        return kCancelled;
+                    }
                 }
+                
+                break;
+            }
+            case kSynchronous: {
+                
+                A_D(Stage);
+                
+                shared->mSource->mStage->syncProcessLoop(d->mClock);
+                break;
             }
+            case kScheduled:
+                // The producer has already run this cycle. Don't wait.
+                break;
         }
-        case kSynchronous: {
-            
-            A_D(Stage);
-
-            sink->mLinkedSource->mStage->syncProcessLoop(d->mClock);
+        
+        uint32_t generation;
+        
+        if( !shared->mBufferQueue.pop(outBuffer, &generation) ) {
+            return kBufferQueueEmpty;
         }
-    }
-
-    if( !shared->mBufferQueue.pop(outBuffer) ) {
-        return kBufferQueueEmpty;
+        
+        shared->returnCredits();
+        
+        if( generation == shared->mGeneration.load(std::memory_order_acquire) ) {
+            break;
+        }
+        
+        outBuffer->reset();
     }
     
     // Check if the buffer's format matches the sink's format.
@@ -576,6 +1359,11 @@ Stage::PullResult Stage::pull(Sink *sink, ManagedBuffer *outBuffer)
         sink->mBufferFormat = (*outBuffer)->format();
     }
     
+    // Align the buffer with the stage's other sinks.
+    if( sink->mDelayLine ) {
+        StagePrivate::compensate(sink, **outBuffer);
+    }
+    
     return kSuccess;
 }
 
@@ -583,9 +1371,28 @@ Stage::PullResult Stage::tryPull(Sink *sink, ManagedBuffer *outBuffer) {
     
     SourceSinkPrivate *shared = sink->mShared;
     
-    if( shared->mLinkSynchronicity == kAsynchronous ) {
-        if( !shared->mBufferQueue.pop(outBuffer) ) {
-            return kBufferQueueEmpty;
+    if( shared == nullptr ) {
+        return kNotLinked;
+    }
+    
+    if( shared->mLinkSynchronicity != kSynchronous ) {
+        
+        // Discard any buffers from before a flush.
+        for(;;) {
+            
+            uint32_t generation;
+            
+            if( !shared->mBufferQueue.pop(outBuffer, &generation) ) {
+                return kBufferQueueEmpty;
+            }
+            
+            shared->returnCredits();
+            
+            if( generation == shared->mGeneration.load(std::memory_order_acquire) ) {
+                break;
+            }
+            
+            outBuffer->reset();
         }
     }
     else {
@@ -604,6 +1411,11 @@ Stage::PullResult Stage::tryPull(Sink *sink, ManagedBuffer *outBuffer) {
         sink->mBufferFormat = (*outBuffer)->format();
     }
     
+    // Align the buffer with the stage's other sinks.
+    if( sink->mDelayLine ) {
+        StagePrivate::compensate(sink, **outBuffer);
+    }
+    
     return kSuccess;
 }
 
@@ -612,7 +1424,7 @@ void Stage::cancelPull(Sink *sink)
     SourceSinkPrivate *shared = sink->mShared;
     
     // No-op in synchronous mode.
-    if( shared->mLinkSynchronicity == kAsynchronous ) {
+    if( (shared != nullptr) && (shared->mLinkSynchronicity == kAsynchronous) ) {
         
         std::lock_guard<std::mutex> lock(shared->mPushMutex);
         
@@ -624,9 +1436,217 @@ void Stage::cancelPull(Sink *sink)
     }
 }
 
+void Stage::attachScheduler(Clock *clock) {
+    
+    A_D(Stage);
+    
+    std::lock_guard<std::mutex> lock(d->mStateMutex);
+    
+    if( !d->isStarted() ) {
+        d->mSchedulerClock = clock;
+    }
+    else {
+        NOTICE_THIS("Stage::attachScheduler") << "Can't attach a scheduler to "
+        "a playing stage." << std::endl;
+    }
+}
+
+void Stage::detachScheduler() {
+    
+    A_D(Stage);
+    
+    std::lock_guard<std::mutex> lock(d->mStateMutex);
+    
+    if( !d->isStarted() ) {
+        d->mSchedulerClock = nullptr;
+    }
+    else {
+        NOTICE_THIS("Stage::detachScheduler") << "Can't detach a scheduler "
+        "from a playing stage." << std::endl;
+    }
+}
+
+void Stage::processScheduled() {
+    
+    A_D(Stage);
+    
+    // Skip the cycle if any linked source can't accept a buffer.
+    if( d->batchCapacity() > 0 ) {
+        d->syncProcessLoop(d->mSchedulerClock);
+    }
+}
+
+void Stage::flush() {
+    
+    A_D(Stage);
+    
+    std::lock_guard<std::mutex> lock(StagePrivate::linkMutex());
+    
+    // Find this stage and every stage downstream of it.
+    std::vector<StagePrivate*> pending(1, d);
+    std::set<StagePrivate*> visited;
+    
+    while( !pending.empty() ) {
+        
+        StagePrivate *stage = pending.back();
+        pending.pop_back();
+        
+        if( !visited.insert(stage).second ) {
+            continue;
+        }
+        
+        for(SourceCollection::iterator iter = stage->q_ptr->mSources.begin(),
+            end = stage->q_ptr->mSources.end(); iter != end; ++iter)
+        {
+            Sink *sink = (*iter != nullptr) ? (*iter)->linkedSink() : nullptr;
+            
+            if( sink != nullptr ) {
+                pending.push_back(sink->mStage);
+            }
+        }
+    }
+    
+    // Every stage is marked before any generation changes, so that no stage
+    // accepts a buffer from after the flush before it has been flushed.
+    for(std::set<StagePrivate*>::iterator iter = visited.begin(),
+        end = visited.end(); iter != end; ++iter)
+    {
+        (*iter)->mFlushPending.store(true, std::memory_order_release);
+    }
+    
+    // Bump the generation of every link so that buffers already in flight
+    // are discarded.
+    for(std::set<StagePrivate*>::iterator iter = visited.begin(),
+        end = visited.end(); iter != end; ++iter)
+    {
+        SourceCollection &sources = (*iter)->q_ptr->mSources;
+        
+        for(SourceCollection::iterator source = sources.begin(),
+            last = sources.end(); source != last; ++source)
+        {
+            if( *source != nullptr ) {
+                (*source)->mShared->mGeneration.fetch_add(1, std::memory_order_release);
+            }
+        }
+    }
+}
+
+void Stage::flushed() {
+}
+
+void Stage::pausedPlayback() {
+}
+
+void Stage::resumedPlayback() {
+}
+
+ClockProvider *Stage::providedClockProvider() {
+    return nullptr;
+}
+
+ClockProvider *Stage::requiredClockProvider() {
+    return nullptr;
+}
+
+BufferLength Stage::maximumBufferLength(const Source &) const {
+    return BufferLength(Duration(0.1));
+}
+
+double Stage::latency() const {
+    return 0.0;
+}
+
+bool Stage::setCompensationDelay(Sink *sink, double delay) {
+    
+    A_D(Stage);
+    
+    std::lock_guard<std::mutex> lock(d->mStateMutex);
+    
+    if( d->isStarted() ) {
+        NOTICE_THIS("Stage::setCompensationDelay") << "Can't change delays "
+        "while playing." << std::endl;
+        return false;
+    }
+    
+    if( sink->mStage != d ) {
+        ERROR_THIS("Stage::setCompensationDelay") << "Sink must belong to the "
+        "stage." << std::endl;
+        return false;
+    }
+    
+    if( delay <= 0.0 ) {
+        sink->mDelayLine.reset();
+    }
+    else if( sink->mDelayLine ) {
+        sink->mDelayLine->setDelay(delay);
+    }
+    else {
+        sink->mDelayLine.reset(new DelayLine(delay));
+    }
+    
+    return true;
+}
+
+uint32_t Stage::processBatch(uint32_t maxRuns, ProcessIOFlags *ioFlags) {
+    
+    uint32_t runs = 0;
+    
+    while( runs < maxRuns ) {
+        
+        *ioFlags = 0;
+        process(ioFlags);
+        ++runs;
+        
+        // Pure sinks only continue while they hint that they can buffer more.
+        if( mSources.empty() && !((*ioFlags) & kProcessMoreHint) ) {
+            break;
+        }
+    }
+    
+    return runs;
+}
+
+bool Stage::supportsInputFormat(const Sink &, const BufferFormat &) const {
+    return true;
+}
+
+BufferFormat Stage::proposeOutputFormat(const Source &source) {
+    
+    // In-place pairs carry the input format through unchanged.
+    for(ConstSinkIterator iter = mSinks.begin(), end = mSinks.end();
+        iter != end; ++iter)
+    {
+        if( (*iter)->mInPlaceSource == &source ) {
+            return (*iter)->mBufferFormat;
+        }
+    }
+    
+    return BufferFormat();
+}
+
+SampleFormatSet Stage::supportedSampleFormats() const {
+    return kAllSampleFormats;
+}
+
+SampleFormat Stage::preferredSampleFormat() const {
+    return kFloat32;
+}
+
+SampleFormat Stage::plannedSampleFormat() const {
+    A_D(const Stage);
+    return d->mSampleFormatPlanned ? d->mPlannedSampleFormat : preferredSampleFormat();
+}
+
+void Stage::setPlannedSampleFormat(SampleFormat format) {
+    A_D(Stage);
+    d->mPlannedSampleFormat = format;
+    d->mSampleFormatPlanned = true;
+}
+
 void Stage::resetPort(Source *source) {
     // Clear the queue.
     source->mShared->mBufferQueue.clear();
+    source->mShared->returnCredits();
 }
 
 void Stage::resetPort(Sink *sink) {
@@ -635,29 +1655,123 @@ void Stage::resetPort(Sink *sink) {
 
 
 
-void Stage::addSource(const std::string &name) {
+const Stage::PortHandle Stage::kInvalidPortHandle;
+
+Stage::Source *Stage::source(const std::string &name) const {
+    
+    A_D(const Stage);
+    
+    PortHandle handle = StagePrivate::findPort(d->mSourceNames, name);
+    return (handle != kInvalidPortHandle) ? mSources[handle].get() : nullptr;
+}
+
+Stage::Sink *Stage::sink(const std::string &name) const {
+    
+    A_D(const Stage);
+    
+    PortHandle handle = StagePrivate::findPort(d->mSinkNames, name);
+    return (handle != kInvalidPortHandle) ? mSinks[handle].get() : nullptr;
+}
+
+Stage::PortHandle Stage::sourceHandle(const std::string &name) const {
+    A_D(const Stage);
+    return StagePrivate::findPort(d->mSourceNames, name);
+}
+
+Stage::PortHandle Stage::sinkHandle(const std::string &name) const {
+    A_D(const Stage);
+    return StagePrivate::findPort(d->mSinkNames, name);
+}
+
+Stage::PortHandle Stage::addSource(const std::string &name) {
     
     A_D(Stage);
     
-    if( d->mState == kDeactivated ){
-        mSources.insert(std::make_pair(name, std::unique_ptr<Source>(new Source(d))));
-    }
-    else {
+    if( d->mState != kDeactivated ){
         NOTICE_THIS("Stage::addSource") << "Can't add source unless stage is "
         "deactivated." << std::endl;
+        return kInvalidPortHandle;
+    }
+    
+    if( StagePrivate::findPort(d->mSourceNames, name) != kInvalidPortHandle ) {
+        NOTICE_THIS("Stage::addSource") << "Source named " << name
+        << " already exists." << std::endl;
+        return kInvalidPortHandle;
+    }
+    
+    mSources.push_back(std::unique_ptr<Source>(new Source(d)));
+    d->mSourceNames.push_back(name);
+    
+    return static_cast<PortHandle>(mSources.size() - 1);
+}
+
+void Stage::removeSource(const std::string &name) {
+    
+    A_D(Stage);
+    
+    if( d->mState != kDeactivated ){
+        NOTICE_THIS("Stage::removeSource") << "Can't remove source unless "
+        "stage is deactivated." << std::endl;
+        return;
+    }
+    
+    PortHandle handle = StagePrivate::findPort(d->mSourceNames, name);
+    
+    if( handle != kInvalidPortHandle ) {
+        
+        // Break any in-place pair feeding the source.
+        for(SinkIterator iter = mSinks.begin(), end = mSinks.end();
+            iter != end; ++iter)
+        {
+            if( (*iter)->mInPlaceSource == mSources[handle].get() ) {
+                (*iter)->mInPlaceSource = nullptr;
+            }
+        }
+        
+        // Erasing the source unlinks it.
+        mSources.erase(mSources.begin() + handle);
+        d->mSourceNames.erase(d->mSourceNames.begin() + handle);
     }
 }
 
-void Stage::addSink(const std::string &name) {
+Stage::PortHandle Stage::addSink(const std::string &name) {
 
     A_D(Stage);
 
-    if( d->mState == kDeactivated ) {
-        mSinks.insert(std::make_pair(name, std::unique_ptr<Sink>(new Sink(d))));
-    }
-    else {
+    if( d->mState != kDeactivated ) {
         NOTICE_THIS("Stage::addSink") << "Can't add sink unless stage is "
         "deactivated." << std::endl;
+        return kInvalidPortHandle;
+    }
+    
+    if( StagePrivate::findPort(d->mSinkNames, name) != kInvalidPortHandle ) {
+        NOTICE_THIS("Stage::addSink") << "Sink named " << name
+        << " already exists." << std::endl;
+        return kInvalidPortHandle;
+    }
+    
+    mSinks.push_back(std::unique_ptr<Sink>(new Sink(d)));
+    d->mSinkNames.push_back(name);
+    
+    return static_cast<PortHandle>(mSinks.size() - 1);
+}
+
+void Stage::removeSink(const std::string &name) {
+    
+    A_D(Stage);
+    
+    if( d->mState != kDeactivated ){
+        NOTICE_THIS("Stage::removeSink") << "Can't remove sink unless stage "
+        "is deactivated." << std::endl;
+        return;
+    }
+    
+    PortHandle handle = StagePrivate::findPort(d->mSinkNames, name);
+    
+    if( handle != kInvalidPortHandle ) {
+        // Erasing the sink unlinks it.
+        mSinks.erase(mSinks.begin() + handle);
+        d->mSinkNames.erase(d->mSinkNames.begin() + handle);
     }
 }
 
@@ -682,26 +1796,36 @@ bool Stage::replace(Source *current, Source *next, Sink *sink) {
         return true;
     }
     
+    std::unique_lock<std::mutex> lock(StagePrivate::linkMutex());
+    
     // Only replace if the ports are linked to each other.
     if( (current->mLinkedSink == sink) && (sink->mLinkedSource == current) ) {
-
-        StageReconfigurationData sinkData, currentSourceData, nextSourceData;
         
-        sink->mStage->beginReconfiguration(sinkData);
-        current->mStage->beginReconfiguration(currentSourceData);
-        next->mStage->beginReconfiguration(nextSourceData);
+        if( next->mLinkedSink != nullptr ) {
+            NOTICE("Stage::replace") << "Source " << next << " already linked."
+            << std::endl;
+            return false;
+        }
 
         // Unlink from current source
         current->mLinkedSink = nullptr;
 
         // Link to new source
-        sink->mShared = next->mShared.get();
         sink->mLinkedSource = next;
         next->mLinkedSink = sink;
         
-        next->mStage->endReconfiguration(nextSourceData);
-        sink->mStage->endReconfiguration(sinkData);
-        current->mStage->endReconfiguration(currentSourceData);
+        next->mShared->setRetired(false);
+        
+        next->mStage->publishLinks();
+        sink->mStage->publishLinks();
+        current->mStage->publishLinks();
+        
+        lock.unlock();
+        
+        // Wake a pull waiting on the current source, then wait till the
+        // sink's stage is no longer using it.
+        current->mShared->setRetired(true);
+        sink->mStage->synchronize();
 
         INFO("Stage::replace") << "Relinked: " << next->mStage << ":" << next
         << " +-----> " << sink->mStage    <<  ":" << sink
@@ -725,20 +1849,20 @@ bool Stage::link( Source *source, Sink *sink )
         return false;
     }
     
+    std::unique_lock<std::mutex> lock(StagePrivate::linkMutex());
+    
     if( (source->mLinkedSink == nullptr) && (sink->mLinkedSource == nullptr) ) {
         
-        StageReconfigurationData sinkData, sourceData;
-        
-        sink->mStage->beginReconfiguration(sinkData);
-        source->mStage->beginReconfiguration(sourceData);
-        
         // Perform link.
         source->mLinkedSink = sink;
         sink->mLinkedSource = source;
-        sink->mShared = source->mShared.get();
         
-        source->mStage->endReconfiguration(sourceData);
-        sink->mStage->endReconfiguration(sinkData);
+        source->mShared->setRetired(false);
+        
+        source->mStage->publishLinks();
+        sink->mStage->publishLinks();
+        
+        lock.unlock();
         
         INFO("Stage::link") << "Linked: " << source->mStage << ":"
         << source << " +-----> " << sink->mStage <<  ":" << sink << std::endl;
@@ -760,21 +1884,24 @@ void Stage::unlink( Source *source, Sink *sink )
         return;
     }
     
+    std::unique_lock<std::mutex> lock(StagePrivate::linkMutex());
+    
     // Only unlink if the ports are linked to each other.
     if( (source->mLinkedSink == sink) && (sink->mLinkedSource == source) ) {
-
-        StageReconfigurationData sinkData, sourceData;
-        
-        sink->mStage->beginReconfiguration(sinkData);
-        source->mStage->beginReconfiguration(sourceData);
         
         // Unlink
-        sink->mShared = nullptr;
         source->mLinkedSink = nullptr;
         sink->mLinkedSource = nullptr;
         
-        source->mStage->endReconfiguration(sourceData);
-        sink->mStage->endReconfiguration(sinkData);
+        source->mStage->publishLinks();
+        sink->mStage->publishLinks();
+        
+        lock.unlock();
+        
+        // Wake a pull waiting on the source, then wait till the sink's
+        // stage is no longer using it.
+        source->mShared->setRetired(true);
+        sink->mStage->synchronize();
         
         INFO("Stage::unlink") << "Unlinked: " << source->mStage << ":"
         << source << " +-/ /-> " << sink->mStage <<  ":" << sink << std::endl;
@@ -794,13 +1921,40 @@ void Stage::unlink( Source *source, Sink *sink )
 
 /* Stage::SourceSinkPrivate */
 
-Stage::SourceSinkPrivate::SourceSinkPrivate() :
+Stage::SourceSinkPrivate::SourceSinkPrivate(Source *source) :
+    mSource(source),
     mLinkSynchronicity(kSynchronous),
-    mBufferQueue(2)
+    mBufferQueue(2),
+    mGeneration(0),
+    mRetired(false),
+    mCreditWaiters(0),
+    mCreditCancelled(false)
 {
     
 }
 
+void Stage::SourceSinkPrivate::returnCredits() {
+    
+    // Pairs with the fence in awaitCredit. Waking is skipped entirely
+    // unless a producer is waiting.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    
+    if( mCreditWaiters.load() > 0 ) {
+        std::lock_guard<std::mutex> lock(mCreditMutex);
+        mCreditNotification.notify_all();
+    }
+}
+
+void Stage::SourceSinkPrivate::setRetired(bool retired) {
+    
+    std::lock_guard<std::mutex> lock(mPushMutex);
+    mRetired = retired;
+    
+    if( retired ) {
+        mPushNotification.notify_all();
+    }
+}
+
 Stage::SourceSinkPrivate::~SourceSinkPrivate() {
     
 }
@@ -811,7 +1965,9 @@ Stage::SourceSinkPrivate::~SourceSinkPrivate() {
 Stage::Source::Source(StagePrivate *stage) :
     mStage(stage),
     mLinkedSink(nullptr),
-    mShared(new Stage::SourceSinkPrivate)
+    mPlannedSampleFormat(kFloat32),
+    mPushGeneration(0),
+    mShared(new Stage::SourceSinkPrivate(this))
 {
     
 }
@@ -829,17 +1985,18 @@ bool Stage::Source::isLinked() const {
     return (mLinkedSink != nullptr);
 }
 
+Stage *Stage::Source::stage() const {
+    return mStage->q_ptr;
+}
+
 Stage::SynchronicityMode Stage::Source::linkSynchronicity() const {
     return mShared->mLinkSynchronicity;
 }
 
 bool Stage::Source::checkFormatSupport(const BufferFormat &format) const
 {
-    if( !mLinkedSink->checkFormatSupport(format) ) {
-        return true;
-    }
-    
-    return false;
+    Sink *sink = linkedSink();
+    return (sink != nullptr) && sink->checkFormatSupport(format);
 }
 
 
@@ -849,9 +2006,14 @@ bool Stage::Source::checkFormatSupport(const BufferFormat &format) const
 Stage::Sink::Sink(StagePrivate *stage) :
     mStage(stage),
     mLinkedSource(nullptr),
+    mProposedFormat(nullptr),
+    m_scheduling(kDefault),
+    mInPlaceSource(nullptr),
+    mDelayLine(),
     mShared(nullptr),
     mBufferFormat(),
-    mPullCancelled(false)
+    mPullCancelled(false),
+    mDeadlineMisses(0)
 {
     
 }
@@ -863,21 +2025,24 @@ Stage::Sink::~Sink() {
         Stage::unlink(mLinkedSource, this);
     }
     
+    delete mProposedFormat.exchange(nullptr);
 }
 
 bool Stage::Sink::isLinked() const {
     return (mLinkedSource != nullptr);
 }
 
+Stage *Stage::Sink::stage() const {
+    return mStage->q_ptr;
+}
+
 Stage::SynchronicityMode Stage::Sink::linkSynchronicity() const {
     return mShared->mLinkSynchronicity;
 }
 
 bool Stage::Sink::checkFormatSupport( const BufferFormat &format ) const
 {
-#pragma unused(format)
-    // TODO: Implement range based format checking.
-    return true;
+    return format.isValid() && mStage->q_ptr->supportsInputFormat(*this, format);
 }
 
 
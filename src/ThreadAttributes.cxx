@@ -0,0 +1,170 @@
+/*
+ *
+ * Copyright (c) 2013 Philip Deljanov. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ */
+
+#include <alloca.h>
+#include <cerrno>
+#include <cstring>
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+
+#if defined(__SSE__) || defined(__x86_64__)
+#include <xmmintrin.h>
+#endif
+
+#include "Ayane/ThreadAttributes.h"
+#include "Ayane/Trace.h"
+
+using namespace Ayane;
+
+namespace {
+
+    bool applyPolicy(ThreadAttributes::SchedulingPolicy policy, int priority) {
+
+        sched_param param;
+        memset(&param, 0, sizeof(param));
+
+        int nativePolicy = SCHED_OTHER;
+
+        switch(policy) {
+            case ThreadAttributes::kFifo:
+                nativePolicy = SCHED_FIFO;
+                param.sched_priority = priority;
+                break;
+            case ThreadAttributes::kRoundRobin:
+                nativePolicy = SCHED_RR;
+                param.sched_priority = priority;
+                break;
+            default:
+                break;
+        }
+
+        int result = pthread_setschedparam(pthread_self(), nativePolicy, &param);
+
+        if( result != 0 ) {
+            ERROR("ThreadAttributes::apply") << "Could not set scheduling "
+            "policy " << policy << " with priority " << priority << ": "
+            << strerror(result) << std::endl;
+            return false;
+        }
+
+        return true;
+    }
+
+    bool applyAffinity(uint64_t affinity) {
+
+#if defined(__linux__)
+        cpu_set_t set;
+        CPU_ZERO(&set);
+
+        for(int cpu = 0; cpu < 64; ++cpu) {
+            if( affinity & (static_cast<uint64_t>(1) << cpu) ) {
+                CPU_SET(cpu, &set);
+            }
+        }
+
+        int result = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+
+        if( result != 0 ) {
+            ERROR("ThreadAttributes::apply") << "Could not set CPU affinity "
+            << std::hex << std::showbase << affinity << std::noshowbase
+            << std::dec << ": " << strerror(result) << std::endl;
+            return false;
+        }
+
+        return true;
+#else
+        ERROR("ThreadAttributes::apply") << "CPU affinity is not supported on "
+        "this platform." << std::endl;
+        return false;
+#endif
+    }
+
+    bool applyFlushDenormals() {
+
+#if defined(__SSE__) || defined(__x86_64__)
+        // FTZ is bit 15, DAZ is bit 6 of the MXCSR.
+        _mm_setcsr(_mm_getcsr() | 0x8040);
+        return true;
+#elif defined(__aarch64__)
+        // FZ is bit 24 of the FPCR.
+        uint64_t fpcr;
+        __asm__ __volatile__("mrs %0, fpcr" : "=r"(fpcr));
+        fpcr |= (static_cast<uint64_t>(1) << 24);
+        __asm__ __volatile__("msr fpcr, %0" : : "r"(fpcr));
+        return true;
+#else
+        ERROR("ThreadAttributes::apply") << "Flushing denormals is not "
+        "supported on this platform." << std::endl;
+        return false;
+#endif
+    }
+
+    bool applyLockMemory() {
+
+        if( mlockall(MCL_CURRENT | MCL_FUTURE) != 0 ) {
+            ERROR("ThreadAttributes::apply") << "Could not lock memory: "
+            << strerror(errno) << std::endl;
+            return false;
+        }
+
+        return true;
+    }
+
+    void touchStack(size_t size) {
+
+        // Touch one byte per page. The volatile pointer prevents the
+        // compiler from eliding the writes.
+        volatile char *stack = static_cast<volatile char*>(alloca(size));
+
+        for(size_t i = 0; i < size; i += 4096) {
+            stack[i] = 0;
+        }
+    }
+
+}
+
+bool ThreadAttributes::isDefault() const {
+    return (policy == kDefaultPolicy) &&
+           (affinity == 0) &&
+           !flushDenormals &&
+           !lockMemory &&
+           (prefaultStack == 0);
+}
+
+ThreadAttributes::Failures ThreadAttributes::apply() const {
+
+    Failures failures = kNone;
+
+    // Claim the thread's trace ring now, so logging never allocates later.
+    Trace::instance().prepareThread();
+
+    // Lock memory before prefaulting so the touched pages stay resident.
+    if( lockMemory && !applyLockMemory() ) {
+        failures |= kMemoryLockFailed;
+    }
+
+    if( prefaultStack > 0 ) {
+        touchStack(prefaultStack);
+    }
+
+    if( (affinity != 0) && !applyAffinity(affinity) ) {
+        failures |= kAffinityFailed;
+    }
+
+    if( flushDenormals && !applyFlushDenormals() ) {
+        failures |= kFloatingPointFailed;
+    }
+
+    if( (policy != kDefaultPolicy) && !applyPolicy(policy, priority) ) {
+        failures |= kPolicyFailed;
+    }
+
+    return failures;
+}
@@ -0,0 +1,174 @@
+/*
+ *
+ * Copyright (c) 2013 Philip Deljanov. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ */
+
+#include <chrono>
+
+#if defined(__linux__)
+#include <cerrno>
+#include <time.h>
+#endif
+
+#include "Ayane/TimerClockProvider.h"
+#include "Ayane/Trace.h"
+
+using namespace Ayane;
+
+namespace {
+
+    const uint64_t kNanosecondsPerSecond = 1000000000;
+
+    // Gets the monotonic time in nanoseconds.
+    uint64_t monotonicNow() {
+
+#if defined(__linux__)
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return (static_cast<uint64_t>(now.tv_sec) * kNanosecondsPerSecond) + now.tv_nsec;
+#else
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+    }
+
+    // Sleeps until the absolute monotonic deadline in nanoseconds.
+    void sleepUntil(uint64_t deadline) {
+
+#if defined(__linux__)
+        struct timespec until;
+        until.tv_sec = static_cast<time_t>(deadline / kNanosecondsPerSecond);
+        until.tv_nsec = static_cast<long>(deadline % kNanosecondsPerSecond);
+
+        // Restart if interrupted by a signal. The deadline is absolute, so
+        // no time is lost.
+        while( clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, nullptr) == EINTR ) {
+        }
+#else
+        std::this_thread::sleep_until(std::chrono::steady_clock::time_point(
+            std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                std::chrono::nanoseconds(deadline))));
+#endif
+    }
+
+}
+
+TimerClockProvider::TimerClockProvider(uint64_t period) :
+    ClockProvider(ClockCapabilities(1000000, kNanosecondsPerSecond), period),
+    mRunning(false),
+    mTicks(0),
+    mTotalLateness(0),
+    mMaxLateness(0),
+    mOverruns(0)
+{
+
+}
+
+TimerClockProvider::~TimerClockProvider() {
+    stop();
+}
+
+void TimerClockProvider::start() {
+
+    if( mRunning ) {
+        NOTICE_THIS("TimerClockProvider::start") << "Already started."
+        << std::endl;
+        return;
+    }
+
+    resetJitter();
+
+    mRunning = true;
+    mThread = std::thread(&TimerClockProvider::run, this, clockPeriod());
+}
+
+void TimerClockProvider::stop() {
+
+    mRunning = false;
+
+    if( mThread.joinable() ) {
+        mThread.join();
+    }
+}
+
+TimerJitter TimerClockProvider::jitter() const {
+
+    TimerJitter jitter;
+
+    jitter.ticks = mTicks.load(std::memory_order_relaxed);
+    jitter.mean = (jitter.ticks > 0) ?
+        (mTotalLateness.load(std::memory_order_relaxed) / jitter.ticks) : 0;
+    jitter.max = mMaxLateness.load(std::memory_order_relaxed);
+    jitter.overruns = mOverruns.load(std::memory_order_relaxed);
+
+    return jitter;
+}
+
+void TimerClockProvider::resetJitter() {
+    mTicks = 0;
+    mTotalLateness = 0;
+    mMaxLateness = 0;
+    mOverruns = 0;
+}
+
+void TimerClockProvider::run(uint64_t period) {
+
+    if( !mThreadAttributes.isDefault() ) {
+
+        ThreadAttributes::Failures failures = mThreadAttributes.apply();
+
+        if( failures != ThreadAttributes::kNone ) {
+            WARNING_THIS("TimerClockProvider::run") << "Failed to apply thread "
+            "attributes, Failures=" << failures << "." << std::endl;
+        }
+    }
+
+    uint64_t deadline = monotonicNow();
+
+    // Nanoseconds published so far, and the ticks they were published as.
+    // Periods that are not a whole number of ticks are rounded, but only
+    // against the total, so the rounding never accumulates.
+    uint64_t elapsed = 0;
+    int64_t published = 0;
+
+    while( mRunning.load(std::memory_order_acquire) ) {
+
+        deadline += period;
+        sleepUntil(deadline);
+
+        uint64_t now = monotonicNow();
+        uint64_t lateness = (now > deadline) ? (now - deadline) : 0;
+        uint64_t periods = 1;
+
+        // If a whole period was missed, publish the elapsed time in a single
+        // event and schedule the next event on the period grid.
+        if( lateness >= period ) {
+
+            uint64_t skipped = lateness / period;
+
+            periods += skipped;
+            deadline += skipped * period;
+
+            mOverruns.fetch_add(skipped, std::memory_order_relaxed);
+        }
+
+        mTicks.fetch_add(1, std::memory_order_relaxed);
+        mTotalLateness.fetch_add(lateness, std::memory_order_relaxed);
+
+        if( lateness > mMaxLateness.load(std::memory_order_relaxed) ) {
+            mMaxLateness.store(lateness, std::memory_order_relaxed);
+        }
+
+        elapsed += periods * period;
+
+        int64_t ticks = Duration::fromNanoseconds(static_cast<int64_t>(elapsed)).ticks();
+        publish(Duration::fromTicks(ticks - published));
+        published = ticks;
+    }
+
+    INFO_THIS("TimerClockProvider::run") << "Stopped after " << mTicks.load()
+    << " ticks." << std::endl;
+}
@@ -6,8 +6,16 @@
  *
  */
 
-#include <sstream>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <fstream>
 #include <iostream>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+#include <syslog.h>
 
 #include "Ayane/Trace.h"
 
@@ -47,62 +55,519 @@ using namespace Ayane;
 #endif
 
 
-class LockedOutputStream : public std::ostream {
-public:
+namespace {
     
-    LockedOutputStream(std::ostream &outputStream, std::mutex &mutex) :
-        std::ostream(outputStream.rdbuf()),
-        mMutex(mutex)
-    {
-        mMutex.lock();
+    // Number of threads that can log at once.
+    const int kRings = 32;
+    
+    // Size of each thread's ring. Must be a power of two.
+    const uint64_t kRingSize = 16384;
+    
+    // Interval at which the rings are drained.
+    const std::chrono::milliseconds kDrainInterval(10);
+    
+    // Size of a record's header in a ring: the record's length, priority,
+    // signature and instance.
+    const size_t kHeaderSize = sizeof(uint32_t) + sizeof(uint32_t) +
+                               sizeof(const char*) + sizeof(const void*);
+    
+    /*
+     * A single-producer, single-consumer ring of records. The producer is
+     * the thread that claimed the ring, and the consumer is whichever
+     * thread holds the drain lock.
+     */
+    struct TraceRing {
+        
+        TraceRing() :
+            mClaimed(false),
+            mHead(0),
+            mTail(0),
+            mDropped(0),
+            mReported(0),
+            mStorage(new unsigned char[kRingSize])
+        {
+        }
+        
+        ~TraceRing() {
+            delete [] mStorage;
+        }
+        
+        void copyIn(uint64_t position, const void *data, size_t size) {
+            
+            size_t offset = static_cast<size_t>(position & (kRingSize - 1));
+            size_t first = std::min(size, static_cast<size_t>(kRingSize) - offset);
+            
+            std::memcpy(mStorage + offset, data, first);
+            std::memcpy(mStorage, static_cast<const unsigned char*>(data) + first, size - first);
+        }
+        
+        void copyOut(uint64_t position, void *data, size_t size) const {
+            
+            size_t offset = static_cast<size_t>(position & (kRingSize - 1));
+            size_t first = std::min(size, static_cast<size_t>(kRingSize) - offset);
+            
+            std::memcpy(data, mStorage + offset, first);
+            std::memcpy(static_cast<unsigned char*>(data) + first, mStorage, size - first);
+        }
+        
+        std::atomic_bool mClaimed;
+        
+        std::atomic<uint64_t> mHead;
+        std::atomic<uint64_t> mTail;
+        
+        std::atomic<uint64_t> mDropped;
+        uint64_t mReported;
+        
+        unsigned char *mStorage;
+    };
+    
+    /*
+     * Releases the thread's ring when the thread exits.
+     */
+    struct TraceThread {
+        
+        ~TraceThread() {
+            if( mRing ) {
+                mRing->mClaimed.store(false, std::memory_order_release);
+                mRing = nullptr;
+            }
+        }
+        
+        TraceRing *mRing;
+    };
+    
+    thread_local TraceThread tThread = { nullptr };
+    
+    /*
+     * Writes the messages still queued when the program exits.
+     */
+    void flushAtExit() {
+        Trace::instance().flush();
+    }
+    
+    int systemLogPriority(Trace::Priority priority) {
+        switch(priority) {
+            case Trace::kError:
+                return LOG_ERR;
+            case Trace::kWarning:
+                return LOG_WARNING;
+            case Trace::kNotice:
+                return LOG_NOTICE;
+            case Trace::kInfo:
+                return LOG_INFO;
+            default:
+                return LOG_DEBUG;
+        }
+    }
+    
+    const char *colour(Trace::Priority priority) {
+        switch(priority) {
+            case Trace::kError:
+                return ANSI_RED;
+            case Trace::kWarning:
+                return ANSI_YELLOW;
+            case Trace::kNotice:
+                return ANSI_BLUE;
+            case Trace::kInfo:
+                return ANSI_CYAN;
+            default:
+                return ANSI_GREEN;
+        }
     }
     
-    explicit LockedOutputStream(LockedOutputStream &lockedStream) :
-        std::ostream(lockedStream.rdbuf()),
-        mMutex(lockedStream.mMutex)
+}
+
+namespace Ayane {
+    
+    class TracePrivate {
+    public:
+        
+        TracePrivate();
+        ~TracePrivate();
+        
+        TraceRing *claim();
+        void write(const TraceRecord &record);
+        
+        void drain();
+        void format(Trace::Priority priority, const char *signature,
+                    const void *instance, const unsigned char *data, size_t length);
+        void emit(Trace::Priority priority, const std::string &line);
+        
+        void drainThread();
+        
+        TraceRing mRings[kRings];
+        std::atomic<uint64_t> mUnclaimedDropped;
+        uint64_t mUnclaimedReported;
+        
+        // Held while draining, and while changing the output.
+        std::mutex mDrainMutex;
+        
+        Trace::Output mOutput;
+        std::string mFilePath;
+        std::ofstream mFile;
+        
+        std::thread mDrainThread;
+        std::mutex mStopMutex;
+        std::condition_variable mStopNotification;
+        bool mStopping;
+    };
+    
+}
+
+
+TracePrivate::TracePrivate() :
+    mUnclaimedDropped(0),
+    mUnclaimedReported(0),
+    mOutput(Trace::kStandardOutput),
+    mStopping(false)
+{
+    mDrainThread = std::thread(&TracePrivate::drainThread, this);
+}
+
+TracePrivate::~TracePrivate() {
+    
     {
+        std::lock_guard<std::mutex> lock(mStopMutex);
+        mStopping = true;
+    }
+    
+    mStopNotification.notify_one();
+    mDrainThread.join();
+    
+    drain();
+    
+    if( mOutput == Trace::kSystemLog ) {
+        closelog();
+    }
+}
+
+TraceRing *TracePrivate::claim() {
+    
+    for(int i = 0; i < kRings; ++i) {
+        
+        bool claimed = false;
+        
+        if( mRings[i].mClaimed.compare_exchange_strong(claimed, true, std::memory_order_acquire) ) {
+            return &mRings[i];
+        }
+    }
+    
+    return nullptr;
+}
+
+void TracePrivate::write(const TraceRecord &record) {
+    
+    if( tThread.mRing == nullptr ) {
+        tThread.mRing = claim();
+        
+        if( tThread.mRing == nullptr ) {
+            mUnclaimedDropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+    }
+    
+    TraceRing *ring = tThread.mRing;
+    
+    uint32_t length = static_cast<uint32_t>(kHeaderSize + record.mLength);
+    uint32_t priority = record.mPriority;
+    
+    uint64_t tail = ring->mTail.load(std::memory_order_relaxed);
+    uint64_t head = ring->mHead.load(std::memory_order_acquire);
+    
+    if( (kRingSize - (tail - head)) < length ) {
+        ring->mDropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    
+    ring->copyIn(tail, &length, sizeof(length));
+    tail += sizeof(length);
+    ring->copyIn(tail, &priority, sizeof(priority));
+    tail += sizeof(priority);
+    ring->copyIn(tail, &record.mSignature, sizeof(record.mSignature));
+    tail += sizeof(record.mSignature);
+    ring->copyIn(tail, &record.mInstance, sizeof(record.mInstance));
+    tail += sizeof(record.mInstance);
+    ring->copyIn(tail, record.mData, record.mLength);
+    tail += record.mLength;
+    
+    ring->mTail.store(tail, std::memory_order_release);
+}
+
+void TracePrivate::drain() {
+    
+    std::lock_guard<std::mutex> lock(mDrainMutex);
+    
+    unsigned char data[TraceRecord::kCapacity];
+    
+    for(int i = 0; i < kRings; ++i) {
+        
+        TraceRing &ring = mRings[i];
+        
+        uint64_t head = ring.mHead.load(std::memory_order_relaxed);
+        uint64_t tail = ring.mTail.load(std::memory_order_acquire);
+        
+        while( head < tail ) {
+            
+            uint32_t length;
+            uint32_t priority;
+            const char *signature;
+            const void *instance;
+            
+            ring.copyOut(head, &length, sizeof(length));
+            ring.copyOut(head + sizeof(length), &priority, sizeof(priority));
+            ring.copyOut(head + sizeof(length) + sizeof(priority), &signature, sizeof(signature));
+            ring.copyOut(head + sizeof(length) + sizeof(priority) + sizeof(signature),
+                         &instance, sizeof(instance));
+            ring.copyOut(head + kHeaderSize, data, length - kHeaderSize);
+            
+            head += length;
+            
+            format(static_cast<Trace::Priority>(priority), signature, instance,
+                   data, length - kHeaderSize);
+        }
+        
+        ring.mHead.store(head, std::memory_order_release);
+        
+        uint64_t dropped = ring.mDropped.load(std::memory_order_relaxed);
+        
+        if( dropped != ring.mReported ) {
+            
+            std::ostringstream line;
+            line << "Trace: Dropped " << (dropped - ring.mReported)
+                 << " messages from a thread." << std::endl;
+            emit(Trace::kWarning, line.str());
+            
+            ring.mReported = dropped;
+        }
+    }
+    
+    uint64_t dropped = mUnclaimedDropped.load(std::memory_order_relaxed);
+    
+    if( dropped != mUnclaimedReported ) {
+        
+        std::ostringstream line;
+        line << "Trace: Dropped " << (dropped - mUnclaimedReported)
+             << " messages from threads without a ring." << std::endl;
+        emit(Trace::kWarning, line.str());
+        
+        mUnclaimedReported = dropped;
+    }
+    
+    if( mOutput == Trace::kStandardOutput ) {
+        std::cout.flush();
+    }
+    else if( mOutput == Trace::kFile ) {
+        mFile.flush();
+    }
+}
+
+void TracePrivate::format(Trace::Priority priority, const char *signature,
+                          const void *instance, const unsigned char *data, size_t length)
+{
+    bool colours = (mOutput == Trace::kStandardOutput) || (mOutput == Trace::kStandardError);
+    
+    std::ostringstream line;
+    
+    if( colours ) {
+        line << colour(priority);
+    }
+    
+    if( instance ) {
+        line << "(" << instance << ") ";
+    }
+    
+    line << signature << ": ";
+    
+    if( colours ) {
+        line << ANSI_COLOUR_END;
+    }
+    
+    size_t position = 0;
+    
+    while( position < length ) {
         
+        unsigned char kind = data[position++];
+        
+        switch(kind) {
+            case TraceRecord::kString: {
+                uint16_t size;
+                std::memcpy(&size, data + position, sizeof(size));
+                position += sizeof(size);
+                line.write(reinterpret_cast<const char*>(data + position), size);
+                position += size;
+                break;
+            }
+            case TraceRecord::kValue: {
+                TraceRecord::Formatter formatter;
+                std::memcpy(&formatter, data + position, sizeof(formatter));
+                position += sizeof(formatter);
+                unsigned char size = data[position++];
+                formatter(line, data + position);
+                position += size;
+                break;
+            }
+            case TraceRecord::kStreamManipulator: {
+                std::ostream &(*manipulator)(std::ostream&);
+                std::memcpy(&manipulator, data + position, sizeof(manipulator));
+                position += sizeof(manipulator);
+                manipulator(line);
+                break;
+            }
+            case TraceRecord::kBaseManipulator: {
+                std::ios_base &(*manipulator)(std::ios_base&);
+                std::memcpy(&manipulator, data + position, sizeof(manipulator));
+                position += sizeof(manipulator);
+                manipulator(line);
+                break;
+            }
+            default:
+                position = length;
+                break;
+        }
     }
     
-    ~LockedOutputStream(){
-        mMutex.unlock();
+    emit(priority, line.str());
+}
+
+void TracePrivate::emit(Trace::Priority priority, const std::string &line) {
+    
+    switch(mOutput) {
+        case Trace::kStandardOutput:
+            std::cout << line;
+            break;
+        case Trace::kStandardError:
+            std::cerr << line;
+            break;
+        case Trace::kFile:
+            mFile << line;
+            break;
+        case Trace::kSystemLog: {
+            // Each message is its own syslog entry, so drop the newline.
+            size_t length = line.size();
+            
+            if( (length > 0) && (line[length - 1] == '\n') ) {
+                --length;
+            }
+            
+            syslog(systemLogPriority(priority), "%.*s", static_cast<int>(length), line.c_str());
+            break;
+        }
     }
+}
+
+void TracePrivate::drainThread() {
     
-private:
-    std::mutex &mMutex;
-};
+    std::unique_lock<std::mutex> lock(mStopMutex);
+    
+    while( !mStopping ) {
+        
+        lock.unlock();
+        drain();
+        lock.lock();
+        
+        if( !mStopping ) {
+            mStopNotification.wait_for(lock, kDrainInterval);
+        }
+    }
+}
+
+
+
+TraceRecord::TraceRecord() :
+    mActive(false),
+    mPriority(Trace::kNone),
+    mSignature(nullptr),
+    mInstance(nullptr),
+    mLength(0)
+{
+}
 
+TraceRecord::TraceRecord(Trace::Priority priority, const char *signature, const void *instance) :
+    mActive(true),
+    mPriority(priority),
+    mSignature(signature),
+    mInstance(instance),
+    mLength(0)
+{
+}
 
+TraceRecord::TraceRecord(TraceRecord &&other) :
+    mActive(other.mActive),
+    mPriority(other.mPriority),
+    mSignature(other.mSignature),
+    mInstance(other.mInstance),
+    mLength(other.mLength)
+{
+    std::memcpy(mData, other.mData, mLength);
+    
+    // Only the last record moved to commits the message.
+    other.mActive = false;
+}
 
-class NullOutputBuffer : public std::streambuf {
-public:
-    virtual std::streamsize xsputn (const char * s, std::streamsize n) {
-#pragma unused(s)
-        return n;
+TraceRecord::~TraceRecord() {
+    if( mActive ) {
+        Trace::instance().commit(*this);
     }
-    virtual int overflow (int c) {
-#pragma unused(c)
-        return 1;
+}
+
+void TraceRecord::appendString(const char *string, size_t length) {
+    
+    uint16_t size = static_cast<uint16_t>(std::min(length, kCapacity));
+    
+    if( (mLength + 1 + sizeof(size)) >= kCapacity ) {
+        return;
+    }
+    
+    // Truncate to the space left.
+    size = static_cast<uint16_t>(std::min<size_t>(size, kCapacity - mLength - 1 - sizeof(size)));
+    
+    mData[mLength++] = kString;
+    std::memcpy(mData + mLength, &size, sizeof(size));
+    mLength += sizeof(size);
+    std::memcpy(mData + mLength, string, size);
+    mLength += size;
+}
+
+void TraceRecord::appendPointer(Kind kind, void (*pointer)()) {
+    
+    if( (mLength + 1 + sizeof(pointer)) > kCapacity ) {
+        return;
+    }
+    
+    mData[mLength++] = static_cast<unsigned char>(kind);
+    std::memcpy(mData + mLength, &pointer, sizeof(pointer));
+    mLength += sizeof(pointer);
+}
+
+void TraceRecord::appendValue(Formatter formatter, const void *value, size_t size) {
+    
+    if( (mLength + 2 + sizeof(formatter) + size) > kCapacity ) {
+        return;
     }
-};
+    
+    mData[mLength++] = kValue;
+    std::memcpy(mData + mLength, &formatter, sizeof(formatter));
+    mLength += sizeof(formatter);
+    mData[mLength++] = static_cast<unsigned char>(size);
+    std::memcpy(mData + mLength, value, size);
+    mLength += size;
+}
 
-class NullOutputStream : public std::ostream {
-public:
-    NullOutputStream() : std::ostream(&buf) {}
-private:
-    NullOutputBuffer buf;
-};
 
-NullOutputStream cnul;
 
+std::atomic<Trace::Priority> Trace::mMaximumPriority(Trace::kTrace);
 
+const size_t TraceRecord::kCapacity;
 
-Trace::Trace() : mMaximumPriority(kTrace)
+Trace::Trace() :
+    d_ptr(new TracePrivate)
 {
+    std::atexit(&flushAtExit);
 }
 
 Trace::~Trace()
 {
+    delete d_ptr;
 }
 
 Trace::Priority Trace::priority() const {
@@ -113,118 +578,147 @@ void Trace::setPriority(Priority priority) {
     mMaximumPriority = priority;
 }
 
-std::ostream &Trace::trace(const char *signature) {
-    if(mMaximumPriority >= kTrace){
-        std::cout << ANSI_GREEN << signature << ": " ANSI_COLOUR_END;
-        return std::cout;
-    }
-    else {
-        return cnul;
-    }
+Trace::Output Trace::output() const {
+    A_D(const Trace);
+    return d->mOutput;
 }
 
-std::ostream &Trace::trace(const char *signature, const void *instance) {
-    if(mMaximumPriority >= kTrace){
-
-        std::cout << ANSI_GREEN "(" << instance << ") " << signature << ": " ANSI_COLOUR_END;
-        return std::cout;
+void Trace::setOutput(Output output) {
+    A_D(Trace);
+    
+    // Write what has been logged so far to the old output.
+    d->drain();
+    
+    std::lock_guard<std::mutex> lock(d->mDrainMutex);
+    
+    if( d->mOutput == output ) {
+        return;
     }
-    else {
-        return cnul;
+    
+    if( d->mOutput == kSystemLog ) {
+        closelog();
     }
-}
-
-
-std::ostream &Trace::info(const char *signature) {
-    if(mMaximumPriority >= kInfo){
-
-        std::cout << ANSI_CYAN << signature << ": " ANSI_COLOUR_END;
-        return std::cout;
+    else if( d->mOutput == kFile ) {
+        d->mFile.close();
+    }
+    
+    if( output == kSystemLog ) {
+        openlog(nullptr, LOG_PID, LOG_USER);
     }
-    else {
-        return cnul;
+    else if( output == kFile ) {
+        
+        d->mFile.open(d->mFilePath.c_str(), std::ios::out | std::ios::app);
+        
+        // Fall back to standard error if there is no file to write to.
+        if( !d->mFile.is_open() ) {
+            output = kStandardError;
+        }
     }
+    
+    d->mOutput = output;
 }
 
-std::ostream &Trace::info(const char *signature, const void *instance) {
-    if(mMaximumPriority >= kInfo){
-        
-        std::cout << ANSI_CYAN "(" << instance << ") " << signature << ": " ANSI_COLOUR_END;
-        return std::cout;
+bool Trace::setOutputFile(const std::string &path) {
+    A_D(Trace);
+    
+    std::ofstream file(path.c_str(), std::ios::out | std::ios::app);
+    
+    if( !file.is_open() ) {
+        return false;
     }
-    else {
-        return cnul;
+    
+    file.close();
+    
+    {
+        std::lock_guard<std::mutex> lock(d->mDrainMutex);
+        d->mFilePath = path;
+        
+        // Reopen the file if it's already the output.
+        if( d->mOutput == kFile ) {
+            d->mOutput = kStandardError;
+            d->mFile.close();
+        }
     }
+    
+    setOutput(kFile);
+    return true;
 }
 
+void Trace::flush() {
+    A_D(Trace);
+    d->drain();
+}
 
-std::ostream &Trace::notice(const char *signature){
-    if(mMaximumPriority >= kNotice){
-        
-        std::cout << ANSI_BLUE << signature << ": " ANSI_COLOUR_END;
-        return std::cout;
-    }
-    else {
-        return cnul;
+void Trace::prepareThread() {
+    A_D(Trace);
+    
+    if( tThread.mRing == nullptr ) {
+        tThread.mRing = d->claim();
     }
 }
 
-std::ostream &Trace::notice(const char *signature, const void *instance){
-    if(mMaximumPriority >= kNotice){
-        
-        std::cout << ANSI_BLUE "(" << instance << ") " << signature << ": " ANSI_COLOUR_END;
-        return std::cout;
+uint64_t Trace::droppedMessages() const {
+    A_D(const Trace);
+    
+    uint64_t dropped = d->mUnclaimedDropped.load();
+    
+    for(int i = 0; i < kRings; ++i) {
+        dropped += d->mRings[i].mDropped.load();
     }
-    else {
-        return cnul;
+    
+    return dropped;
+}
+
+TraceRecord Trace::record(Priority priority, const char *signature, const void *instance) {
+    
+    if( isEnabled(priority) ) {
+        return TraceRecord(priority, signature, instance);
     }
+    
+    return TraceRecord();
 }
 
+void Trace::commit(const TraceRecord &record) {
+    A_D(Trace);
+    d->write(record);
+}
 
-std::ostream &Trace::warning(const char *signature){
-    if(mMaximumPriority >= kWarning){
-        
-        std::cout << ANSI_YELLOW << signature << ": " ANSI_COLOUR_END;
-        return std::cout;
-    }
-    else {
-        return cnul;
-    }
+TraceRecord Trace::trace(const char *signature) {
+    return record(kTrace, signature, nullptr);
 }
 
-std::ostream &Trace::warning(const char *signature, const void *instance){
-    if(mMaximumPriority >= kWarning){
-        
-        std::cout << ANSI_YELLOW "(" << instance << ") " << signature << ": " ANSI_COLOUR_END;
-        return std::cout;
-    }
-    else {
-        return cnul;
-    }
+TraceRecord Trace::trace(const char *signature, const void *instance) {
+    return record(kTrace, signature, instance);
 }
 
+TraceRecord Trace::info(const char *signature) {
+    return record(kInfo, signature, nullptr);
+}
 
+TraceRecord Trace::info(const char *signature, const void *instance) {
+    return record(kInfo, signature, instance);
+}
 
-std::ostream &Trace::error(const char *signature){
-    if(mMaximumPriority >= kError){
-        
-        std::cout << ANSI_RED << signature << ": " ANSI_COLOUR_END;
-        return std::cout;
-    }
-    else {
-        return cnul;
-    }
+TraceRecord Trace::notice(const char *signature) {
+    return record(kNotice, signature, nullptr);
 }
 
-std::ostream &Trace::error(const char *signature, const void *instance){
-    if(mMaximumPriority >= kError){
-        std::cout << ANSI_RED "(" << instance << ") " << signature << ": " ANSI_COLOUR_END;
-        return std::cout;
-    }
-    else {
-        return cnul;
-    }
+TraceRecord Trace::notice(const char *signature, const void *instance) {
+    return record(kNotice, signature, instance);
+}
+
+TraceRecord Trace::warning(const char *signature) {
+    return record(kWarning, signature, nullptr);
 }
 
+TraceRecord Trace::warning(const char *signature, const void *instance) {
+    return record(kWarning, signature, instance);
+}
 
+TraceRecord Trace::error(const char *signature) {
+    return record(kError, signature, nullptr);
+}
 
+TraceRecord Trace::error(const char *signature, const void *instance) {
+    return record(kError, signature, instance);
+}
@@ -0,0 +1,116 @@
+/*
+ *
+ * Copyright (c) 2013 Philip Deljanov. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ */
+
+#include <cmath>
+
+#include "Ayane/VariableResampler.h"
+
+using namespace Ayane;
+
+namespace {
+
+    const double kPi = 3.14159265358979323846;
+
+    // Kaiser window shape. Gives roughly 90dB of stopband attenuation.
+    const double kBeta = 8.6;
+
+    // Cutoff as a fraction of the Nyquist frequency. Leaves room for the
+    // transition band of a 48 tap filter below Nyquist.
+    const double kCutoff = 0.88;
+
+    // Zeroth order modified Bessel function of the first kind.
+    double besselI0(double x) {
+
+        double sum = 1.0;
+        double term = 1.0;
+
+        for(int k = 1; k < 64; ++k) {
+            term *= (x / (2.0 * k)) * (x / (2.0 * k));
+            sum += term;
+
+            if( term < (sum * 1e-12) ) {
+                break;
+            }
+        }
+
+        return sum;
+    }
+
+}
+
+VariableResampler::VariableResampler(uint32_t taps) :
+    mTaps((taps < 2) ? 2 : (taps & ~1u))
+{
+
+}
+
+void VariableResampler::configure(double ratio) {
+
+    // When downsampling, the cutoff must follow the output's Nyquist.
+    double cutoff = kCutoff * ((ratio > 1.0) ? (1.0 / ratio) : 1.0);
+
+    double half = mTaps / 2.0;
+    double normalization = besselI0(kBeta);
+
+    mFilters.assign(static_cast<size_t>(kPhases + 1) * mTaps, 0.0f);
+
+    for(uint32_t phase = 0; phase <= kPhases; ++phase) {
+
+        double fraction = static_cast<double>(phase) / kPhases;
+        float *filter = &mFilters[phase * mTaps];
+        double sum = 0.0;
+
+        for(uint32_t k = 0; k < mTaps; ++k) {
+
+            // Distance of the tap from the interpolated position.
+            double x = static_cast<double>(k) - history() - fraction;
+            double sinc = (x == 0.0) ? 1.0 : std::sin(kPi * cutoff * x) / (kPi * cutoff * x);
+
+            double w = x / half;
+            double window = (std::fabs(w) < 1.0) ?
+                besselI0(kBeta * std::sqrt(1.0 - (w * w))) / normalization : 0.0;
+
+            double h = cutoff * sinc * window;
+
+            filter[k] = static_cast<float>(h);
+            sum += h;
+        }
+
+        // Unity gain at DC for every phase, so the level does not ripple
+        // as the position moves through the phases.
+        for(uint32_t k = 0; k < mTaps; ++k) {
+            filter[k] = static_cast<float>(filter[k] / sum);
+        }
+    }
+}
+
+float VariableResampler::interpolate(const float *input, double fraction) const {
+
+    double position = fraction * kPhases;
+    uint32_t phase = static_cast<uint32_t>(position);
+
+    if( phase >= kPhases ) {
+        phase = kPhases - 1;
+    }
+
+    float t = static_cast<float>(position - phase);
+
+    const float *first = &mFilters[phase * mTaps];
+    const float *second = first + mTaps;
+    const float *x = input - history();
+
+    float a = 0.0f;
+    float b = 0.0f;
+
+    for(uint32_t k = 0; k < mTaps; ++k) {
+        a += x[k] * first[k];
+        b += x[k] * second[k];
+    }
+
+    return a + (t * (b - a));
+}
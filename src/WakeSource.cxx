@@ -0,0 +1,92 @@
+/*
+ *
+ * Copyright (c) 2013 Philip Deljanov. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ */
+
+#if defined(__linux__)
+#include <climits>
+#include <ctime>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "Ayane/WakeSource.h"
+
+using namespace Ayane;
+
+WakeSource::WakeSource() :
+    mGeneration(0),
+    mWaiters(0)
+{
+
+}
+
+void WakeSource::wait(uint32_t generation) {
+
+    // Registering as a waiter before sleeping pairs with the check in
+    // wakeAll(). Either the waker sees the waiter, or the waiter sees the
+    // new generation.
+    mWaiters.fetch_add(1);
+
+#if defined(__linux__)
+    // Returns immediately if the generation has already changed.
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&mGeneration),
+            FUTEX_WAIT_PRIVATE, generation, nullptr, nullptr, 0);
+#else
+    std::unique_lock<std::mutex> lock(mMutex);
+
+    while( mGeneration.load() == generation ) {
+        mCondition.wait(lock);
+    }
+#endif
+
+    mWaiters.fetch_sub(1);
+}
+
+void WakeSource::wait(uint32_t generation, std::chrono::nanoseconds timeout) {
+
+    if( timeout.count() <= 0 ) {
+        return;
+    }
+
+    mWaiters.fetch_add(1);
+
+#if defined(__linux__)
+    struct timespec relative;
+    relative.tv_sec = static_cast<time_t>(timeout.count() / 1000000000);
+    relative.tv_nsec = static_cast<long>(timeout.count() % 1000000000);
+
+    // Returns immediately if the generation has already changed.
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&mGeneration),
+            FUTEX_WAIT_PRIVATE, generation, &relative, nullptr, 0);
+#else
+    std::unique_lock<std::mutex> lock(mMutex);
+
+    mCondition.wait_for(lock, timeout, [this, generation]() {
+        return mGeneration.load() != generation;
+    });
+#endif
+
+    mWaiters.fetch_sub(1);
+}
+
+void WakeSource::wakeAll() {
+
+    mGeneration.fetch_add(1);
+
+    if( mWaiters.load() == 0 ) {
+        return;
+    }
+
+#if defined(__linux__)
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&mGeneration),
+            FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+#else
+    std::lock_guard<std::mutex> lock(mMutex);
+    mCondition.notify_all();
+#endif
+}